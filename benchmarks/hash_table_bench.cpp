@@ -0,0 +1,121 @@
+// Compares the insert and find throughput of bit_hash_table when the probes are filtered
+// with the tag bytes (SIMD groups) against the probing that compares every key. The keys
+// are random phrases of 32-bit symbols, like the ones of the LMS parsing rounds.
+//
+// usage: hash_table_bench [N_KEYS] [MAX_PHRASE_LEN] [BUFFER_MB]
+//
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include "cdt/hash_table.hpp"
+
+typedef bit_hash_table<size_t, 44, size_t, 32, true>  tag_table_t;
+typedef bit_hash_table<size_t, 44, size_t, 32, false> plain_table_t;
+
+struct bench_stats{
+    size_t n_ops=0;
+    size_t n_hits=0;
+    size_t time=0;
+};
+
+struct phrase_set{
+    std::vector<uint32_t> symbols;
+    std::vector<size_t>   starts;
+
+    phrase_set(size_t n, size_t max_len, uint64_t seed){
+        std::mt19937_64 gen(seed);
+        std::uniform_int_distribution<size_t> len_dist(2, max_len);
+        std::uniform_int_distribution<uint32_t> sym_dist(0, 1U<<20U);
+        starts.push_back(0);
+        for(size_t i=0;i<n;i++){
+            size_t len = len_dist(gen);
+            for(size_t j=0;j<len;j++) symbols.push_back(sym_dist(gen));
+            starts.push_back(symbols.size());
+        }
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return starts.size()-1;
+    }
+
+    [[nodiscard]] inline const uint32_t* key(size_t i) const {
+        return symbols.data()+starts[i];
+    }
+
+    [[nodiscard]] inline size_t key_bits(size_t i) const {
+        return (starts[i+1]-starts[i])*32;
+    }
+};
+
+template<class F>
+bench_stats run(size_t n_ops, F&& op){
+    bench_stats stats;
+    auto start = std::chrono::high_resolution_clock::now();
+    for(size_t i=0;i<n_ops;i++){
+        stats.n_hits += op(i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.n_ops = n_ops;
+    stats.time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    return stats;
+}
+
+void print_stats(const std::string& name, const bench_stats& stats){
+    std::cout<<"    "<<name<<std::endl;
+    std::cout<<"      Hits:                     "<<stats.n_hits<<" of "<<stats.n_ops<<std::endl;
+    std::cout<<"      Elap. time (microsec):    "<<stats.time<<std::endl;
+    std::cout<<"      Throughput (Mops/sec):    "<<(stats.time==0 ? 0.0 : double(stats.n_ops)/stats.time)<<std::endl;
+}
+
+template<class table_t>
+void bench_table(const std::string& name, const phrase_set& keys, const phrase_set& misses, size_t buffer_bytes){
+    std::cout<<"  "<<name<<std::endl;
+    {
+        //the keys are inserted twice: the first insertion of a key goes to an empty
+        // place, and the second one finds the key already in the table
+        table_t table(buffer_bytes, "", 0.85);
+        size_t n = keys.size();
+        auto ins_stats = run(n, [&](size_t i){
+            return !table.insert(keys.key(i), keys.key_bits(i), i).second;
+        });
+        print_stats("Insert (new keys)", ins_stats);
+        std::cout<<"      Max. bucket distance:     "<<table.max_bucket_dist()<<std::endl;
+
+        auto dup_stats = run(n, [&](size_t i){
+            return !table.insert(keys.key(i), keys.key_bits(i), i).second;
+        });
+        print_stats("Insert (existing keys)", dup_stats);
+
+        auto hit_stats = run(n, [&](size_t i){
+            return table.find(keys.key(i), keys.key_bits(i)).second;
+        });
+        print_stats("Find (hits)", hit_stats);
+
+        auto miss_stats = run(misses.size(), [&](size_t i){
+            return table.find(misses.key(i), misses.key_bits(i)).second;
+        });
+        print_stats("Find (misses)", miss_stats);
+    }
+}
+
+int main(int argc, char** argv){
+
+    size_t n_keys = argc>1 ? std::stoul(argv[1]) : 4000000;
+    size_t max_len = argc>2 ? std::stoul(argv[2]) : 8;
+    size_t buffer_bytes = argc>3 ? std::stoul(argv[3])*1024*1024 : 0;
+
+    if(n_keys==0 || max_len<2){
+        std::cout<<"usage: "<<argv[0]<<" [N_KEYS] [MAX_PHRASE_LEN>=2] [BUFFER_MB]"<<std::endl;
+        exit(1);
+    }
+
+    phrase_set keys(n_keys, max_len, 42);
+    phrase_set misses(n_keys, max_len, 4242);
+    std::cout<<"Hashing "<<n_keys<<" random phrases of 2 to "<<max_len<<" symbols"<<std::endl;
+
+    bench_table<plain_table_t>("Full key comparisons", keys, misses, buffer_bytes);
+    bench_table<tag_table_t>("Tag bytes", keys, misses, buffer_bytes);
+
+    return 0;
+}
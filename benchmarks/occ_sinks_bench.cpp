@@ -0,0 +1,113 @@
+// Compares the cost of collecting the occurrences of a pattern list with the different
+// sinks of lpg_index::locate. Every heap allocation is counted by replacing the global
+// operator new.
+//
+// usage: occ_sinks_bench INDEX PATTERN_LIST
+//
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include "lpg/lpg_index.hpp"
+
+static std::atomic<size_t> n_allocs{0};
+static std::atomic<size_t> alloc_bytes{0};
+
+void* operator new(std::size_t size){
+    n_allocs.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if(void *ptr = std::malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept{
+    std::free(ptr);
+}
+
+struct bench_stats{
+    size_t occ=0;
+    size_t time=0;
+    size_t allocs=0;
+    size_t bytes=0;
+};
+
+template<class F>
+bench_stats run(const std::vector<std::string>& patterns, F&& locate_pattern){
+    bench_stats stats;
+    size_t allocs = n_allocs.load(), bytes = alloc_bytes.load();
+    auto start = std::chrono::high_resolution_clock::now();
+    for(auto const& pattern : patterns){
+        stats.occ += locate_pattern(pattern);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    stats.allocs = n_allocs.load() - allocs;
+    stats.bytes = alloc_bytes.load() - bytes;
+    return stats;
+}
+
+void print_stats(const std::string& name, const bench_stats& stats){
+    std::cout<<"  "<<name<<std::endl;
+    std::cout<<"    Total occ:                "<<stats.occ<<std::endl;
+    std::cout<<"    Elap. time (microsec):    "<<stats.time<<std::endl;
+    std::cout<<"    Heap allocations:         "<<stats.allocs<<std::endl;
+    std::cout<<"    Allocated bytes:          "<<stats.bytes<<std::endl;
+}
+
+int main(int argc, char** argv){
+
+    if(argc!=3){
+        std::cout<<"usage: "<<argv[0]<<" INDEX PATTERN_LIST"<<std::endl;
+        exit(1);
+    }
+
+    lpg_index g;
+    sdsl::load_from_file(g, argv[1]);
+
+    std::vector<std::string> patterns;
+    std::fstream in(argv[2], std::ios::in | std::ios::binary);
+    std::string line;
+    while(std::getline(in, line)) patterns.push_back(line);
+
+    std::cout<<"Locating "<<patterns.size()<<" patterns"<<std::endl;
+
+    auto set_stats = run(patterns, [&](const std::string& pattern){
+        std::set<size_t> occ;
+        g.locate(pattern, occ);
+        return occ.size();
+    });
+    print_stats("std::set", set_stats);
+
+    occ_vector_sink v_sink;
+    auto vec_stats = run(patterns, [&](const std::string& pattern){
+        v_sink.clear();
+        g.locate(pattern, v_sink);
+        v_sink.finish();
+        return v_sink.size();
+    });
+    print_stats("vector sink", vec_stats);
+
+    occ_bitmap_sink b_sink(g.text_size());
+    auto bmp_stats = run(patterns, [&](const std::string& pattern){
+        b_sink.clear();
+        g.locate(pattern, b_sink);
+        return b_sink.size();
+    });
+    print_stats("bitmap sink", bmp_stats);
+
+    size_t n_occ=0;
+    auto count_occ = [&](const size_t&){ n_occ++; };
+    occ_callback_sink<decltype(count_occ)> c_sink(count_occ);
+    auto cb_stats = run(patterns, [&](const std::string& pattern){
+        size_t prev = n_occ;
+        g.locate(pattern, c_sink);
+        return n_occ - prev;
+    });
+    print_stats("callback sink (with duplicates)", cb_stats);
+
+    return 0;
+}
@@ -10,37 +10,72 @@
 #include <iostream>
 #include <cstring>
 #include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "bitstream.h"
 
+//Buffered reader of a file of sym_t cells. While the cells of the buffer are consumed, a
+// prefetch thread reads the adjacent block of the file (the next one in the direction of
+// the scan) into a second buffer, so a scan crossing a block boundary usually finds the
+// data already in memory. The hashing threads of the grammar construction scan their
+// ranges backwards, which the read-ahead of the kernel does not detect. The prefetch
+// thread is started in the first prefetch and lives until the stream is closed
 template<class sym_t>
 struct i_file_stream{
 
-    std::ifstream text_i;
+    int fd=-1;
+    size_t header{};//bytes before the first cell
     size_t tot_cells{};
     size_t block_bg{};
     bitstream<sym_t> buffer;
 
+    enum pf_state_t {PF_IDLE, PF_REQUESTED, PF_DONE};
+
+    sym_t*                  pf_stream=nullptr;//block read by the prefetch thread
+    size_t                  pf_bg{};
+    pf_state_t              pf_state=PF_IDLE;
+    bool                    pf_stop=false;
+    std::thread             pf_thread;
+    std::mutex              pf_mutex;
+    std::condition_variable pf_cv;
+    bool                    backward=false;//direction of the scan
+
     std::string file;
     static constexpr size_t w_bytes = sizeof(sym_t);
 
+    i_file_stream() = default;
+
     i_file_stream(i_file_stream<sym_t> &&other) noexcept{
         move(std::forward<i_file_stream<sym_t>>(other));
     }
 
-    i_file_stream(const std::string& i_file, size_t buff_size_){
+    i_file_stream(const std::string& i_file, size_t buff_size_, size_t header_=0){
         file =  i_file;
-        text_i = std::ifstream(file, std::ifstream::binary);
+        header = header_;
+        fd = open(file.c_str(), O_RDONLY);
+        if(fd<0){
+            std::cout<<"Error trying to open file "<<file<<std::endl;
+            exit(1);
+        }
 
-        text_i.seekg (0, std::ifstream::end);
-        tot_cells = text_i.tellg()/w_bytes;
-        text_i.seekg (0, std::ifstream::beg);
+        struct stat st{};
+        if(fstat(fd, &st)!=0){
+            std::cout<<"Error trying to get the size of file "<<file<<": "<<strerror(errno)<<std::endl;
+            exit(1);
+        }
+        tot_cells = size_t(st.st_size)>header ? (st.st_size-header)/w_bytes : 0;
 
-        size_t buff_size = std::min<size_t>(buff_size_/w_bytes, tot_cells);
+        size_t buff_size = std::max<size_t>(std::min<size_t>(buff_size_/w_bytes, tot_cells), 1);
         buffer.stream_size = buff_size;
         buffer.stream = new sym_t[buff_size];
 
-        block_bg=0;
-        text_i.read((char*) buffer.stream, buff_size*w_bytes);
+        //the first block is read in the first access, when the direction is known
+        block_bg=tot_cells;
     }
 
     i_file_stream& operator=(i_file_stream<sym_t> &&other) noexcept{
@@ -49,10 +84,17 @@ struct i_file_stream{
     }
 
     void move(i_file_stream<sym_t> &&other){
+        //the prefetch threads point to their streams
+        stop_prefetch();
+        other.stop_prefetch();
         std::swap(file, other.file);
-        std::swap(text_i, other.text_i);
+        std::swap(fd, other.fd);
+        std::swap(header, other.header);
         std::swap(tot_cells, other.tot_cells);
         std::swap(block_bg, other.block_bg);
+        std::swap(pf_stream, other.pf_stream);
+        std::swap(pf_bg, other.pf_bg);
+        std::swap(backward, other.backward);
         buffer.swap(other.buffer);
     }
 
@@ -64,12 +106,25 @@ struct i_file_stream{
         return file;
     }
 
+    //hint the direction of the scan before the first read
+    inline void set_backward(bool val){
+        backward = val;
+    }
+
     void close(bool rem=false){
+        stop_prefetch();
         if(buffer.stream!= nullptr){
             delete [] buffer.stream;
             buffer.stream = nullptr;
         }
-        if(text_i.is_open()) text_i.close();
+        if(pf_stream!=nullptr){
+            delete [] pf_stream;
+            pf_stream = nullptr;
+        }
+        if(fd>=0){
+            ::close(fd);
+            fd = -1;
+        }
         if(rem){
             if(remove(file.c_str())){
                 std::cout<<"Error trying to remove file"<<file<<std::endl;
@@ -84,35 +139,135 @@ struct i_file_stream{
     inline size_t read(size_t i) {
         assert(i<tot_cells);
         if(i<block_bg || (block_bg+buffer.stream_size)<=i){
-            block_bg = (i/buffer.stream_size)*buffer.stream_size;
-            text_i.seekg(block_bg*w_bytes);
-            text_i.read((char*) buffer.stream, buffer.stream_size*w_bytes);
-            if((unsigned int)text_i.gcount()<(buffer.stream_size*w_bytes)){
-                text_i.clear();
-            }
+            fetch((i/buffer.stream_size)*buffer.stream_size);
         }
         return buffer.stream[i-block_bg];
     }
 
     inline void read_chunk(void *dst, size_t i, size_t j) {
         assert(i<=j);
+        size_t start = load_bits(i, j);
+        buffer.read_chunk(dst, start, start+(j-i));
+    }
+
+    //read the bits [i..j] (at most one word)
+    inline size_t read_bits(size_t i, size_t j) {
+        assert(i<=j && (j-i)<bitstream<sym_t>::word_bits);
+        size_t start = load_bits(i, j);
+        return buffer.read(start, start+(j-i));
+    }
 
+private:
+
+    //make the buffer contain the cells with the bits [i..j], and return the position of i
+    // in the buffer
+    inline size_t load_bits(size_t i, size_t j) {
         size_t cell_i = i/(w_bytes*8);
         size_t cell_j = j/(w_bytes*8);
 
         assert(cell_j<tot_cells && (cell_j-cell_i+1)<=buffer.stream_size);
 
         if(cell_i<block_bg || (block_bg+buffer.stream_size)<=cell_j){
-            block_bg = cell_i;
-            text_i.seekg(cell_i*w_bytes);
-            text_i.read((char*) buffer.stream, buffer.stream_size*w_bytes);
-            if((unsigned int)text_i.gcount()<(buffer.stream_size*w_bytes)){
-                text_i.clear();
+            if(block_bg<tot_cells && cell_j<block_bg){//backward scan: cell_j is the last cell of the block
+                fetch(cell_j+1>buffer.stream_size ? cell_j+1-buffer.stream_size : 0);
+            }else{
+                fetch(cell_i);
             }
         }
+        return i - block_bg*w_bytes*8;
+    }
 
-        size_t start = i - block_bg*w_bytes*8;
-        buffer.read_chunk(dst, start, start+(j-i));
+    void read_cells(sym_t* dst, size_t bg) const {
+        size_t to_read = std::min<size_t>(buffer.stream_size, tot_cells-bg)*w_bytes, n=0;
+        auto* tmp_dst = reinterpret_cast<char*>(dst);
+        while(n<to_read){
+            ssize_t r = pread(fd, tmp_dst+n, to_read-n, off_t(header+bg*w_bytes+n));
+            if(r<0 && errno==EINTR) continue;
+            if(r<0){
+                std::cout<<"Error trying to read file "<<file<<": "<<strerror(errno)<<std::endl;
+                exit(1);
+            }
+            if(r==0){
+                std::cout<<"Error trying to read file "<<file<<": it ended after "<<header+bg*w_bytes+n
+                         <<" bytes, but "<<header+bg*w_bytes+to_read<<" were expected"<<std::endl;
+                exit(1);
+            }
+            n += size_t(r);
+        }
+    }
+
+    void prefetch_loop(){
+        std::unique_lock<std::mutex> lk(pf_mutex);
+        while(true){
+            pf_cv.wait(lk, [this]{ return pf_state==PF_REQUESTED || pf_stop; });
+            if(pf_state==PF_REQUESTED){
+                size_t bg = pf_bg;
+                lk.unlock();
+                read_cells(pf_stream, bg);
+                lk.lock();
+                pf_state = PF_DONE;
+                pf_cv.notify_all();
+            }else{
+                return;
+            }
+        }
+    }
+
+    //wait until the requested block (if any) is in pf_stream, and tell if it is the block
+    // starting at cell bg
+    bool wait_prefetch(size_t bg){
+        std::unique_lock<std::mutex> lk(pf_mutex);
+        pf_cv.wait(lk, [this]{ return pf_state!=PF_REQUESTED; });
+        bool hit = pf_state==PF_DONE && pf_bg==bg;
+        pf_state = PF_IDLE;
+        return hit;
+    }
+
+    void stop_prefetch(){
+        if(!pf_thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(pf_mutex);
+            pf_stop = true;
+        }
+        pf_cv.notify_all();
+        pf_thread.join();
+        pf_stop = false;
+        pf_state = PF_IDLE;
+    }
+
+    //load the block starting at cell bg, and start reading the following block of the scan
+    void fetch(size_t bg){
+        if(block_bg<tot_cells){
+            if(bg+buffer.stream_size==block_bg){
+                backward = true;
+            }else if(block_bg+buffer.stream_size==bg){
+                backward = false;
+            }
+        }
+
+        if(wait_prefetch(bg)){
+            std::swap(buffer.stream, pf_stream);
+        }else{
+            read_cells(buffer.stream, bg);
+        }
+        block_bg = bg;
+
+        size_t next;
+        if(backward){
+            if(bg==0) return;
+            next = bg>buffer.stream_size ? bg-buffer.stream_size : 0;
+        }else{
+            next = bg+buffer.stream_size;
+            if(next>=tot_cells) return;
+        }
+        if(pf_stream==nullptr) pf_stream = new sym_t[buffer.stream_size];
+        if(!pf_thread.joinable()) pf_thread = std::thread(&i_file_stream::prefetch_loop, this);
+        {
+            std::lock_guard<std::mutex> lk(pf_mutex);
+            pf_bg = next;
+            pf_state = PF_REQUESTED;
+        }
+        pf_cv.notify_all();
     }
 };
 
@@ -12,6 +12,11 @@
 #include "../../third-party/xxHash-dev/xxhash.h"
 #include "bitstream.h"
 #include "prime_generator.hpp"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 template<class ht_type>
 class bit_hash_table_iterator{
@@ -120,14 +125,17 @@ public:
     }
 };
 
+//tag_probe=false resolves every probe with a full key comparison (as the table did before
+// the tags), and it is only there to measure the tags in benchmarks/hash_table_bench.cpp
 template<class value_t,
          size_t val_bits=sizeof(value_t)*8,
          class buffer_t=size_t,
-         size_t desc_bits=32>
+         size_t desc_bits=32,
+         bool tag_probe=true>
 class bit_hash_table{
 
 private:
-    typedef bit_hash_table<value_t, val_bits, buffer_t, desc_bits>   ht_type;
+    typedef bit_hash_table<value_t, val_bits, buffer_t, desc_bits, tag_probe>   ht_type;
     typedef bitstream<buffer_t>                                      stream_t;
     typedef bit_hash_table_iterator<ht_type>                         iterator;
     friend                                                           iterator;
@@ -141,6 +149,18 @@ private:
     // hash table
     size_t* table= nullptr;
 
+    //one tag byte per bucket: the highest bit marks an occupied bucket and the other
+    // seven are the highest bits of the key's hash. A probe compares a group of TAG_GROUP
+    // tags at once and only compares the keys of the buckets whose tag matches. The first
+    // TAG_GROUP tags are replicated after the last bucket, so a group can start anywhere
+    uint8_t* tags= nullptr;
+
+#if defined(__AVX2__)
+    static constexpr size_t TAG_GROUP = 32;
+#else
+    static constexpr size_t TAG_GROUP = 16;
+#endif
+
     //maximum buffer size in bytes
     // used for the data structure
     size_t max_buffer_bytes=0;
@@ -182,6 +202,90 @@ private:
     size_t d_bits=0;
 
 
+    static inline uint8_t hash_tag(size_t hash){
+        return 0x80U | (hash>>57UL);
+    }
+
+    //bytes of the tag array of a table with n buckets (rounded to words to keep the data
+    // buffer aligned when the table is in a static buffer)
+    static inline size_t tag_bytes(size_t n){
+        return INT_CEIL(n+TAG_GROUP, sizeof(size_t))*sizeof(size_t);
+    }
+
+    //bytes of a table with n buckets, including its tags
+    static inline size_t table_bytes(size_t n){
+        return n*sizeof(size_t) + tag_bytes(n);
+    }
+
+    inline void set_tag(size_t idx, uint8_t tag){
+        tags[idx] = tag;
+        if(idx<TAG_GROUP) tags[n_buckets+idx] = tag;
+    }
+
+    inline void clear_table(){
+        memset(table, 0, n_buckets*sizeof(size_t));
+        memset(tags, 0, tag_bytes(n_buckets));
+    }
+
+    //bitmaps of the buckets idx..idx+TAG_GROUP-1 whose tag is equal to tag (match) and
+    // of the empty ones (empty)
+    inline void probe_group(size_t idx, uint8_t tag, uint64_t& match, uint64_t& empty) const {
+#if defined(__AVX2__)
+        __m256i group = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags+idx));
+        match = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char)tag)));
+        empty = (uint32_t)~_mm256_movemask_epi8(group);
+#elif defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags+idx));
+        match = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+        empty = (uint32_t)_mm_movemask_epi8(group) ^ 0xFFFFU;
+#else
+        match = 0;
+        empty = 0;
+        for(size_t j=0;j<TAG_GROUP;j++){
+            match |= uint64_t(tags[idx+j]==tag)<<j;
+            empty |= uint64_t(tags[idx+j]==0)<<j;
+        }
+#endif
+    }
+
+    //offset+1 of the key in the data buffer, or 0 if the key is not in the table
+    inline size_t lookup(const void* key, size_t key_bits, size_t hash) const {
+        size_t idx = hash & (n_buckets - 1);
+        if(table[idx]==0) return 0;
+
+        size_t offset;
+        if constexpr (tag_probe){
+            uint8_t tag = hash_tag(hash);
+            uint64_t match, empty, range;
+            for(size_t i=0;i<=max_bck_dist;i+=TAG_GROUP){
+                probe_group(idx, tag, match, empty);
+
+                //the key can only be before the first empty bucket and within the
+                // maximum bucket distance
+                range = empty ? (empty & -empty)-1 : ~0UL;
+                if(max_bck_dist-i<TAG_GROUP-1) range &= (1UL<<(max_bck_dist-i+1))-1;
+                match &= range;
+
+                while(match){
+                    offset = table[(idx+__builtin_ctzl(match)) & (n_buckets-1)] & 0xFFFFFFFFFFFul;
+                    if(equal(key, key_bits, offset-1)) return offset;
+                    match &= match-1;
+                }
+                if(empty) break;
+                idx = (idx+TAG_GROUP) & (n_buckets - 1);
+            }
+        }else{
+            size_t i=0;
+            while(i<=max_bck_dist && table[idx]!=0){
+                offset = (table[idx] & 0xFFFFFFFFFFFul);
+                if(equal(key, key_bits, offset-1)) return offset;
+                idx = (idx+1) & (n_buckets - 1);
+                i++;
+            }
+        }
+        return 0;
+    }
+
     //the variable query is a pointer containing the queried string
     inline bool equal(const void *query, size_t query_bits, size_t data_offset) const{
         size_t key_bits = data.read(data_offset, data_offset+d_bits-1);
@@ -235,6 +339,7 @@ private:
         void * tmp_key = malloc(INT_CEIL(max_key_bits, stream_t::word_bits)*sizeof(buffer_t));
 
         size_t dist, bck_dist, bck_offset, tmp_offset, idx, hash;
+        uint8_t tmp_tag, bck_tag;
 
         for(size_t k=0;k<n_elms;k++){
 
@@ -251,9 +356,11 @@ private:
             hash = XXH3_64bits(tmp_key, key_bytes);
             idx = hash & (n_buckets - 1);
             tmp_offset = data_offset + 1;
+            tmp_tag = hash_tag(hash);
 
             if(table[idx]==0){
                 table[idx] = tmp_offset;
+                set_tag(idx, tmp_tag);
             }else{
                 dist = 0;
                 while(table[idx]!=0){
@@ -262,8 +369,11 @@ private:
 
                     if(bck_dist<dist){ //steal to the rich
                         table[idx] = (dist<<44UL) | tmp_offset;
+                        bck_tag = tags[idx];
+                        set_tag(idx, tmp_tag);
                         if(dist>max_bck_dist) max_bck_dist = dist;
                         tmp_offset = bck_offset;
+                        tmp_tag = bck_tag;
                         dist = bck_dist+1;
                     }else{
                         dist++;
@@ -272,6 +382,7 @@ private:
                 }
 
                 table[idx] = (dist<<44UL) | tmp_offset ;
+                set_tag(idx, tmp_tag);
                 if(dist>max_bck_dist) max_bck_dist = dist;
             }
 
@@ -288,7 +399,7 @@ private:
         return n_buckets<<1UL;
     }
 
-    //number of bytes available for the hash table
+    //number of bytes available for the hash table (and its tags)
     inline size_t av_tb_bytes() const{
         size_t data_bytes = data.stream_size*sizeof(buffer_t);
         size_t av_bytes = max_buffer_bytes-data_bytes;
@@ -297,12 +408,11 @@ private:
 
     void resize_table(size_t new_n_buckets) {
         assert(!static_buffer);
-        size_t new_table_bytes = new_n_buckets*sizeof(size_t);
-
-        assert(new_table_bytes <= av_tb_bytes());
-        table = reinterpret_cast<size_t*>(realloc(table, new_table_bytes));
+        assert(table_bytes(new_n_buckets) <= av_tb_bytes());
+        table = reinterpret_cast<size_t*>(realloc(table, new_n_buckets*sizeof(size_t)));
+        tags = reinterpret_cast<uint8_t*>(realloc(tags, tag_bytes(new_n_buckets)));
         n_buckets = new_n_buckets;
-        memset(table, 0, new_n_buckets * sizeof(size_t));
+        clear_table();
         rehash();
         m_load_factor = float(n_elms) / n_buckets;
     };
@@ -314,13 +424,13 @@ private:
         size_t bytes_to_fit = INT_CEIL(bits_to_fit, stream_t::word_bits)*sizeof(buffer_t);
 
         //number of bytes allocated for the hash table
-        size_t table_bytes = n_buckets * sizeof(size_t);
+        size_t tb_bytes = table_bytes(n_buckets);
 
         //number of bytes used by the data buffer
         size_t used_data_bytes = INT_CEIL(next_av_bit, stream_t::word_bits)*sizeof(buffer_t);
 
         //number of available bytes
-        size_t av_bytes = max_buffer_bytes-(used_data_bytes + table_bytes);
+        size_t av_bytes = max_buffer_bytes-(used_data_bytes + tb_bytes);
 
         if(bytes_to_fit>av_bytes){
             if(bytes_to_fit>(max_buffer_bytes/2)){
@@ -334,7 +444,7 @@ private:
 
             size_t new_size = size_t(data.stream_size*sizeof(buffer_t)*1.5);
             //maximum number of bytes we can allocate
-            size_t new_data_bytes = std::min(std::max(min_data_bytes, new_size), max_buffer_bytes-table_bytes);
+            size_t new_data_bytes = std::min(std::max(min_data_bytes, new_size), max_buffer_bytes-tb_bytes);
             data.stream = reinterpret_cast<buffer_t*>(realloc(data.stream, new_data_bytes));
             data.stream_size = new_data_bytes/sizeof(buffer_t);
         }
@@ -343,6 +453,7 @@ private:
 
     void move(ht_type&& other){
         std::swap(table, other.table);
+        std::swap(tags, other.tags);
         std::swap(max_buffer_bytes, other.max_buffer_bytes);
         std::swap(next_av_bit, other.next_av_bit);
         std::swap(n_buckets, other.n_buckets);
@@ -375,21 +486,23 @@ private:
         n_buckets = 1UL<<sdsl::bits::hi(n_buckets); //resize the table to the previous power of two
         assert(n_buckets>=4);
         table = reinterpret_cast<size_t*>(buff_addr);
+        tags = reinterpret_cast<uint8_t*>(table+n_buckets);
 
         //define the size of the data
-        size_t rem_buff = buffer_size - n_buckets*sizeof(n_buckets);//the other half is for the data
+        assert(table_bytes(n_buckets)<buffer_size);
+        size_t rem_buff = buffer_size - table_bytes(n_buckets);//the other half (minus the tags) is for the data
 
         //the address should be aligned!!
-        assert(((uintptr_t)(table+n_buckets) % sizeof(buff_t))==0);
+        assert(((uintptr_t)(tags+tag_bytes(n_buckets)) % sizeof(buff_t))==0);
         data.stream_size = rem_buff/sizeof(buff_t);//the number of elements is floored
-        data.stream = reinterpret_cast<buffer_t*>(table+n_buckets);
+        data.stream = reinterpret_cast<buffer_t*>(tags+tag_bytes(n_buckets));
 
         next_av_bit = 1;
         m_load_factor = 0;
         max_bck_dist = 0;
         n_elms = 0;
         max_key_bits = 0;
-        max_buffer_bytes = data.stream_size*sizeof(buff_t)+n_buckets*sizeof(size_t);
+        max_buffer_bytes = data.stream_size*sizeof(buff_t)+table_bytes(n_buckets);
     }
 
     void dynamic_init(size_t buffer_size){
@@ -397,15 +510,15 @@ private:
 
         n_buckets = 4;//minimum size for the hash table
 
-        size_t table_bytes = (n_buckets * sizeof(size_t)); //number of bytes allocated for the hash table
+        size_t tb_bytes = table_bytes(n_buckets); //number of bytes allocated for the hash table
 
         //number of bytes allocated for the data buffer
-        size_t data_bytes = table_bytes*2;
+        size_t data_bytes = n_buckets*sizeof(size_t)*2;
 
         if(buffer_size!=0){
             //approximate to a number divisible by sizeof(buff_t)
             max_buffer_bytes = INT_CEIL(buffer_size, sizeof(buff_t))*sizeof(buff_t);
-            data_bytes = std::min(max_buffer_bytes-table_bytes, data_bytes);
+            data_bytes = std::min(max_buffer_bytes-tb_bytes, data_bytes);
 
             if(!file.empty()){
                 dump_fs.open(file, std::ios::out | std::ios::binary);
@@ -416,8 +529,9 @@ private:
             max_buffer_bytes = std::numeric_limits<size_t>::max();
         }
 
-        table = reinterpret_cast<size_t*>(malloc(table_bytes));
-        memset(table, 0, table_bytes);
+        table = reinterpret_cast<size_t*>(malloc(n_buckets*sizeof(size_t)));
+        tags = reinterpret_cast<uint8_t*>(malloc(tag_bytes(n_buckets)));
+        clear_table();
 
         data.stream = reinterpret_cast<buffer_t *>(malloc(data_bytes));
         data.stream_size = data_bytes/sizeof(buffer_t);
@@ -444,7 +558,7 @@ public:
             static_buffer = false;
             dynamic_init(buffer_size);
         }else{
-            assert(buffer_size>=64);//must be at least 32 bytes
+            assert(buffer_size>=128);//must be at least 128 bytes
             static_buffer = true;
             static_init(buffer_size, buff_addr);
         }
@@ -472,20 +586,32 @@ public:
 
     std::pair<iterator, bool> insert(const void* key, const size_t& key_bits, const value_t& val){
 
-        assert(max_buffer_bytes >= (data.stream_size*sizeof(buff_t) + n_buckets*sizeof(size_t)));
+        assert(max_buffer_bytes >= (data.stream_size*sizeof(buff_t) + table_bytes(n_buckets)));
 
         XXH64_hash_t hash =  XXH3_64bits(key, INT_CEIL(key_bits, 8));
         size_t idx = hash & (n_buckets - 1);
         size_t in_offset=0;//locus where the key is inserted
+        uint8_t tag = hash_tag(hash);
 
         if(table[idx]==0){
             auto res  = insert_int(key, key_bits, val);
             if(res.second) idx = hash & (n_buckets-1);
             in_offset = res.first;
             table[idx] =  in_offset;
+            set_tag(idx, tag);
         }else{ //resolve collision
+            if constexpr (tag_probe){
+                //the tags find the key faster than the robin hood probing below, which
+                // then does not need to compare keys
+                size_t found = lookup(key, key_bits, hash);
+                if(found!=0){
+                    return {iterator{*this, found-1}, false};
+                }
+            }
+
             size_t dist=0, offset;
             size_t bck_dist, bck_offset;
+            uint8_t bck_tag;
             bool inserted = false;
 
             while(table[idx]!=0){
@@ -493,7 +619,7 @@ public:
                 bck_offset = (table[idx] & 0xFFFFFFFFFFFul);
                 bck_dist = table[idx] >> 44UL;
 
-                if(!inserted && equal(key, key_bits , bck_offset-1)){
+                if(!tag_probe && !inserted && equal(key, key_bits , bck_offset-1)){
                     return {iterator{*this, bck_offset-1}, false};
                 }else if(bck_dist<dist){ //steal to the rich
 
@@ -507,6 +633,7 @@ public:
                             //data was dumped, it is not necessary
                             idx = hash & (n_buckets-1);
                             table[idx] =  res.first;
+                            set_tag(idx, tag);
                             goto finish;
                         }
                     }
@@ -515,7 +642,10 @@ public:
                     if(dist>max_bck_dist) max_bck_dist = dist;
 
                     table[idx] = (dist<<44UL) | offset;
+                    bck_tag = tags[idx];
+                    set_tag(idx, tag);
                     offset = bck_offset;
+                    tag = bck_tag;
                     dist = bck_dist+1;
 
                 }else{
@@ -538,9 +668,10 @@ public:
             if(dist>max_bck_dist) max_bck_dist = dist;
 
             table[idx] = (dist<<44UL) | offset ;
+            set_tag(idx, tag);
         }
 
-        assert(max_buffer_bytes >= (data.stream_size*sizeof(buff_t) + n_buckets*sizeof(size_t)));
+        assert(max_buffer_bytes >= (data.stream_size*sizeof(buff_t) + table_bytes(n_buckets)));
 
         finish:
         n_elms++;
@@ -553,7 +684,7 @@ public:
                 dump=true;
             }else{
                 size_t new_size = new_table_size();
-                if((new_size*sizeof(size_t)) > av_tb_bytes()){
+                if(table_bytes(new_size) > av_tb_bytes()){
                     //the new size doesn't fit the buffer
                     dump = true;
                 }else{
@@ -609,13 +740,13 @@ public:
         m_load_factor = 0;
         next_av_bit = 1;
 
-        size_t table_bytes = n_buckets*sizeof(size_t);
-        table = reinterpret_cast<size_t*>(realloc(table, table_bytes));
+        table = reinterpret_cast<size_t*>(realloc(table, n_buckets*sizeof(size_t)));
+        tags = reinterpret_cast<uint8_t*>(realloc(tags, tag_bytes(n_buckets)));
 
-        size_t data_bytes = table_bytes*2;
+        size_t data_bytes = n_buckets*sizeof(size_t)*2;
         data.stream = reinterpret_cast<buffer_t*>(realloc(data.stream, data_bytes));
         data.stream_size = data_bytes/sizeof(buffer_t);
-        memset(table, 0, table_bytes);
+        clear_table();
         memset(data.stream, 0, data_bytes);
     }
 
@@ -624,23 +755,9 @@ public:
     }
 
     inline std::pair<iterator, bool> find(const void* key, size_t key_bits) const {
-        size_t hash = XXH3_64bits(key, INT_CEIL(key_bits, 8));
-        size_t idx = hash & (n_buckets - 1);
-
-        if(table[idx]==0){
-            return {end(), false};
-        }else{
-            size_t offset, i=0;
-            while(i<=max_bck_dist && table[idx]!=0){
-                offset = (table[idx] & 0xFFFFFFFFFFFul);
-                if(equal(key, key_bits, offset-1)){
-                    return {iterator(*this, offset - 1), true};
-                }
-                idx = (idx+1) & (n_buckets - 1);
-                i++;
-            }
-            return {end(), false};
-        }
+        size_t offset = lookup(key, key_bits, XXH3_64bits(key, INT_CEIL(key_bits, 8)));
+        if(offset==0) return {end(), false};
+        return {iterator(*this, offset - 1), true};
     }
 
     //offset is the bit where the pair description starts
@@ -668,6 +785,9 @@ public:
             if(table!= nullptr){
                 free(table);
             }
+            if(tags!= nullptr){
+                free(tags);
+            }
             if(data.stream!= nullptr){
                 free(data.stream);
             }
@@ -727,14 +847,15 @@ public:
             n_buckets = INT_CEIL( (max_buffer_bytes/2), sizeof(size_t));
             n_buckets = 1UL << (sdsl::bits::hi(n_buckets));//prev power of two
             table = reinterpret_cast<size_t*>(realloc(table, n_buckets*sizeof(size_t)));
+            tags = reinterpret_cast<uint8_t*>(realloc(tags, tag_bytes(n_buckets)));
 
-            //half of the buffer for the data
-            data.stream_size = INT_CEIL((max_buffer_bytes/2), sizeof(buffer_t));
+            //the other half (minus the tags) for the data
+            data.stream_size = (max_buffer_bytes - table_bytes(n_buckets))/sizeof(buffer_t);
             data.stream = reinterpret_cast<buffer_t *>(realloc(data.stream, data.stream_size*sizeof(buffer_t)));
         }
 
         data.stream[0] = tail;
-        memset(table, 0, n_buckets * sizeof(size_t));
+        clear_table();
     };
 
     inline size_t tot_buckets() const{
@@ -746,7 +867,7 @@ public:
     }
 
     inline void clean(){
-        memset(table, 0, n_buckets*sizeof(size_t));
+        clear_table();
         memset(data.stream, 0, data.stream_size*sizeof(buffer_t));
         n_elms = 0;
         max_bck_dist = 0;
@@ -760,24 +881,24 @@ public:
 
     void unload_table(std::string output) {
         std::ofstream ofs(output, std::ios_base::binary);
+        ofs.write(reinterpret_cast<char *>(&n_buckets), sizeof(size_t));
         ofs.write(reinterpret_cast<char *>(table), n_buckets*sizeof(size_t));
-        ofs.tellp();
+        ofs.write(reinterpret_cast<char *>(tags), tag_bytes(n_buckets));
         free(table);
+        free(tags);
         table= nullptr;
+        tags= nullptr;
         ofs.close();
     }
 
     void load_table(std::string input) {
         assert(table== nullptr);
         std::ifstream ifs(input, std::ios_base::binary);
-
-        ifs.seekg (0, std::ifstream::end);
-        size_t tot_bytes = ifs.tellg();
-        ifs.seekg (0, std::ifstream::beg);
-
-        table = reinterpret_cast<size_t*>(malloc(tot_bytes));
-        n_buckets = tot_bytes/sizeof(size_t);
-        ifs.read(reinterpret_cast<char *>(table), tot_bytes);
+        ifs.read(reinterpret_cast<char *>(&n_buckets), sizeof(size_t));
+        table = reinterpret_cast<size_t*>(malloc(n_buckets*sizeof(size_t)));
+        tags = reinterpret_cast<uint8_t*>(malloc(tag_bytes(n_buckets)));
+        ifs.read(reinterpret_cast<char *>(table), n_buckets*sizeof(size_t));
+        ifs.read(reinterpret_cast<char *>(tags), tag_bytes(n_buckets));
         ifs.close();
     }
 };
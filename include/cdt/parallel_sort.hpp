@@ -0,0 +1,52 @@
+#ifndef LPG_COMPRESSOR_PARALLEL_SORT_HPP
+#define LPG_COMPRESSOR_PARALLEL_SORT_HPP
+
+#include <algorithm>
+#include <vector>
+#include "thread_pool.hpp"
+
+//sort [begin, end) with the workers of the pool: every worker sorts a block of the range,
+// and then the blocks are merged in pairs in log(n_blocks) rounds. The function blocks
+// until the range is sorted, so it can not be called from a task running in the same pool
+template<class iter_t, class comp_t>
+void parallel_sort(iter_t begin, iter_t end, const comp_t& comp, thread_pool& pool){
+
+    size_t n = end-begin;
+    size_t n_blocks = pool.size();
+    if(n_blocks<=1 || n < (size_t(1)<<16)){
+        std::sort(begin, end, comp);
+        return;
+    }
+
+    std::vector<size_t> limits(n_blocks+1);
+    for(size_t i=0;i<=n_blocks;i++){
+        limits[i] = (i*n)/n_blocks;
+    }
+
+    pool.parallel_for(n_blocks, [&](size_t i, size_t){
+        std::sort(begin+limits[i], begin+limits[i+1], comp);
+    });
+
+    for(size_t width=1; width<n_blocks; width*=2){
+        size_t n_merges = (n_blocks + 2*width - 1)/(2*width);
+        pool.parallel_for(n_merges, [&](size_t j, size_t){
+            size_t b = 2*j*width;
+            size_t m = std::min(b+width, n_blocks);
+            size_t e = std::min(b+2*width, n_blocks);
+            if(m<e){
+                std::inplace_merge(begin+limits[b], begin+limits[m], begin+limits[e], comp);
+            }
+        });
+    }
+}
+
+template<class iter_t, class comp_t>
+void parallel_sort(iter_t begin, iter_t end, const comp_t& comp, size_t n_threads){
+    if(n_threads<=1){
+        std::sort(begin, end, comp);
+        return;
+    }
+    thread_pool pool(n_threads);
+    parallel_sort(begin, end, comp, pool);
+}
+#endif //LPG_COMPRESSOR_PARALLEL_SORT_HPP
@@ -4,7 +4,7 @@
 
 #ifndef LPG_COMPRESSOR_PARALLEL_STRING_SORT_HPP
 #define LPG_COMPRESSOR_PARALLEL_STRING_SORT_HPP
-#include <pthread.h>
+#include "thread_pool.hpp"
 
 struct sorting_data{
     sdsl::bit_vector                 b_limits{};
@@ -55,13 +55,6 @@ struct sorting_thread_data{
     }
 };
 
-template<typename comparator>
-void * sort_p(void *data){
-    auto t_data = reinterpret_cast<sorting_thread_data<comparator>*>(data);
-    (*t_data)();
-    pthread_exit(nullptr);
-}
-
 template<typename accessor>
 void light_sort(std::string& file, accessor& acc, size_t alph_size, sorting_data& sdata, sdsl::cache_config& config,
                 std::string& bck_c_file){
@@ -127,7 +120,7 @@ template<typename comparator,
          typename accessor>
 void parallel_str_sort(std::string& file, comparator comp,
                        accessor acce, size_t alph_size,
-                       size_t n_threads, sdsl::cache_config& config,
+                       thread_pool& pool, sdsl::cache_config& config,
                        std::string bck_counts= ""){
 
     sorting_data sdata;
@@ -138,7 +131,7 @@ void parallel_str_sort(std::string& file, comparator comp,
 
         size_t len, acc=0, f_bucket=1, s, e;
         std::vector<std::pair<size_t, size_t>> t_ranges;
-        size_t phrases_per_thread = INT_CEIL(sdata.qs_phrases, n_threads);
+        size_t phrases_per_thread = INT_CEIL(sdata.qs_phrases, pool.size());
         size_t sum=0;
 
         for(size_t j=1;j<=sdata.n_buckets;j++){
@@ -174,20 +167,9 @@ void parallel_str_sort(std::string& file, comparator comp,
         }
         symbols_buff.close(true);
 
-        std::vector<pthread_t> threads(threads_data.size());
-        for (size_t j = 0; j < threads_data.size(); j++) {
-            int ret = pthread_create(&threads[j],
-                                     nullptr,
-                                     &sort_p<comparator>,
-                                     (void *) &threads_data[j]);
-            if (ret != 0) {
-                printf("Error: pthread_create() failed\n");
-                exit(EXIT_FAILURE);
-            }
-        }
-        for (size_t j = 0; j < threads_data.size(); j++) {
-            pthread_join(threads[j], nullptr);
-        }
+        pool.parallel_for(threads_data.size(), [&](size_t j, size_t){
+            threads_data[j]();
+        });
     }else{
         sdsl::int_vector<> thread_label;
         sdsl::load_from_file(thread_label, sdata.list_file);
@@ -0,0 +1,151 @@
+#ifndef LPG_COMPRESSOR_THREAD_POOL_HPP
+#define LPG_COMPRESSOR_THREAD_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+
+//persistent pool of worker threads. Every worker owns a deque of tasks: it consumes
+// its own deque from the front and, when it runs out of work, it steals from the back
+// of the deques of the other workers. This keeps the load balanced when the cost of the
+// tasks is skewed (e.g., patterns with very different number of occurrences)
+class thread_pool{
+
+    typedef std::function<void(size_t)> task_t;
+
+    struct worker_queue{
+        std::mutex         mtx;
+        std::deque<task_t> tasks;
+    };
+
+    std::vector<std::thread>                   workers;
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::mutex                                 pool_mtx;
+    std::condition_variable                    work_cv;
+    std::condition_variable                    done_cv;
+    std::atomic<long>                          queued{0}; //tasks waiting in the deques
+    size_t                                     pending{0};//tasks submitted but not finished
+    size_t                                     next_queue{0};
+    bool                                       stop{false};
+
+    bool pop_local(size_t id, task_t& task){
+        auto& q = *queues[id];
+        std::lock_guard<std::mutex> lck(q.mtx);
+        if(q.tasks.empty()) return false;
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool steal(size_t id, task_t& task){
+        for(size_t i=1;i<queues.size();i++){
+            auto& q = *queues[(id+i) % queues.size()];
+            std::lock_guard<std::mutex> lck(q.mtx);
+            if(q.tasks.empty()) continue;
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(size_t id){
+        task_t task;
+        while(true){
+            if(pop_local(id, task) || steal(id, task)){
+                task(id);
+                task = nullptr;
+                std::lock_guard<std::mutex> lck(pool_mtx);
+                if(--pending==0) done_cv.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lck(pool_mtx);
+            work_cv.wait(lck, [&]{ return stop || queued.load(std::memory_order_relaxed)>0; });
+            if(stop && queued.load(std::memory_order_relaxed)<=0) break;
+        }
+    }
+
+    void push(size_t q_id, task_t&& task){
+        {
+            std::lock_guard<std::mutex> lck(pool_mtx);
+            pending++;
+        }
+        {
+            auto& q = *queues[q_id];
+            std::lock_guard<std::mutex> lck(q.mtx);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lck(pool_mtx);
+            queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        work_cv.notify_one();
+    }
+
+public:
+
+    explicit thread_pool(size_t n_threads){
+        if(n_threads==0) n_threads=1;
+        for(size_t i=0;i<n_threads;i++){
+            queues.push_back(std::make_unique<worker_queue>());
+        }
+        for(size_t i=0;i<n_threads;i++){
+            workers.emplace_back(&thread_pool::worker_loop, this, i);
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool(){
+        {
+            std::lock_guard<std::mutex> lck(pool_mtx);
+            stop = true;
+        }
+        work_cv.notify_all();
+        for(auto& w : workers) w.join();
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return workers.size();
+    }
+
+    //enqueue a task. The function receives the id of the worker that runs it
+    template<class F>
+    void submit(F&& f){
+        size_t q_id;
+        {
+            std::lock_guard<std::mutex> lck(pool_mtx);
+            q_id = next_queue++ % queues.size();
+        }
+        push(q_id, task_t(std::forward<F>(f)));
+    }
+
+    //wait until all the submitted tasks are finished
+    void wait(){
+        std::unique_lock<std::mutex> lck(pool_mtx);
+        done_cv.wait(lck, [&]{ return pending==0; });
+    }
+
+    //run f(i, worker_id) for every i in [0, n). The range is split in contiguous blocks,
+    // one per worker, and idle workers steal indexes from the tail of the busy ones
+    template<class F>
+    void parallel_for(size_t n, F&& f){
+        size_t n_workers = queues.size();
+        for(size_t w=0;w<n_workers;w++){
+            size_t start = (w*n)/n_workers, end = ((w+1)*n)/n_workers;
+            for(size_t i=start;i<end;i++){
+                push(w, [i, &f](size_t worker_id){ f(i, worker_id); });
+            }
+        }
+        wait();
+    }
+};
+#endif //LPG_COMPRESSOR_THREAD_POOL_HPP
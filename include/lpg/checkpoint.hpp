@@ -0,0 +1,267 @@
+#ifndef LPG_COMPRESSOR_CHECKPOINT_HPP
+#define LPG_COMPRESSOR_CHECKPOINT_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include "../../third-party/xxHash-dev/xxhash.h"
+
+//Manifest of the stages finished by an index construction. It is the file "checkpoint" of
+// the temporal folder, and for every finished stage it lists the files the following stages
+// need, with their length and an XXH3 checksum. A construction resumed from the folder
+// verifies the files of a stage before skipping it, and runs the stage again if they do
+// not match
+class build_checkpoint{
+
+public:
+
+    //how the length and the checksum of a file are computed
+    enum file_kind{
+        WHOLE=0,  //all the bytes of the file
+        IV_DYN,   //the bits of a serialized int_vector<> (header with the size and the width)
+        IV_FIXED  //the bits of a serialized int_vector<w> of fixed width (header with the size)
+    };
+
+    typedef std::vector<std::pair<std::string, file_kind>> file_list;
+
+private:
+
+    struct file_entry{
+        std::string path;
+        uint8_t     kind{};
+        uint64_t    len{};//bytes for WHOLE files and bits for the int_vectors
+        uint64_t    hash{};
+    };
+
+    struct stage_entry{
+        std::string             name;
+        std::string             info;//small state of the stage (e.g., counters)
+        std::vector<file_entry> files;
+        bool                    verified=false;
+    };
+
+    std::string              m_file;
+    std::string              m_params;
+    std::vector<stage_entry> m_stages;
+
+    static size_t header_bytes(uint8_t kind){
+        return kind==IV_DYN ? sizeof(uint64_t)+sizeof(uint8_t) : kind==IV_FIXED ? sizeof(uint64_t) : 0;
+    }
+
+    //length of a file in the units of its kind
+    static bool file_len(const std::string& path, uint8_t kind, uint64_t& len){
+        std::error_code ec;
+        auto bytes = std::filesystem::file_size(path, ec);
+        if(ec) return false;
+        if(kind==WHOLE){
+            len = bytes;
+            return true;
+        }
+        std::ifstream in(path, std::ios::binary);
+        in.read((char *)&len, sizeof(len));
+        return in.good() && bytes>=header_bytes(kind)+(len+7)/8;
+    }
+
+    //checksum of the first len units of a file. The prefix of an int_vector does not change
+    // when more elements are appended, so a later stage can keep growing it
+    static uint64_t file_hash(const std::string& path, uint8_t kind, uint64_t len){
+        std::ifstream in(path, std::ios::binary);
+        in.seekg((std::streamoff)header_bytes(kind));
+        uint64_t bytes = kind==WHOLE ? len : len/8, rem_bits = kind==WHOLE ? 0 : len%8;
+
+        XXH3_state_t* state = XXH3_createState();
+        XXH3_64bits_reset(state);
+        std::vector<char> buffer(1UL<<20UL);
+        while(bytes>0){
+            size_t to_read = std::min<uint64_t>(buffer.size(), bytes);
+            in.read(buffer.data(), (std::streamsize)to_read);
+            XXH3_64bits_update(state, buffer.data(), to_read);
+            bytes -= to_read;
+        }
+        if(rem_bits>0){
+            char last=0;
+            in.read(&last, 1);
+            last = char(uint8_t(last) & ((1U<<rem_bits)-1U));
+            XXH3_64bits_update(state, &last, 1);
+        }
+        uint64_t hash = XXH3_64bits_digest(state);
+        XXH3_freeState(state);
+        return hash;
+    }
+
+    void load(){
+        std::ifstream in(m_file);
+        std::string line, tag;
+        m_stages.clear();
+        while(std::getline(in, line)){
+            std::istringstream ss(line);
+            ss>>tag;
+            if(tag=="params"){
+                std::getline(ss>>std::ws, m_params);
+            }else if(tag=="stage"){
+                m_stages.emplace_back();
+                ss>>m_stages.back().name;
+            }else if(tag=="info" && !m_stages.empty()){
+                std::getline(ss>>std::ws, m_stages.back().info);
+            }else if(tag=="file" && !m_stages.empty()){
+                file_entry entry;
+                int kind;
+                ss>>kind>>entry.len>>entry.hash;
+                entry.kind = kind;
+                std::getline(ss>>std::ws, entry.path);
+                m_stages.back().files.push_back(entry);
+            }
+        }
+    }
+
+    //the manifest is replaced atomically, so a crash leaves either the old or the new one
+    void store() const {
+        std::string tmp_file = m_file+".tmp";
+        {
+            std::ofstream out(tmp_file);
+            out<<"params "<<m_params<<"\n";
+            for(auto const& stage : m_stages){
+                out<<"stage "<<stage.name<<"\n";
+                if(!stage.info.empty()) out<<"info "<<stage.info<<"\n";
+                for(auto const& f : stage.files){
+                    out<<"file "<<(int)f.kind<<" "<<f.len<<" "<<f.hash<<" "<<f.path<<"\n";
+                }
+            }
+            out.flush();
+            if(!out.good()){
+                std::cout<<"Error trying to write the checkpoint "<<tmp_file<<std::endl;
+                exit(1);
+            }
+        }
+        std::filesystem::rename(tmp_file, m_file);
+    }
+
+    stage_entry* find(const std::string& name){
+        for(auto& stage : m_stages){
+            if(stage.name==name) return &stage;
+        }
+        return nullptr;
+    }
+
+public:
+
+    build_checkpoint() = default;
+
+    [[nodiscard]] inline bool enabled() const {
+        return !m_file.empty();
+    }
+
+    //use the manifest of the folder dir. When resuming, the manifest has to exist and has
+    // to be created with the same parameters
+    void open(const std::string& dir, const std::string& params, bool resume){
+        m_file = dir+"/checkpoint";
+        if(resume){
+            if(!std::filesystem::exists(m_file)){
+                std::cout<<"Error: there is no checkpoint to resume from in "<<dir<<std::endl;
+                exit(1);
+            }
+            load();
+            if(m_params!=params){
+                std::cout<<"Error: the checkpoint in "<<dir<<" was created with different input or parameters"<<std::endl;
+                std::cout<<"  Checkpoint: "<<m_params<<std::endl;
+                std::cout<<"  Current:    "<<params<<std::endl;
+                exit(1);
+            }
+            std::cout<<"  Stages in the checkpoint:";
+            for(auto const& stage : m_stages) std::cout<<" "<<stage.name;
+            std::cout<<std::endl;
+        }else{
+            m_params = params;
+            m_stages.clear();
+            store();
+        }
+    }
+
+    //names of the stages in the manifest, in the order they were finished
+    [[nodiscard]] std::vector<std::string> stages() const {
+        std::vector<std::string> names;
+        for(auto const& stage : m_stages) names.push_back(stage.name);
+        return names;
+    }
+
+    //true if the stage is in the manifest and its files are intact. A stage whose files do
+    // not match is removed from the manifest
+    bool completed(const std::string& name){
+        if(!enabled()) return false;
+        stage_entry* stage = find(name);
+        if(stage==nullptr) return false;
+        if(stage->verified) return true;
+
+        for(auto const& f : stage->files){
+            uint64_t len;
+            if(!file_len(f.path, f.kind, len) || len<f.len || (f.kind==WHOLE && len!=f.len) ||
+               file_hash(f.path, f.kind, f.len)!=f.hash){
+                std::cout<<"  Warning: the file "<<f.path<<" of the stage "<<name
+                         <<" does not match the checkpoint, the stage will run again"<<std::endl;
+                m_stages.erase(m_stages.begin()+(stage-m_stages.data()));
+                store();
+                return false;
+            }
+        }
+        stage->verified = true;
+        return true;
+    }
+
+    [[nodiscard]] std::string info(const std::string& name) {
+        stage_entry* stage = find(name);
+        return stage==nullptr ? "" : stage->info;
+    }
+
+    //record a finished stage (it replaces a previous record with the same name)
+    void commit(const std::string& name, const file_list& files, const std::string& info=""){
+        if(!enabled()) return;
+        stage_entry stage;
+        stage.name = name;
+        stage.info = info;
+        for(auto const& f : files){
+            file_entry entry;
+            entry.path = f.first;
+            entry.kind = f.second;
+            if(!file_len(entry.path, entry.kind, entry.len)){
+                std::cout<<"Error: the file "<<entry.path<<" of the stage "<<name<<" can not be read"<<std::endl;
+                exit(1);
+            }
+            entry.hash = file_hash(entry.path, entry.kind, entry.len);
+            stage.files.push_back(entry);
+        }
+        stage.verified = true;
+        auto it = std::find_if(m_stages.begin(), m_stages.end(), [&](const stage_entry& s){ return s.name==name; });
+        if(it!=m_stages.end()) m_stages.erase(it);
+        m_stages.push_back(stage);
+        store();
+    }
+
+    //remove a stage from the manifest (its files are not deleted)
+    void drop(const std::string& name){
+        if(!enabled()) return;
+        auto it = std::find_if(m_stages.begin(), m_stages.end(), [&](const stage_entry& s){ return s.name==name; });
+        if(it==m_stages.end()) return;
+        m_stages.erase(it);
+        store();
+    }
+
+    //set the length of the int_vectors of a stage back to the one in the manifest, in case
+    // a later stage appended elements before it was interrupted
+    void restore_lengths(const std::string& name){
+        stage_entry* stage = find(name);
+        if(stage==nullptr) return;
+        for(auto const& f : stage->files){
+            if(f.kind==WHOLE) continue;
+            {
+                std::fstream out(f.path, std::ios::in | std::ios::out | std::ios::binary);
+                out.write((const char *)&f.len, sizeof(f.len));
+            }
+            std::filesystem::resize_file(f.path, header_bytes(f.kind)+((f.len+63)/64)*8);
+        }
+    }
+};
+#endif //LPG_COMPRESSOR_CHECKPOINT_HPP
@@ -0,0 +1,230 @@
+#ifndef LPG_COMPRESSOR_COLLECTION_HPP
+#define LPG_COMPRESSOR_COLLECTION_HPP
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "lpg_build.hpp"
+
+//how the input of the index is interpreted
+enum collection_mode{
+    SINGLE_TEXT=0, //one string that already ends with '\0'
+    DOC_DIRECTORY, //every regular file in a directory (recursively) is a document
+    DOC_LIST,      //a file with the paths of the documents, one per line
+    DOC_LINES      //every line of the input file is a document
+};
+
+//Concatenation of a document collection into one text that the grammar construction
+// accepts: doc_1 sep doc_2 sep ... doc_d '\0'. The separator is a byte that does not
+// appear in any document (the newline in DOC_LINES mode), so no pattern free of the
+// separator can have an occurrence spanning two documents
+struct doc_collection{
+
+    std::vector<std::string> names;      //document files (empty in DOC_LINES mode)
+    std::vector<size_t>      doc_starts; //text position where every document starts
+    uint8_t                  sep=0;      //separator between consecutive documents
+    size_t                   n_chars=0;  //length of the concatenated text
+
+private:
+
+    //buffered writer for the concatenated text
+    struct text_writer{
+        std::ofstream     ofs;
+        std::vector<char> buffer;
+        size_t            buff_pos=0;
+        size_t            pos=0;
+
+        explicit text_writer(const std::string& file): ofs(file, std::ios::out | std::ios::binary),
+                                                       buffer(BUFFER_SIZE){
+            if(!ofs.good()){
+                std::cout<<"Error trying to create the file "<<file<<std::endl;
+                exit(1);
+            }
+        }
+
+        inline void push(char sym){
+            if(buff_pos==buffer.size()) flush();
+            buffer[buff_pos++] = sym;
+            pos++;
+        }
+
+        void write(const char* data, size_t len){
+            while(len>0){
+                if(buff_pos==buffer.size()) flush();
+                size_t n = std::min(len, buffer.size()-buff_pos);
+                memcpy(buffer.data()+buff_pos, data, n);
+                buff_pos+=n;
+                pos+=n;
+                data+=n;
+                len-=n;
+            }
+        }
+
+        void flush(){
+            ofs.write(buffer.data(), (std::streamsize)buff_pos);
+            buff_pos = 0;
+        }
+    };
+
+    void begin_doc(text_writer& writer){
+        if(!doc_starts.empty()) writer.push((char)sep);
+        doc_starts.push_back(writer.pos);
+    }
+
+    void finish(text_writer& writer){
+        if(doc_starts.empty()){
+            std::cout<<"Error: the collection has no documents"<<std::endl;
+            exit(1);
+        }
+        writer.push('\0');
+        writer.flush();
+        writer.ofs.close();
+        n_chars = writer.pos;
+    }
+
+    //read a file in blocks of BUFFER_SIZE bytes
+    template<class F>
+    static void scan_file(const std::string& file, std::vector<char>& buffer, const F& f){
+        std::ifstream ifs(file, std::ios::in | std::ios::binary);
+        if(!ifs.good()){
+            std::cout<<"Error trying to read the document "<<file<<std::endl;
+            exit(1);
+        }
+        while(ifs.good()){
+            ifs.read(buffer.data(), (std::streamsize)buffer.size());
+            auto n = (size_t)ifs.gcount();
+            if(n==0) break;
+            f(buffer.data(), n);
+        }
+    }
+
+    //the documents are scanned twice: first to find a byte that can act as separator, and
+    // then to write the concatenation
+    void build_from_files(const std::string& o_file){
+        std::vector<char> buffer(BUFFER_SIZE);
+        size_t freqs[256] = {0};
+        for(auto const& file : names){
+            scan_file(file, buffer, [&](const char* data, size_t len){
+                for(size_t i=0;i<len;i++) freqs[(uint8_t)data[i]]++;
+            });
+            if(freqs[0]>0){
+                std::cout<<"Error: the document "<<file<<" contains the symbol '\\0'"<<std::endl;
+                exit(1);
+            }
+        }
+
+        size_t sym=1;
+        while(sym<256 && freqs[sym]>0) sym++;
+        if(sym==256){
+            std::cout<<"Error: the documents use all the byte values, there is no symbol left to separate them"<<std::endl;
+            exit(1);
+        }
+        sep = sym;
+
+        text_writer writer(o_file);
+        for(auto const& file : names){
+            begin_doc(writer);
+            scan_file(file, buffer, [&](const char* data, size_t len){
+                writer.write(data, len);
+            });
+        }
+        finish(writer);
+    }
+
+    void build_from_lines(const std::string& i_file, const std::string& o_file){
+        sep = '\n';
+        std::vector<char> buffer(BUFFER_SIZE);
+        text_writer writer(o_file);
+        bool at_start = true;
+        size_t pos = 0;
+        scan_file(i_file, buffer, [&](const char* data, size_t len){
+            for(size_t i=0;i<len;i++){
+                if(at_start){
+                    begin_doc(writer);
+                    at_start = false;
+                }
+                if(data[i]=='\n'){
+                    at_start = true;
+                }else{
+                    if(data[i]=='\0'){
+                        std::cout<<"Error: the input contains the symbol '\\0' at position "<<pos+i<<std::endl;
+                        exit(1);
+                    }
+                    writer.push(data[i]);
+                }
+            }
+            pos += len;
+        });
+        finish(writer);
+    }
+
+public:
+
+    //regular files of a directory and its subdirectories, sorted by path
+    static std::vector<std::string> list_directory(const std::string& dir){
+        std::vector<std::string> files;
+        for(auto const& entry : std::filesystem::recursive_directory_iterator(dir)){
+            if(entry.is_regular_file()) files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    //paths of a list file (one per line, empty lines are skipped)
+    static std::vector<std::string> read_list(const std::string& list_file){
+        std::vector<std::string> files;
+        std::ifstream in(list_file);
+        std::string line;
+        while(std::getline(in, line)){
+            if(!line.empty()) files.push_back(line);
+        }
+        return files;
+    }
+
+    //write the concatenated text of the input to o_file
+    void build(const std::string& input, collection_mode mode, const std::string& o_file){
+        names.clear();
+        doc_starts.clear();
+        if(mode==DOC_LINES){
+            build_from_lines(input, o_file);
+        }else{
+            names = mode==DOC_DIRECTORY ? list_directory(input) : read_list(input);
+            build_from_files(o_file);
+        }
+        std::cout<<"  Number of documents:  "<<doc_starts.size()<<std::endl;
+        std::cout<<"  Separator symbol:     "<<(int)sep<<std::endl;
+    }
+
+    //store the layout of the collection (not its text), so a resumed construction can skip
+    // the concatenation
+    void store(const std::string& file) const {
+        std::ofstream ofs(file);
+        ofs<<(int)sep<<" "<<n_chars<<" "<<doc_starts.size()<<" "<<names.size()<<"\n";
+        for(auto const& pos : doc_starts) ofs<<pos<<"\n";
+        for(auto const& name : names) ofs<<name<<"\n";
+    }
+
+    void load(const std::string& file){
+        std::ifstream ifs(file);
+        int sym;
+        size_t n_docs, n_names;
+        ifs>>sym>>n_chars>>n_docs>>n_names;
+        sep = sym;
+        doc_starts.resize(n_docs);
+        for(auto& pos : doc_starts) ifs>>pos;
+        ifs>>std::ws;
+        names.resize(n_names);
+        for(auto& name : names) std::getline(ifs, name);
+    }
+
+    //store the names of the documents, one per line, in the order of their ids
+    void store_names(const std::string& file) const {
+        std::ofstream ofs(file);
+        for(auto const& name : names) ofs<<name<<"\n";
+    }
+};
+#endif //LPG_COMPRESSOR_COLLECTION_HPP
@@ -119,11 +119,12 @@ public:
     }
 
 
-    void build(utils::nav_grammar& NG, const plain_grammar& Gr, const size_t& text_length,utils::lenght_rules& rules_off, const size_type& init_rule){
+    void build(utils::nav_grammar& NG, const plain_grammar& Gr, const size_t& text_length,utils::lenght_rules& rules_off, const size_type& init_rule,
+               sdsl::cache_config& config){
 #ifdef DEBUG_INFO
         std::cout<<"build_tree(Gr,NG,text_length);\n";
 #endif
-        build_tree(Gr,NG,text_length,rules_off,init_rule);
+        build_tree(Gr,NG,text_length,rules_off,init_rule,config);
 #ifdef DEBUG_INFO
         std::cout<<"compute_aux_st();\n";
 #endif
@@ -198,6 +199,14 @@ public:
     inline size_type get_text_len()const { return L.size();}
     inline size_type selectL(const size_type &i)const{ return select_L(i);}
     inline size_type num_leaves()const{return rank_L(L.size());}
+    //rank of the leaf whose phrase contains the text position i
+    inline size_type leaf_from_pos(const size_type &i)const{ return rank_L(i+1);}
+    //length of the text segment covered by the subtree of node
+    inline size_type node_len(const size_type& node) const {
+        size_type l_leaf = T.lastleaf(node);
+        size_type end = l_leaf < num_leaves() ? select_L(l_leaf + 1) : L.size();
+        return end - offset_node(node);
+    }
 
 protected:
 
@@ -208,7 +217,7 @@ protected:
      * */
 
     void build_tree( const plain_grammar& Gr,utils::nav_grammar& grammar, const size_t& text_length,utils::lenght_rules& rules_off
-                     ,const size_type& init_rule){
+                     ,const size_type& init_rule, sdsl::cache_config& config){
 
         size_type nnodes = (Gr.g - Gr.sigma);
 #ifdef DEBUG_INFO
@@ -217,15 +226,16 @@ protected:
 #endif
         sdsl::bit_vector _bv(2 * nnodes  - 1 , 1);
         size_type pos = 0; // offset in tree topology bitvector
-        std::set<size_type> M; //
+        sdsl::bit_vector M(Gr.r, false); // mark the rules already visited (first mentions)
+        rules_off.assign(Gr.r, {0, 0});
         sdsl::bit_vector _z(nnodes, 0); // mark if the node i in preorder is a first mention node
 
         sdsl::int_vector_buffer<1> is_rules_len(Gr.is_rl_file);
         size_type n_l = 0; // count the number of runs
         for (size_type i = 0; i < is_rules_len.size(); ++i) {
             if(is_rules_len[i]){
-                auto it = grammar[i];
-                if(it.size() == 2 && it[1] > 2) //(X-> Xi^l === Xi,l ) check if l > 2 else is not consider as a run length node...
+                auto rhs = grammar[i];
+                if(rhs.size() == 2 && rhs[1] > 2) //(X-> Xi^l === Xi,l ) check if l > 2 else is not consider as a run length node...
                     n_l++;
             }
         }
@@ -253,7 +263,7 @@ protected:
                 z_pos ++ ; // pre-incress offset in vector z;
                 _l[l_pos] = true; // mark text position for first time visit
 
-                if (M.find(id) != M.end()) { // second mention of a non-terminal => leaf tree
+                if (M[id]) { // second mention of a non-terminal => leaf tree
 
                     _bv[pos] = false; // add to the tree as leaf
                     ++pos; // increase off in tree
@@ -265,7 +275,7 @@ protected:
                     return false; // return false stop descending in the tree
                 }
 
-                M.insert(id); // store first mention of a rule tree
+                M[id] = true; // store first mention of a rule tree
                 _z[ z_pos - 1 ] = true; //mark the node as first mention (we index in z_pos -1 because we pre increase the off)
                 _f[id] = ++z_rank; // map the rule with the number of 1s in z;
 
@@ -335,10 +345,15 @@ protected:
 
         T.build(_bv);
         sdsl::util::bit_compress(_x);
-        std::ofstream x_file("x_file", std::ios::binary);
+        std::string x_file_name = sdsl::cache_file_name("x_file", config);
+        std::ofstream x_file(x_file_name, std::ios::binary);
         sdsl::serialize(_x, x_file);
         x_file.close();
-        sdsl::construct(X, "x_file", 0);
+        sdsl::construct(X, x_file_name, config, 0);
+        if(remove(x_file_name.c_str())){
+            std::cout<<"Error trying to remove temporal file "<<x_file_name<<std::endl;
+            exit(1);
+        }
         F = vi (_f);
         Z = bv_z(_z);
         L = bv_l (_l);
@@ -6,11 +6,15 @@
 #define LPG_COMPRESSOR_GRID_H
 
 
+#include <variant>
+#include <algorithm>
 #include <sdsl/rrr_vector.hpp>
+#include <sdsl/rank_support_v5.hpp>
 #include "../sdsl-files/wt_int.hpp"
-#include <sdsl/construct.hpp>
+#include "../sdsl-files/wm_int.hpp"
 #include "macros.hpp"
 #include "utils.hpp"
+#include "cdt/parallel_sort.hpp"
 
 struct grid_point{
 
@@ -38,13 +42,29 @@ struct grid_point{
 
 };
 
+//point of the grid during the construction: the row and the column are packed in one
+// word (the row in the high bits), so the points are sorted by (row, col) comparing one
+// integer. The label breaks the ties, so the order does not depend on the threads
+struct packed_point{
+    uint64_t key{};
+    uint64_t label{};
+
+    bool operator<(const packed_point& other) const {
+        return key < other.key || (key == other.key && label < other.label);
+    }
+};
+
 struct grid_query{
     size_t row1{};
     size_t col1{};
     size_t row2{};
     size_t col2{};
 };
-class grid {
+//Grid of the index over a 2D range structure wt_t (a wavelet tree or a wavelet matrix
+// with range_search_2d2 and select) and a bitvector bv_x that maps the rows to the
+// positions of their points
+template<class wt_t, class bv_t>
+class basic_grid {
 
 public:
 
@@ -52,15 +72,8 @@ public:
     typedef grid_point                                     point;
     typedef grid_query                                     query;
     typedef size_t                                     size_type;
-    typedef sdsl::rrr_vector<>                             wt_bv;
-    typedef sdsl::wt_int<
-            wt_bv,
-            wt_bv::rank_1_type,
-            wt_bv::select_1_type,
-            wt_bv::select_0_type
-            >                                               wt_s;
-//    typedef sdsl::wt_int<> wt_s;
-    typedef sdsl::rrr_vector<>                              bv_x;
+    typedef wt_t                                            wt_s;
+    typedef bv_t                                            bv_x;
     typedef sdsl::int_vector<>                                vi;
 
 protected:
@@ -71,36 +84,50 @@ protected:
     bv_x xb;
 
 //    bv_x::rank_1_type xb_rank1;
-    bv_x::select_1_type xb_sel1;
+    typename bv_x::select_1_type xb_sel1;
 //    bv_x::select_0_type xb_sel0;
 //    bv_x::rank_1_type xa_rank1;
 
 public:
 
-    grid() = default;
-    grid( const grid& _g ):sb(_g.sb), labels(_g.labels),xb(_g.xb) {
+    basic_grid() = default;
+    basic_grid( const basic_grid& _g ):sb(_g.sb), labels(_g.labels),xb(_g.xb) {
         compute_rank_select_st();
     }
-    grid(const std::vector<point>& _points) {
-        build(_points);
+    basic_grid(const std::vector<point>& _points, thread_pool& pool) {
+        build(_points, pool);
     }
 
-    virtual ~grid() = default;
-    void build(const std::vector<point>& _points) {
-        std::vector<point> level_points(_points.size());
-        size_type n_cols = 0,n_rows = 0, n_points = 0;
+    //the select structure points to xb, so it has to be rebuilt on every copy
+    basic_grid& operator=(const basic_grid& _g){
+        if(this != &_g){
+            sb = _g.sb;
+            labels = _g.labels;
+            xb = _g.xb;
+            compute_rank_select_st();
+        }
+        return *this;
+    }
+
+    virtual ~basic_grid() = default;
+    void build(const std::vector<point>& _points, thread_pool& pool) {
+        size_type n_cols = 0,n_rows = 0, n_points = _points.size(), max_label = 0;
         for (const auto & _point : _points){
-            level_points[n_points] = _point;
             n_cols = (n_cols < _point.col)? _point.col:n_cols;
             n_rows = (n_rows < _point.row)? _point.row:n_rows;
-            ++n_points;
+            max_label = (max_label < _point.label)? _point.label:max_label;
         }
 #ifdef DEBUG_INFO
         std::cout<<"GRID:n_points:"<<n_points<<std::endl;
         std::cout<<"GRID:n_cols:"<<n_cols<<std::endl;
         std::cout<<"GRID:n_rows:"<<n_rows<<std::endl;
 #endif
-        sort_points(level_points);
+        uint8_t col_bits = sdsl::bits::hi(std::max<size_type>(n_cols, 1))+1;
+        if(sdsl::bits::hi(std::max<size_type>(n_rows, 1))+1+col_bits > 64){
+            std::cout<<"Error: the rows and the columns of the grid do not fit in 64 bits"<<std::endl;
+            exit(1);
+        }
+        std::vector<packed_point> level_points = sort_points(_points, col_bits, pool);
 
 #ifdef DEBUG_INFO
         std::fstream fout("points",std::ios::out|std::ios::binary);
@@ -114,12 +141,12 @@ public:
 
         std::cout<<"sort_points"<<n_rows<<std::endl;
 #endif
-        build_bitvectors(level_points,n_cols,n_rows,n_points);
+        build_bitvectors(level_points,col_bits,n_rows,n_points);
 
 #ifdef DEBUG_INFO
         std::cout<<"build_bitvectors"<<n_rows<<std::endl;
 #endif
-        build_wt_and_labels(level_points,n_cols,n_rows,n_points);
+        build_wt_and_labels(level_points,col_bits,max_label,n_points,pool);
 #ifdef DEBUG_INFO
         std::cout<<"build_wt_and_labels"<<n_rows<<std::endl;
 #endif
@@ -128,25 +155,12 @@ public:
         std::cout<<"compute_rank_select_st"<<n_rows<<std::endl;
 #endif
     }
-    void build(const std::vector<point>& _points,uint32_t level) {
+    void build(const std::vector<point>& _points,uint32_t level, thread_pool& pool) {
 
         std::vector<point> level_points;
-        size_type n_cols = 0,n_rows = 0, n_points = 0;
         for (const auto & _point : _points)
-            if(_point.level == level){
-                level_points.push_back(_point);
-                /**
-                 * compute max and min of col and row values...
-                 * */
-                n_cols = (n_cols < _point.col)? _point.col:n_cols;
-                n_rows = (n_rows < _point.row)? _point.row:n_rows;
-                ++n_points;
-            }
-
-        sort_points(level_points);
-        build_bitvectors(level_points,n_cols,n_rows,n_points);
-        build_wt_and_labels(level_points,n_cols,n_rows,n_points);
-        compute_rank_select_st();
+            if(_point.level == level) level_points.push_back(_point);
+        build(level_points, pool);
     }
 
     void breakdown_space() const {
@@ -157,16 +171,32 @@ public:
 
 protected:
 
-    void sort_points(std::vector<point>& _points){
+    //blocks of whole multiples of 64 points, so the tasks of the pool never write the same
+    // word of a bit-packed vector
+    static std::vector<size_type> point_blocks(size_type n_points, thread_pool& pool){
+        size_type n_words = (n_points+63)/64;
+        size_type n_blocks = std::max<size_type>(1, std::min<size_type>(n_words, 4*pool.size()));
+        std::vector<size_type> limits(n_blocks+1);
+        for(size_type i=0;i<=n_blocks;i++){
+            limits[i] = std::min(((i*n_words)/n_blocks)*64, n_points);
+        }
+        return limits;
+    }
+
+    std::vector<packed_point> sort_points(const std::vector<point>& _points, uint8_t col_bits, thread_pool& pool){
         /*
          * Sort _points by rows (rules) then by cols(suffix)
          * */
-        sort(_points.begin(), _points.end(), [](const point &a, const point &b) -> bool
-        {
-            if (a.row < b.row) return true;
-            if (a.row > b.row) return false;
-            return (a.col) < (b.col);
+        std::vector<packed_point> p_points(_points.size());
+        std::vector<size_type> limits = point_blocks(_points.size(), pool);
+        pool.parallel_for(limits.size()-1, [&](size_t b, size_t){
+            for(size_type i=limits[b];i<limits[b+1];i++){
+                p_points[i].key = (uint64_t(_points[i].row)<<col_bits) | _points[i].col;
+                p_points[i].label = _points[i].label;
+            }
         });
+        parallel_sort(p_points.begin(), p_points.end(), std::less<packed_point>(), pool);
+        return p_points;
     }
 
     size_type map(const size_type  & row) const{
@@ -174,7 +204,7 @@ protected:
         return xb_sel1(row)-row+1;
     }
 
-    void build_bitvectors(const std::vector<point>& _points, const size_type& n_cols, const size_type& n_rows,const size_type& n_points){
+    void build_bitvectors(const std::vector<packed_point>& _points, uint8_t col_bits, const size_type& n_rows,const size_type& n_points){
 
         std::vector<size_type> card_rows(n_rows, 0);
 //        std::vector<size_type> card_cols(n_cols, 0);
@@ -183,12 +213,13 @@ protected:
         * Computing the cardinal of every column and every row
         * */
         for (size_type i = 0; i < n_points; ++i) {
-            if(_points[i].row != 0){
-                card_rows.at(_points[i].row - 1)++;
+            size_type row = _points[i].key >> col_bits;
+            if(row != 0){
+                card_rows.at(row - 1)++;
             }else{
                 std::cout<<"ZERO WARNING!!!!"<<std::endl;
-                std::cout<<"row:"<<_points[i].row<<std::endl;
-                std::cout<<"col:"<<_points[i].col<<std::endl;
+                std::cout<<"row:"<<row<<std::endl;
+                std::cout<<"col:"<<(_points[i].key & sdsl::bits::lo_set[col_bits])<<std::endl;
                 std::cout<<"label:"<<_points[i].label<<std::endl;
             }
 //            card_cols[_points[i].col - 1]++;
@@ -225,32 +256,24 @@ protected:
 //        xa = bv_x(build_bv(card_rows,n_points,n_rows));
     }
 
-    void build_wt_and_labels(const std::vector<point>& _points, const size_type& n_cols,const size_type& n_rows,const size_type& n_points){
+    void build_wt_and_labels(const std::vector<packed_point>& _points, uint8_t col_bits, const size_type& max_label,
+                             const size_type& n_points, thread_pool& pool){
 
         /**
          * Build a wavelet_tree on SB( index of the columns not empty ) and plain representation for SL(labels)
          * */
-        std::ofstream sb_file("sb_file", std::ios::binary);
-        sdsl::int_vector<> _sl(n_points,0);
-        sdsl::int_vector<> _sb(n_points,0);
-
-        size_type j = 0;
-        for (size_type  i = 0; i < n_points; ++i) {
-            _sl[j] = _points[i].label;
-            _sb[j] = _points[i].col;
-            ++j;
-        }
-
-        sdsl::util::bit_compress(_sl);
-        sdsl::util::bit_compress(_sb);
-
-        labels = vi(_sl);
-        sdsl::serialize(_sb,sb_file);
-        sb_file.close();
-        //todo refactor wt construction...
-        std::string id_sb = sdsl::util::basename("sb_file") + "_";
-        sdsl::cache_config file_conf_sb(false,"./",id_sb);
-        sdsl::construct(sb,"sb_file",file_conf_sb,0);
+        //both are built in memory with the workers of the pool (no temporal files)
+        sdsl::int_vector<64> _sb(n_points,0);
+        labels = vi(n_points, 0, max_label==0 ? 1 : sdsl::bits::hi(max_label)+1);
+
+        std::vector<size_type> limits = point_blocks(n_points, pool);
+        pool.parallel_for(limits.size()-1, [&](size_t b, size_t){
+            for (size_type i = limits[b]; i < limits[b+1]; ++i) {
+                labels[i] = _points[i].label;
+                _sb[i] = _points[i].key & sdsl::bits::lo_set[col_bits];
+            }
+        });
+        sb = wt_s(_sb, pool);
 #ifdef DEBUG_PRINT
         std::cout<<"GRID:SB"<<std::endl;
         for (int i = 0; i < sb.size(); ++i) {
@@ -266,7 +289,7 @@ protected:
     }
 
     void compute_rank_select_st(){
-        xb_sel1 = bv_x::select_1_type(&xb);
+        xb_sel1 = typename bv_x::select_1_type(&xb);
     }
 
 
@@ -313,6 +336,130 @@ public:
 };
 
 
+//2D range structures available for the grid
+enum grid_backend{
+    GRID_RRR=0, //wavelet tree over rrr_vector (smallest, slowest)
+    GRID_PLAIN, //wavelet tree over plain bit_vector with rank_support_v5
+    GRID_WM     //wavelet matrix over plain bit_vector with rank_support_v5
+};
+
+typedef sdsl::rrr_vector<>                                                       grid_rrr_bv;
+typedef sdsl::rank_support_v5<1, 1>                                              grid_plain_rank;
+typedef basic_grid<sdsl::wt_int<grid_rrr_bv, grid_rrr_bv::rank_1_type,
+                                 grid_rrr_bv::select_1_type,
+                                 grid_rrr_bv::select_0_type>, grid_rrr_bv>          grid_rrr;
+typedef basic_grid<sdsl::wt_int<sdsl::bit_vector, grid_plain_rank,
+                                 sdsl::select_support_mcl<1, 1>,
+                                 sdsl::select_support_mcl<0, 1>>, sdsl::bit_vector> grid_plain;
+typedef basic_grid<sdsl::wm_int<sdsl::bit_vector, grid_plain_rank,
+                                 sdsl::select_support_mcl<1, 1>,
+                                 sdsl::select_support_mcl<0, 1>>, sdsl::bit_vector> grid_wm;
+
+//Grid whose backend is chosen when the index is built. The backend is stored in the
+// index file, so the grid is loaded with the same structure it was built with
+class grid {
+
+public:
+
+    typedef grid_point                                     point;
+    typedef grid_query                                     query;
+    typedef size_t                                     size_type;
+
+private:
+
+    std::variant<grid_rrr, grid_plain, grid_wm> m_impl;
+
+    void select_backend(grid_backend backend){
+        switch (backend) {
+            case GRID_RRR:
+                m_impl.emplace<grid_rrr>();
+                break;
+            case GRID_PLAIN:
+                m_impl.emplace<grid_plain>();
+                break;
+            case GRID_WM:
+                m_impl.emplace<grid_wm>();
+                break;
+            default:
+                std::cout<<"Error: unknown grid backend "<<(int)backend<<std::endl;
+                exit(1);
+        }
+    }
+
+public:
+
+    explicit grid(grid_backend backend=GRID_RRR){
+        select_backend(backend);
+    }
+
+    grid(const std::vector<point>& _points, thread_pool& pool, grid_backend backend=GRID_RRR){
+        select_backend(backend);
+        build(_points, pool);
+    }
+
+    [[nodiscard]] grid_backend backend() const {
+        return grid_backend(m_impl.index());
+    }
+
+    static const char* backend_name(grid_backend backend){
+        switch (backend) {
+            case GRID_RRR: return "rrr";
+            case GRID_PLAIN: return "plain";
+            case GRID_WM: return "wm";
+            default: return "unknown";
+        }
+    }
+
+    void build(const std::vector<point>& _points, thread_pool& pool) {
+        std::visit([&](auto& g){ g.build(_points, pool); }, m_impl);
+    }
+
+    void build(const std::vector<point>& _points,uint32_t level, thread_pool& pool) {
+        std::visit([&](auto& g){ g.build(_points, level, pool); }, m_impl);
+    }
+
+    void breakdown_space() const {
+        std::cout<<"backend:"<<backend_name(backend())<<std::endl;
+        std::visit([](auto const& g){ g.breakdown_space(); }, m_impl);
+    }
+
+    void load(std::istream &in) {
+        uint8_t tag;
+        sdsl::read_member(tag, in);
+        select_backend(grid_backend(tag));
+        std::visit([&](auto& g){ g.load(in); }, m_impl);
+    }
+
+    size_type serialize(std::ostream &out, sdsl::structure_tree_node *v, const std::string& name) const {
+        sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
+        size_t written_bytes = 0;
+        auto tag = uint8_t(m_impl.index());
+        written_bytes += sdsl::write_member(tag, out, child, "backend");
+        written_bytes += std::visit([&](auto const& g){ return g.serialize(out, child, "impl"); }, m_impl);
+        sdsl::structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    [[nodiscard]] inline size_type first_label_col(const size_type  & col) const{
+        return std::visit([&](auto const& g){ return g.first_label_col(col); }, m_impl);
+    }
+
+    [[nodiscard]] inline size_type size_cols()const{
+        return std::visit([](auto const& g){ return g.size_cols(); }, m_impl);
+    }
+
+    inline void search_2d(const query& q,std::vector<size_type>& R) const{
+        std::visit([&](auto const& g){ g.search_2d(q, R); }, m_impl);
+    }
+};
+
+
+//Grid partitioned by the level of the points. Every level has its own grid whose rows
+// and columns are only those of its points (renumbered from 1, in the order of the global
+// grid), so the binary searches and the range reports of a level never touch the rows and
+// columns of the other levels. Besides, every level keeps the length of its longest row
+// and column expansions: a cut whose prefix or suffix is longer than those can not have
+// occurrences in the level
 class grid_t {
 
 public:
@@ -326,40 +473,85 @@ public:
 
 protected:
     std::vector<_grid> grid_levels{};
-    vi  level_columns_map;
+    std::vector<vi>    level_rows{};   //level_rows[l-1][r-1] is the global row of the local row r of level l
+    std::vector<vi>    level_cols{};   //level_cols[l-1][c-1] is the global column of the local column c of level l
+    vi  level_columns_map;             //level of every global column
+    vi  level_max_row_len;             //longest row expansion of every level
+    vi  level_max_col_len;             //longest column suffix of every level
 
 
 public:
 
     grid_t () = default;
 
-    grid_t (const grid_t & _g ){
-        for (uint32_t i = 0; i < _g.grid_levels.size() ; ++i) {
-            grid_levels[i] = _g.grid_levels[i];
+    grid_t (const grid_t & _g ) = default;
+
+    //the level of a point goes from 1 to _l. max_row_len[l-1] and max_col_len[l-1] are the
+    // longest expansions of the rows and the columns with points in level l
+    grid_t (const std::vector<point>& _points,const uint32_t &_l, const std::vector<size_type>& max_row_len,
+            const std::vector<size_type>& max_col_len, thread_pool& pool, grid_backend backend=GRID_RRR) {
+
+        size_type n_cols = 0;
+        for (const auto & _point : _points) n_cols = std::max(n_cols, _point.col);
+
+        sdsl::int_vector<> V(n_cols, 0);
+        std::vector<std::vector<point>> by_level(_l);
+        for (const auto & _point : _points) {
+            assert(_point.level>=1 && _point.level<=_l);
+            by_level[_point.level-1].push_back(_point);
+            V[_point.col-1] = _point.level;
         }
-        level_columns_map = _g.level_columns_map;
-    }
 
-    grid_t (const std::vector<point>& _points,const uint32_t &_l) {
-        grid_levels.resize(_l);
+        grid_levels.assign(_l, _grid(backend));
+        level_rows.resize(_l);
+        level_cols.resize(_l);
         for (uint32_t i = 0; i < _l  ; ++i) {
-            grid_levels[i].build(_points,i+1);
-//            std::cout<<"grid-level-"<<i+1<<std::endl;
-        }
-        sdsl::int_vector<> V(_points.size(),0);
-        for (size_type i = 0; i < _points.size() ; ++i) {
-            V[i] = _points[i].level;
+            auto& lv_points = by_level[i];
+
+            //local rows
+            std::vector<size_type> rows;
+            rows.reserve(lv_points.size());
+            for (const auto & _point : lv_points) rows.push_back(_point.row);
+            parallel_sort(rows.begin(), rows.end(), std::less<size_type>(), pool);
+            rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+            //local columns
+            parallel_sort(lv_points.begin(), lv_points.end(), [](const point& a, const point& b){ return a.col < b.col; }, pool);
+            level_cols[i] = vi(lv_points.size(), 0);
+            for (size_type j = 0; j < lv_points.size(); ++j) {
+                level_cols[i][j] = lv_points[j].col;
+                lv_points[j].col = j+1;
+                lv_points[j].row = (std::lower_bound(rows.begin(), rows.end(), lv_points[j].row) - rows.begin()) + 1;
+            }
+
+            level_rows[i] = vi(rows.size(), 0);
+            for (size_type j = 0; j < rows.size(); ++j) level_rows[i][j] = rows[j];
+            sdsl::util::bit_compress(level_rows[i]);
+            sdsl::util::bit_compress(level_cols[i]);
+
+            if(!lv_points.empty()) grid_levels[i].build(lv_points, pool);
+            std::vector<point>().swap(lv_points);
         }
+
         sdsl::util::bit_compress(V);
         level_columns_map = vi(V);
 
+        level_max_row_len = vi(_l, 0);
+        level_max_col_len = vi(_l, 0);
+        for (uint32_t i = 0; i < _l  ; ++i) {
+            level_max_row_len[i] = max_row_len[i];
+            level_max_col_len[i] = max_col_len[i];
+        }
+        sdsl::util::bit_compress(level_max_row_len);
+        sdsl::util::bit_compress(level_max_col_len);
     }
 
     void breakdown_space() const {
 
         std::cout<<"level_columns_map,"<<sdsl::size_in_bytes(level_columns_map)<<std::endl;
         for(size_t i=0;i<grid_levels.size();i++) {
-            std::cout<<"grid_levels["<<i+1<<"],"<<sdsl::size_in_bytes(grid_levels[i])<<std::endl;
+            std::cout<<"grid_levels["<<i+1<<"],"<<sdsl::size_in_bytes(grid_levels[i])+sdsl::size_in_bytes(level_rows[i])+
+                     sdsl::size_in_bytes(level_cols[i])<<","<<level_rows[i].size()<<" rows,"<<level_cols[i].size()<<" cols"<<std::endl;
         }
 
     }
@@ -370,10 +562,16 @@ public:
     void load(std::istream &in) {
 
         sdsl::load(level_columns_map,in);
+        sdsl::load(level_max_row_len,in);
+        sdsl::load(level_max_col_len,in);
         size_type levels;
         sdsl::load(levels,in);
         grid_levels.resize(levels);
+        level_rows.resize(levels);
+        level_cols.resize(levels);
         for (uint32_t i = 0; i < levels; ++i) {
+            sdsl::load(level_rows[i],in);
+            sdsl::load(level_cols[i],in);
             grid_levels[i].load(in);
         }
     }
@@ -384,12 +582,14 @@ public:
         sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
         size_t written_bytes = 0;
         written_bytes += sdsl::serialize(level_columns_map,out);
-        std::cout<<"written_bytes += sdsl::serialize(level_columns_map,out);"<<std::endl;
+        written_bytes += sdsl::serialize(level_max_row_len,out);
+        written_bytes += sdsl::serialize(level_max_col_len,out);
         size_type levels = grid_levels.size();
         written_bytes += sdsl::serialize(levels,out);
         for (uint32_t i = 0; i < levels; ++i) {
+            written_bytes += sdsl::serialize(level_rows[i],out);
+            written_bytes += sdsl::serialize(level_cols[i],out);
             written_bytes += sdsl::serialize(grid_levels[i],out);
-            std::cout<<"written_bytes += sdsl::serialize(grid_levels["<<i<<"],out);"<<std::endl;
         }
         return written_bytes;
     }
@@ -397,10 +597,18 @@ public:
 
     size_type get_preorder_node_from_suffix(const size_type & sfx, const uint32_t& level) const{
         // if the sfx is in level it should be a point
-        if(level_columns_map[sfx] != level)
+        if(level_columns_map[sfx-1] != level)
             return 0;
-        return grid_levels[level-1].first_label_col(sfx);
+        auto const& cols = level_cols[level-1];
+        size_type col = std::lower_bound(cols.begin(), cols.end(), sfx) - cols.begin() + 1;
+        return grid_levels[level-1].first_label_col(col);
+    }
+
+    //label of a global column, and number of global columns
+    size_type first_label_col(const size_type & col) const{
+        return get_preorder_node_from_suffix(col, level_columns_map[col-1]);
     }
+    size_type size_cols() const{ return level_columns_map.size();}
 
     /**
      * O(G) this is linear on G but can reduce the number of extraction rules expanded to compares
@@ -417,6 +625,31 @@ public:
         }
     }
 
+    //can a cut with a prefix of length pre_len and a suffix of length sfx_len have points in level?
+    [[nodiscard]] inline bool fits(const uint32_t& level, const size_type& pre_len, const size_type& sfx_len) const{
+        return level_max_row_len[level-1] >= pre_len && level_max_col_len[level-1] >= sfx_len;
+    }
+
+    //map a range of global rows and columns to the local rows and columns of level. The local
+    // rows and columns keep the global order, so the map is a pair of lower bounds per axis.
+    // Returns false if the range has no row or no column in the level
+    bool local_range(const uint32_t& level, const grid_query& global, grid_query& local) const{
+        auto const& rows = level_rows[level-1];
+        auto const& cols = level_cols[level-1];
+        local.row1 = std::lower_bound(rows.begin(), rows.end(), global.row1) - rows.begin() + 1;
+        local.row2 = std::upper_bound(rows.begin(), rows.end(), global.row2) - rows.begin();
+        if(local.row1 > local.row2) return false;
+        local.col1 = std::lower_bound(cols.begin(), cols.end(), global.col1) - cols.begin() + 1;
+        local.col2 = std::upper_bound(cols.begin(), cols.end(), global.col2) - cols.begin();
+        return local.col1 <= local.col2;
+    }
+
+    [[nodiscard]] inline const _grid& get_level(const uint32_t& level) const{ return grid_levels[level-1]; }
+    [[nodiscard]] inline size_type size_rows(const uint32_t& level) const{ return level_rows[level-1].size(); }
+    [[nodiscard]] inline size_type row_id(const uint32_t& level, const size_type& row) const{ return level_rows[level-1][row-1]; }
+    [[nodiscard]] inline size_type size_cols(const uint32_t& level) const{ return level_cols[level-1].size(); }
+    [[nodiscard]] inline size_type col_id(const uint32_t& level, const size_type& col) const{ return level_cols[level-1][col-1]; }
+
     void search (const grid_query& q,const uint32_t & level, std::vector<size_type>&results) const {
         grid_levels[level-1].search_2d(q,results);
     }
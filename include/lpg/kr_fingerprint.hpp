@@ -0,0 +1,106 @@
+#ifndef LPG_COMPRESSOR_KR_FINGERPRINT_HPP
+#define LPG_COMPRESSOR_KR_FINGERPRINT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+
+//Karp-Rabin fingerprints modulo the Mersenne prime 2^61-1. The fingerprint of a string s
+// is sum_{j} s[j]*B^(|s|-1-j), so the fingerprint of a concatenation xy is
+// kr(x)*B^|y| + kr(y)
+namespace kr{
+
+    constexpr uint64_t prime = (1ULL<<61)-1;
+    constexpr uint64_t base = 0x1c3f2e97a5b4d1fULL % prime;
+
+    inline uint64_t add(uint64_t a, uint64_t b){
+        uint64_t r = a+b;
+        return r>=prime ? r-prime : r;
+    }
+
+    inline uint64_t sub(uint64_t a, uint64_t b){
+        return a>=b ? a-b : a+prime-b;
+    }
+
+    inline uint64_t mul(uint64_t a, uint64_t b){
+        __uint128_t r = (__uint128_t)a*b;
+        uint64_t res = uint64_t(r & prime) + uint64_t(r>>61);
+        return res>=prime ? res-prime : res;
+    }
+
+    //b^e
+    inline uint64_t pow(uint64_t e, uint64_t b){
+        uint64_t res=1;
+        while(e){
+            if(e & 1UL) res = mul(res, b);
+            b = mul(b, b);
+            e>>=1UL;
+        }
+        return res;
+    }
+
+    //B^e
+    inline uint64_t pow(uint64_t e){
+        return pow(e, base);
+    }
+
+    //random base in [2^8, prime-1]. The fingerprints that are not stored in the index use
+    // it, so no input can be built to make them collide
+    inline uint64_t random_base(){
+        std::random_device rd;
+        std::mt19937_64 rng((uint64_t(rd())<<32UL) | rd());
+        return (1ULL<<8) + rng() % (prime - (1ULL<<8));
+    }
+
+    //fingerprint of xy, where b_pow_y is B^|y|
+    inline uint64_t concat(uint64_t kr_x, uint64_t kr_y, uint64_t b_pow_y){
+        return add(mul(kr_x, b_pow_y), kr_y);
+    }
+
+    //fingerprint of x^k, where b_pow_x is B^|x|
+    inline uint64_t repeat(uint64_t kr_x, uint64_t b_pow_x, uint64_t k){
+        uint64_t res=0, res_pow=1;
+        uint64_t sq = kr_x, sq_pow = b_pow_x;//fingerprint and power of x^(2^i)
+        while(k){
+            if(k & 1UL){
+                res = concat(res, sq, sq_pow);
+                res_pow = mul(res_pow, sq_pow);
+            }
+            sq = concat(sq, sq, sq_pow);
+            sq_pow = mul(sq_pow, sq_pow);
+            k>>=1UL;
+        }
+        return res;
+    }
+}
+
+//fingerprints of the prefixes of a pattern, to get the fingerprint of any of its
+// substrings in O(1) time
+struct kr_pattern{
+
+    const std::string*    str = nullptr;
+    std::vector<uint64_t> pref; //pref[i] = kr(str[0..i-1])
+    std::vector<uint64_t> pows; //pows[i] = B^i
+
+    kr_pattern() = default;
+
+    explicit kr_pattern(const std::string& pattern): str(&pattern), pref(pattern.size()+1), pows(pattern.size()+1){
+        pref[0] = 0;
+        pows[0] = 1;
+        for(size_t i=0;i<pattern.size();i++){
+            pref[i+1] = kr::add(kr::mul(pref[i], kr::base), (uint8_t)pattern[i]);
+            pows[i+1] = kr::mul(pows[i], kr::base);
+        }
+    }
+
+    //fingerprint of str[i..i+len-1]
+    [[nodiscard]] inline uint64_t substr(size_t i, size_t len) const {
+        return kr::sub(pref[i+len], kr::mul(pref[i], pows[len]));
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return pref.size()-1;
+    }
+};
+#endif //LPG_COMPRESSOR_KR_FINGERPRINT_HPP
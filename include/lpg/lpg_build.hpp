@@ -7,10 +7,18 @@
 
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sys/resource.h>
 
 #include "cdt/file_streams.hpp"
 #include "cdt/int_array.h"
 #include "cdt/hash_table.hpp"
+#include "cdt/thread_pool.hpp"
 
 #include <sdsl/int_vector.hpp>
 #include <sdsl/rank_support_v.hpp>
@@ -20,6 +28,73 @@
 #define L_TYPE false
 #define S_TYPE true
 #define BUFFER_SIZE 8388608 //8MB of buffer
+#define SHARED_DICT_STRIPES 8 //shards (lock stripes) per thread in the shared phrase dictionary
+
+//reader for the parses produced by the LMS rounds, with the interface of i_file_stream.
+// The parses are stored bit-packed (in the format of sdsl::int_vector_buffer) with the
+// width of the largest symbol of the round, instead of one size_t per symbol. A parse
+// that fits in the memory budget of the construction is read from RAM instead
+struct packed_file_stream{
+
+    //header of a serialized sdsl::int_vector<>: number of bits and width
+    static constexpr size_t header_bytes = sizeof(uint64_t)+sizeof(uint8_t);
+
+    i_file_stream<uint64_t>   ifs;//the words of the file go through the read-ahead of i_file_stream
+    const sdsl::int_vector<>* mem = nullptr;
+    uint8_t                   width{};
+    size_t                    tot_cells{};
+
+    packed_file_stream(const std::string& i_file, size_t buff_size){
+        uint64_t n_bits=0;
+        std::ifstream in(i_file, std::ios::binary);
+        in.read((char *)&n_bits, sizeof(n_bits));
+        in.read((char *)&width, sizeof(width));
+        if(!in.good() || width==0){
+            std::cout<<"Error trying to read the parse in "<<i_file<<std::endl;
+            exit(1);
+        }
+        tot_cells = n_bits/width;
+        ifs = i_file_stream<uint64_t>(i_file, buff_size, header_bytes);
+    }
+    explicit packed_file_stream(const sdsl::int_vector<>& parse): mem(&parse), width(parse.width()),
+                                                                  tot_cells(parse.size()){}
+    packed_file_stream(packed_file_stream&& other) = default;
+
+    inline size_t size() const{
+        return tot_cells;
+    }
+
+    inline std::string filename() const{
+        return mem==nullptr ? ifs.filename() : "";
+    }
+
+    inline void set_backward(bool val){
+        ifs.set_backward(val);
+    }
+
+    inline size_t read(size_t i) {
+        assert(i<tot_cells);
+        return mem==nullptr ? ifs.read_bits(i*width, (i+1)*width-1) : size_t((*mem)[i]);
+    }
+
+    void close(bool rem=false){
+        if(mem==nullptr) ifs.close(rem);
+    }
+};
+
+//stream to read the input of a parsing round: the text in the first round, and a
+// bit-packed parse in the following ones
+template<class sym_t>
+struct parse_stream{
+    typedef i_file_stream<sym_t> type;
+};
+
+template<>
+struct parse_stream<size_t>{
+    typedef packed_file_stream type;
+};
+
+class build_checkpoint;
 
 class lpg_build {
 
@@ -219,9 +294,16 @@ public:
      * @param config : temporal files handler
      * @param hbuff_size : buffer size for the hashing step
      * @param sep_symbol : string delimiter in the input text
+     * @param mem_budget : bytes of RAM a parse can use before the rounds keep it in memory instead of
+     *                     in a temporal file (0 keeps all the rounds on disk)
+     * @param ckpt : manifest where the finished stages are recorded. The stages it already has are not
+     *               executed again (nullptr disables the checkpoints)
+     * @param shared_dict : the threads insert the phrases into one dictionary shared by all of them instead
+     *                      of private dictionaries limited by hbuff_size that are merged afterwards
      */
     static void compute_LPG(std::string &i_file, std::string &p_gram_file, size_t n_threads, sdsl::cache_config &config,
-                            size_t hbuff_size, alpha_t &alphabet);
+                            size_t hbuff_size, alpha_t &alphabet, size_t mem_budget=0, build_checkpoint* ckpt=nullptr,
+                            bool shared_dict=false);
 
     /***
      * check if the grammar is correct
@@ -234,51 +316,447 @@ public:
 
 private:
 
+    //time (in microseconds) spent in every phase of the LMS parsing rounds
+    struct phase_timings{
+        size_t hash{};   //hashing the phrases in the thread ranges and partitioning them by shard
+        size_t merge{};  //merging the thread dictionaries into the shards of the global one (only
+                         // the shrinking of the shards if the dictionary is shared)
+        size_t assign{}; //sorting the phrases and assigning them ids
+        size_t record{}; //writing the parse chunks
+        size_t update{}; //joining the parse chunks and updating the symbol descriptions
+
+        phase_timings& operator+=(const phase_timings& other){
+            hash+=other.hash;
+            merge+=other.merge;
+            assign+=other.assign;
+            record+=other.record;
+            update+=other.update;
+            return *this;
+        }
+
+        void print(const std::string& indent) const {
+            std::cout<<indent<<"Hashing:          "<<hash<<std::endl;
+            std::cout<<indent<<"Merging:          "<<merge<<std::endl;
+            std::cout<<indent<<"Assigning ids:    "<<assign<<std::endl;
+            std::cout<<indent<<"Recording parse:  "<<record<<std::endl;
+            std::cout<<indent<<"Joining/updating: "<<update<<std::endl;
+        }
+    };
+
+    //elapsed time and memory peak of one of the passes that post-process the grammar. In
+    // Linux, a thread samples the resident memory (VmRSS) of the process from the start to
+    // the end of the pass, and the report is the largest sample. The peak of the process
+    // (VmHWM) is not reset, so mem_monitor still sees it. In other systems the report is the
+    // peak of the whole process
+    struct pass_stats{
+        std::chrono::high_resolution_clock::time_point start;
+        size_t                  rss_peak=0;
+        std::mutex              mutex;
+        std::condition_variable cv;
+        std::thread             sampler;
+        bool                    run=true;
+
+        pass_stats(): start(std::chrono::high_resolution_clock::now()){
+#ifdef __linux__
+            rss_peak = mem_rss();
+            sampler = std::thread([this](){
+                std::unique_lock<std::mutex> lk(mutex);
+                while(!cv.wait_for(lk, std::chrono::milliseconds(10), [this]{ return !run; })){
+                    lk.unlock();
+                    size_t rss = mem_rss();
+                    lk.lock();
+                    rss_peak = std::max(rss_peak, rss);
+                }
+            });
+#endif
+        }
+
+        pass_stats(const pass_stats&) = delete;
+        pass_stats& operator=(const pass_stats&) = delete;
+
+        ~pass_stats(){
+            stop();
+        }
+
+        //resident memory of the process in bytes (0 if it is unknown)
+        static size_t mem_rss(){
+            std::ifstream status("/proc/self/status");
+            std::string line;
+            while(std::getline(status, line)){
+                if(line.rfind("VmRSS:", 0)==0) return std::stoul(line.substr(6))*1024;
+            }
+            return 0;
+        }
+
+        //peak of resident memory in bytes since the pass started
+        size_t mem_peak(){
+#ifdef __linux__
+            stop();
+            if(rss_peak>0) return std::max(rss_peak, mem_rss());
+#endif
+            struct rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+            return usage.ru_maxrss;
+#else
+            return usage.ru_maxrss*1024;
+#endif
+        }
+
+        void print(const std::string& indent){
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout<<indent<<"Elap. time (microsec):      "<<std::chrono::duration_cast<std::chrono::microseconds>(end-start).count()<<std::endl;
+            std::cout<<indent<<"Mem. peak (MiB):            "<<double(mem_peak())/(1024.0*1024.0)<<std::endl;
+        }
+
+    private:
+        void stop(){
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                run = false;
+            }
+            cv.notify_one();
+            if(sampler.joinable()) sampler.join();
+        }
+    };
+
+    //positions [start..end) of the rules array. The first position is the first symbol of
+    // the rule `rule`, and the last one ends a rule (except in the pieces of the compressed string)
+    struct rule_range{
+        size_t rule;
+        size_t start;
+        size_t end;
+    };
+
+    //set or clear bit i of a bit vector that other threads modify at the same time
+    static inline void atomic_set(bv_t& bv, size_t i){
+        __atomic_fetch_or(bv.data()+(i>>6UL), 1UL<<(i & 63UL), __ATOMIC_RELAXED);
+    }
+    static inline void atomic_unset(bv_t& bv, size_t i){
+        __atomic_fetch_and(bv.data()+(i>>6UL), ~(1UL<<(i & 63UL)), __ATOMIC_RELAXED);
+    }
+    //set bit i and return its previous value
+    static inline bool atomic_test_set(bv_t& bv, size_t i){
+        uint64_t mask = 1UL<<(i & 63UL);
+        return __atomic_fetch_or(bv.data()+(i>>6UL), mask, __ATOMIC_RELAXED) & mask;
+    }
+
+    //dictionary of the phrases of a round, split into disjoint shards by the prefix of the
+    // hash of the phrases. The thread dictionaries are partitioned with the same hash, so
+    // every shard is merged by its own worker. A phrase is referred to by the bit offset of
+    // its key in the shard, with the shard id in the lowest shard_bits bits (with one shard,
+    // the references are the offsets of phrase_map_t). A shared dictionary receives the
+    // phrases of all the hashing threads directly, and every shard is then a lock stripe
+    struct phrase_dict{
+        std::vector<std::unique_ptr<phrase_map_t>> shards;
+        uint8_t                                    shard_bits;
+        std::unique_ptr<std::mutex[]>              locks;//one per shard, only if the dictionary is shared
+
+        explicit phrase_dict(size_t n_shards, bool shared=false): shard_bits(n_shards>1 ? sdsl::bits::hi(n_shards-1)+1 : 0){
+            for(size_t i=0;i<n_shards;i++){
+                shards.emplace_back(new phrase_map_t(0, "", 0.85));
+            }
+            if(shared) locks.reset(new std::mutex[n_shards]);
+        }
+
+        [[nodiscard]] inline bool shared() const {
+            return locks!=nullptr;
+        }
+
+        [[nodiscard]] inline size_t n_shards() const {
+            return shards.size();
+        }
+
+        [[nodiscard]] inline size_t shard_of(const void* key, size_t key_bits) const {
+            if(shards.size()==1) return 0;
+            size_t hash = XXH3_64bits(key, INT_CEIL(key_bits, 8));
+            return ((hash>>32UL)*shards.size())>>32UL;
+        }
+
+        [[nodiscard]] inline size_t ref(size_t shard, size_t offset) const {
+            return (offset<<shard_bits) | shard;
+        }
+
+        [[nodiscard]] inline size_t shard_of_ref(size_t ref) const {
+            return ref & ((1UL<<shard_bits)-1UL);
+        }
+
+        [[nodiscard]] inline size_t offset_of_ref(size_t ref) const {
+            return ref>>shard_bits;
+        }
+
+        [[nodiscard]] size_t size() const {
+            size_t n=0;
+            for(auto const& shard : shards) n+=shard->size();
+            return n;
+        }
+
+        //insert a phrase from a hashing thread, or mark it as repeated if it is already in
+        // the dictionary (the same rule as merge_thread_phrases)
+        inline void insert_shared(const void* key, size_t key_bits){
+            size_t s = shard_of(key, key_bits);
+            std::lock_guard<std::mutex> lock(locks[s]);
+            auto res = shards[s]->insert(key, key_bits, 0);
+            if(!res.second) shards[s]->insert_value_at(*res.first, 1UL);
+        }
+
+        inline bool find(const void* key, size_t key_bits, phrase_map_t::val_type& val) const {
+            auto res = shards[shard_of(key, key_bits)]->find(key, key_bits);
+            if(res.second) val = res.first.value();
+            return res.second;
+        }
+
+        inline void get_value_from(size_t ref, phrase_map_t::val_type& val) const {
+            shards[shard_of_ref(ref)]->get_value_from(offset_of_ref(ref), val);
+        }
+
+        inline void insert_value_at(size_t ref, phrase_map_t::val_type val){
+            shards[shard_of_ref(ref)]->insert_value_at(offset_of_ref(ref), val);
+        }
+
+        //visit the phrases, f(ref, value)
+        template<class F>
+        void for_each(const F& f){
+            for(size_t s=0;s<shards.size();s++){
+                auto it = shards[s]->begin();
+                auto it_end = shards[s]->end();
+                while(it!=it_end){
+                    f(ref(s, *it), it.value());
+                    ++it;
+                }
+            }
+        }
+
+        //the hash tables are not needed while the phrases are sorted (only their data)
+        void unload_tables(const std::string& prefix){
+            for(size_t s=0;s<shards.size();s++) shards[s]->unload_table(prefix+"_"+std::to_string(s));
+        }
+
+        void load_tables(const std::string& prefix){
+            for(size_t s=0;s<shards.size();s++){
+                std::string file = prefix+"_"+std::to_string(s);
+                shards[s]->load_table(file);
+                if(remove(file.c_str())){
+                    std::cout<<"Error trying to remove temporal file "<<file<<std::endl;
+                    exit(1);
+                }
+            }
+        }
+    };
+
+    //phrases of a phrase_dict, reinterpreted from the bits of their shards
+    struct phrase_keys{
+        std::vector<key_wrapper> shard_keys;
+        uint8_t                  shard_bits;
+
+        phrase_keys(size_t width, phrase_dict& dict): shard_bits(dict.shard_bits){
+            for(auto & shard : dict.shards){
+                shard_keys.push_back(key_wrapper{width, shard->description_bits(), shard->get_data()});
+            }
+        }
+
+        inline size_t read(size_t ref, size_t idx) const {
+            return shard_keys[ref & ((1UL<<shard_bits)-1UL)].read(ref>>shard_bits, idx);
+        }
+
+        inline size_t size(size_t ref) const {
+            return shard_keys[ref & ((1UL<<shard_bits)-1UL)].size(ref>>shard_bits);
+        }
+
+        //same order as key_wrapper::compare. Two phrases of different shards are compared
+        // symbol by symbol from their last symbol (the first in the key)
+        inline bool compare(size_t a, size_t b) const {
+            size_t mask = (1UL<<shard_bits)-1UL;
+            if((a & mask)==(b & mask)){
+                return shard_keys[a & mask].compare(a>>shard_bits, b>>shard_bits);
+            }
+            size_t a_len = size(a), b_len = size(b);
+            size_t min_len = std::min(a_len, b_len);
+            for(size_t i=1;i<=min_len;i++){
+                size_t sym_a = read(a, a_len-i), sym_b = read(b, b_len-i);
+                if(sym_a!=sym_b) return sym_a<sym_b;
+            }
+            return a_len>b_len;
+        }
+    };
+
+    //sequential reader of the (key, value) pairs a bit_hash_table dumps to its file. The
+    // file is read in blocks, so the memory does not depend on its size
+    struct phrase_dump_reader{
+        std::ifstream       ifs;
+        size_t              file_bits=0;
+        std::vector<buff_t> words;
+        bitstream<buff_t>   bits;
+        size_t              w_start=0; //bit of the file where the block starts
+        size_t              w_bits=0;  //bits of the file in the block
+        size_t              pos=0;     //bit where the next pair starts
+        std::vector<buff_t> key;
+
+        explicit phrase_dump_reader(const std::string& file): ifs(file, std::ios::binary),
+                                                              words(BUFFER_SIZE/sizeof(buff_t)){
+            if(!ifs.good()){
+                std::cout<<"Error trying to read the phrases in "<<file<<std::endl;
+                exit(1);
+            }
+            ifs.seekg(0, std::ifstream::end);
+            file_bits = size_t(ifs.tellg())*8;
+            ifs.seekg(0, std::ifstream::beg);
+            bits.stream = words.data();
+            bits.stream_size = words.size();
+        }
+
+        //make the bits [pos..end-1] of the file available in the block
+        void fetch(size_t end){
+            if(end<=w_start+w_bits) return;
+            size_t drop = (pos-w_start)/bitstream<buff_t>::word_bits;
+            size_t kept = INT_CEIL(w_bits, bitstream<buff_t>::word_bits)-drop;
+            memmove(words.data(), words.data()+drop, kept*sizeof(buff_t));
+            w_start += drop*bitstream<buff_t>::word_bits;
+            w_bits -= drop*bitstream<buff_t>::word_bits;
+
+            size_t needed = INT_CEIL(end-w_start, bitstream<buff_t>::word_bits);
+            if(needed>words.size()){
+                words.resize(needed);
+                bits.stream = words.data();
+                bits.stream_size = words.size();
+            }
+            auto to_read = (std::streamsize)std::min(words.size()*sizeof(buff_t)-w_bits/8, (file_bits-w_start-w_bits)/8);
+            ifs.read(reinterpret_cast<char *>(words.data())+w_bits/8, to_read);
+            w_bits += size_t(ifs.gcount())*8;
+            if(end>w_start+w_bits){
+                std::cout<<"Error: the file of phrases is truncated"<<std::endl;
+                exit(1);
+            }
+        }
+
+        //read the next pair. The key is zero-padded to whole words
+        bool next(const void*& key_ptr, size_t& key_bits, bool& val){
+            if(pos+32>=file_bits) return false;
+            fetch(pos+32);
+            key_bits = bits.read(pos-w_start, pos-w_start+31);
+            fetch(pos+33+key_bits);
+
+            size_t n_words = INT_CEIL(key_bits, bitstream<buff_t>::word_bits);
+            if(key.size()<n_words) key.resize(n_words);
+            key[n_words-1] = 0;
+            bits.read_chunk(key.data(), pos-w_start+32, pos-w_start+31+key_bits);
+            val = bits.read(pos-w_start+32+key_bits, pos-w_start+32+key_bits);
+            pos += 33+key_bits;
+            key_ptr = key.data();
+            return true;
+        }
+    };
+
+    //writer of (key, value) pairs in the format of the bit_hash_table dumps
+    struct phrase_dump_writer{
+        std::ofstream       ofs;
+        std::vector<buff_t> words;
+        bitstream<buff_t>   bits;
+        size_t              pos=0;
+
+        explicit phrase_dump_writer(const std::string& file, size_t buff_bytes): ofs(file, std::ios::binary),
+                                                                                 words(std::max<size_t>(buff_bytes/sizeof(buff_t), 2), 0){
+            if(!ofs.good()){
+                std::cout<<"Error trying to create the file "<<file<<std::endl;
+                exit(1);
+            }
+            bits.stream = words.data();
+            bits.stream_size = words.size();
+        }
+
+        void push(const void* key, size_t key_bits, bool val){
+            size_t pair_bits = 33+key_bits;
+            if(pos+pair_bits>bits.n_bits()){
+                //write the full words and keep the tail
+                size_t full = pos/bitstream<buff_t>::word_bits;
+                ofs.write(reinterpret_cast<char *>(words.data()), std::streamsize(full*sizeof(buff_t)));
+                words[0] = words[full];
+                pos -= full*bitstream<buff_t>::word_bits;
+                if(pos+pair_bits>bits.n_bits()){
+                    words.resize(INT_CEIL(pos+pair_bits, bitstream<buff_t>::word_bits));
+                    bits.stream = words.data();
+                    bits.stream_size = words.size();
+                }
+            }
+            bits.write(pos, pos+31, key_bits);
+            bits.write_chunk(key, pos+32, pos+31+key_bits);
+            bits.write(pos+32+key_bits, pos+32+key_bits, val);
+            pos += pair_bits;
+        }
+
+        void close(){
+            if(pos>0){
+                size_t last = (pos-1)/bitstream<buff_t>::word_bits;
+                size_t rem = pos % bitstream<buff_t>::word_bits;
+                if(rem>0) words[last] &= bitstream<buff_t>::masks[rem];
+                ofs.write(reinterpret_cast<char *>(words.data()), std::streamsize(INT_CEIL(pos, 8)));
+            }
+            ofs.close();
+        }
+    };
+
     template<class sym_type>
     struct lms_info {
 
-        i_file_stream<sym_type>    ifs;
+        typename parse_stream<sym_type>::type ifs;
         o_file_stream<size_t>      ofs;
+        const bool                 in_memory; //the parse chunk goes to mem_ofs instead of ofs
+        std::vector<size_t>        mem_ofs;
         const sdsl::int_vector<2>& phrase_desc;
 
-        phrase_map_t&              m_map;
+        phrase_dict&               m_map;
         size_t                     start;
         size_t                     end;
         const uint8_t              sym_width;
         string_map_t               thread_map;
 
-        lms_info(std::string &i_file_, std::string &o_file_, phrase_map_t &m_map_,
+        lms_info(typename parse_stream<sym_type>::type &&ifs_, std::string &o_file_, bool in_memory_,
+                 phrase_dict &m_map_,
                  size_t start_, size_t end_,
                  const size_t &alph,
                  const size_t &hb_size, void *hb_addr,
-                 const sdsl::int_vector<2> &phrase_desc_) : ifs(i_file_, BUFFER_SIZE),
-                                                            ofs(o_file_, BUFFER_SIZE, std::ios::out),
+                 const sdsl::int_vector<2> &phrase_desc_) : ifs(std::move(ifs_)),
+                                                            ofs(in_memory_ ? o_file_stream<size_t>() :
+                                                                o_file_stream<size_t>(o_file_, BUFFER_SIZE, std::ios::out)),
+                                                            in_memory(in_memory_),
                                                             phrase_desc(phrase_desc_),
                                                             m_map(m_map_),
                                                             start(start_),
                                                             end(end_),
                                                             sym_width(sdsl::bits::hi(alph)+1),
-                                                            thread_map(hb_size, o_file_+"_phrases", 0.8, hb_addr) {
+                                                            thread_map(hb_size, hb_addr==nullptr ? "" : o_file_+"_phrases", 0.8, hb_addr) {
             //TODO for the moment the input string has to have a sep_symbol appended at the end
             //TODO assertion : sep_symbols cannot be consecutive
         };
 
         inline void hash_phrase(string_t& phrase) {
             phrase.mask_tail();
-            auto res = thread_map.insert(phrase.data(), phrase.n_bits(), false);
+            if(m_map.shared()){
+                m_map.insert_shared(phrase.data(), phrase.n_bits());
+            }else{
+                thread_map.insert(phrase.data(), phrase.n_bits(), false);
+            }
         };
 
         inline void store_phrase(string_t& phrase){
             phrase.mask_tail();
-            auto res = m_map.find(phrase.data(), phrase.n_bits());
-            if(res.second){
-                ofs.push_back(res.first.value()>>1UL);
+            phrase_map_t::val_type val=0;
+            if(m_map.find(phrase.data(), phrase.n_bits(), val)){
+                push_sym(val>>1UL);
             }else{
                 assert(phrase.size()==1 && is_suffix(phrase[0]));
-                ofs.push_back(phrase[0]);
+                push_sym(phrase[0]);
             }
         };
 
+        inline void push_sym(size_t sym){
+            if(in_memory){
+                mem_ofs.push_back(sym);
+            }else{
+                ofs.push_back(sym);
+            }
+        }
+
         inline bool is_suffix(sym_type symbol) const{
             return phrase_desc[symbol] & 2;
         }
@@ -286,14 +764,14 @@ private:
 
     /***
      * Find the previous S* suffix before S[idx]
-     * @tparam sym_t : type of symbol in S
+     * @tparam stream_t : type of the stream for S
      * @param idx : the scan starts from this position
      * @param ifs : input file stream for S
      * @param phrase_desc : input array with the class of each symbol S
      * @return
      */
-    template<class sym_t>
-    static long long prev_lms_sym(long long idx, i_file_stream<sym_t>& ifs, sdsl::int_vector<2>& phrase_desc) {
+    template<class stream_t>
+    static long long prev_lms_sym(long long idx, stream_t& ifs, sdsl::int_vector<2>& phrase_desc) {
 
         bool type, prev_type;
         size_t sym, prev_sym = ifs.read(idx);
@@ -326,42 +804,61 @@ private:
         }
     }
 
-    template<class sym_type>
+    template<class stream_t>
     static std::vector<std::pair<size_t, size_t>>
-    compute_thread_ranges(size_t n_threads, std::string& i_file, sdsl::int_vector<2>& phrase_desct);
+    compute_thread_ranges(size_t n_threads, stream_t& is, sdsl::int_vector<2>& phrase_desct);
 
+    //one round of LMS parsing. The tasks of all the rounds run in the same pool of workers.
+    // If mem_in is not null, the input parse is read from it instead of i_file, and if
+    // mem_out is not null, the output parse is stored in it instead of o_file
     template<class sym_type>
     static size_t
-    compute_LPG_int(std::string &i_file, std::string &o_file, size_t n_threads, size_t hbuff_size,
+    compute_LPG_int(std::string &i_file, std::string &o_file, const sdsl::int_vector<> *mem_in,
+                    sdsl::int_vector<> *mem_out, thread_pool &pool, size_t hbuff_size, bool shared_dict,
                     plain_grammar_t &p_gram, ivb_t &rules, bvb_t &rules_lim,
-                    sdsl::int_vector<2> &phrase_desc, sdsl::cache_config &config);
+                    sdsl::int_vector<2> &phrase_desc, sdsl::cache_config &config, phase_timings& timings,
+                    size_t &psize);
     static void
-    assign_ids(phrase_map_t &mp_map, size_t max_sym, key_wrapper &key_w, ivb_t &r, bvb_t &r_lim,
-               size_t n_threads, sdsl::cache_config &config);
+    assign_ids(phrase_dict &mp_map, size_t max_sym, phrase_keys &key_w, ivb_t &r, bvb_t &r_lim,
+               thread_pool &pool, sdsl::cache_config &config);
 
-    static void join_parse_chunks(const std::string &output_file,
+    //concatenate the (reversed) parse chunks into a bit-packed parse whose cells have width bits
+    static void join_parse_chunks(const std::string &output_file, uint8_t width,
                                   std::vector<std::string> &chunk_files);
-    static void join_thread_phrases(phrase_map_t& mp_map, std::vector<std::string> &chunk_files);
+    //split the phrases a thread dictionary dumped to file into one file per shard of the
+    // global dictionary (file_shard_<s>)
+    static void partition_thread_phrases(const phrase_dict& mp_map, const std::string &file);
+    //insert the phrases of a dumped dictionary into one shard of the global dictionary
+    static void merge_thread_phrases(phrase_map_t& mp_map, const std::string &file);
 
     template<class sym_t>
-    static void * hash_phrases(void * data);
+    static void hash_phrases(lms_info<sym_t>& lms_data);
     template<class sym_t>
-    static void * record_phrases(void *data);
+    static void record_phrases(lms_info<sym_t>& lms_data);
+
+    //the passes that post-process the grammar split the rules into ranges of consecutive
+    // rules with a similar number of symbols and process the ranges in parallel. The
+    // compressed string is one rule, so its symbols are split apart (split_rule)
+    static std::vector<rule_range> rule_ranges(size_t first, size_t last, const bv_t::select_1_type& r_lim_ss,
+                                               size_t n_parts);
+    static void split_rule(size_t rule, size_t start, size_t end, size_t n_parts, std::vector<rule_range>& ranges);
 
     //mark the nonterminals that can be removed from the grammar
-    static bv_t mark_nonterminals(plain_grammar_t& p_gram);
-    static void simplify_grammar(lpg_build::plain_grammar_t &p_gram, bv_t &rem_nts, bv_t::rank_1_type &rem_nts_rs);
-    static void decomp(size_t nt, sdsl::int_vector<> &rules, bv_t::select_1_type &rlim_ss, bv_t &rem_nt,
-                       bv_t::rank_1_type &rem_nt_rs,
-                       ivb_t &dec);
+    static bv_t mark_nonterminals(plain_grammar_t& p_gram, thread_pool& pool);
+    static void simplify_grammar(lpg_build::plain_grammar_t &p_gram, bv_t &rem_nts, bv_t::rank_1_type &rem_nts_rs,
+                                 thread_pool& pool);
+    //expand the removed nonterminals of nt and call f with the (renamed) symbols that remain
+    template<class F>
+    static void decomp(size_t nt, const sdsl::int_vector<> &rules, const bv_t::select_1_type &rlim_ss, const bv_t &rem_nt,
+                       const bv_t::rank_1_type &rem_nt_rs, const F& f);
     //these functions are to build the index
     static void create_lvl_breaks(plain_grammar_t &p_gram, bv_t &rem_nts, bv_t::rank_1_type &rem_nts_rs);
     static std::vector<uint8_t>
     rec_dc(gram_wrapper_t& gram_w, size_t nt, uint8_t lev);
     static void rec_dc_int(gram_wrapper_t& gram_w, size_t nt, uint8_t lev, size_t &pos, bool rm,
                            std::vector<uint8_t> &lms_breaks);
-    static void colex_nt_sort(plain_grammar_t &p_gram);
-    static void run_length_compress(plain_grammar_t& p_gram, sdsl::cache_config& config);
+    static void colex_nt_sort(plain_grammar_t &p_gram, thread_pool& pool);
+    static void run_length_compress(plain_grammar_t& p_gram, thread_pool& pool);
 
 
 
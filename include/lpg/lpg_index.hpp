@@ -8,11 +8,20 @@
 #include <pthread.h>
 #include <iostream>
 #include <cstdlib>
+#include <filesystem>
 #include <mem_monitor/mem_monitor.hpp>
 #include "lpg_build.hpp"
 #include "grammar_tree.hpp"
 #include "grid.hpp"
 #include "macros.hpp"
+#include "occ_sinks.hpp"
+#include "text_stats.hpp"
+#include "collection.hpp"
+#include "kr_fingerprint.hpp"
+#include "prefix_cache.hpp"
+#include "checkpoint.hpp"
+#include "scratch_monitor.hpp"
+#include "cdt/thread_pool.hpp"
 
 class lpg_index {
 
@@ -22,7 +31,12 @@ public:
     typedef typename lpg_build::alpha_t alpha_t;
 
     grammar_tree_t grammar_tree;
+    sdsl::int_vector<> rules_occ; // number of occurrences of every rule in the parse tree of the text
+    sdsl::int_vector<> m_kr; // Karp-Rabin fingerprint of every rule (optional, empty if not built)
     grid m_grid;
+    grid_t m_level_grid; // grid partitioned by the level of the rules (optional, replaces m_grid)
+    prefix_cache m_row_cache; // first bytes of the reversed expansion of every grid row (optional)
+    prefix_cache m_col_cache; // first bytes of the suffix expansion of every grid column (optional)
 
     bv_y Y;
     bv_y::rank_1_type rank_Y;
@@ -32,8 +46,55 @@ public:
     uint8_t parsing_rounds{}; //number of LMS parsing rounds during the grammar construction
     bool rl_compressed{}; // is the grammar run-length compressed?
 
+    //document boundaries when the text is a collection (see collection.hpp). m_docs marks
+    // the first position of every document, and it is empty for a single text
+    sdsl::sd_vector<> m_docs;
+    sdsl::sd_vector<>::rank_1_type rank_docs;
+    sdsl::sd_vector<>::select_1_type select_docs;
+    uint8_t m_doc_sep{}; //separator symbol between consecutive documents
+
+    void build_doc_starts(const doc_collection& docs){
+        sdsl::sd_vector_builder builder(grammar_tree.get_text_len(), docs.doc_starts.size());
+        for(auto const& pos : docs.doc_starts) builder.set(pos);
+        m_docs = sdsl::sd_vector<>(builder);
+        rank_docs = sdsl::sd_vector<>::rank_1_type(&m_docs);
+        select_docs = sdsl::sd_vector<>::select_1_type(&m_docs);
+        m_doc_sep = docs.sep;
+    }
+
+    //raw copy of a vector of plain structs, for the checkpoints of the construction
+    template<class T>
+    static void store_pod_vector(const std::vector<T>& vec, std::ostream& out){
+        size_t n = vec.size();
+        out.write((const char *)&n, sizeof(n));
+        out.write((const char *)vec.data(), std::streamsize(n*sizeof(T)));
+    }
+
+    template<class T>
+    static void load_pod_vector(std::vector<T>& vec, std::istream& in){
+        size_t n = 0;
+        in.read((char *)&n, sizeof(n));
+        vec.resize(n);
+        in.read((char *)vec.data(), std::streamsize(n*sizeof(T)));
+    }
+
     void build_index(const std::string &i_file, plain_grammar_t &p_gram, const size_t &text_length,
-                     sdsl::cache_config &config) {
+                     sdsl::cache_config &config, size_t n_threads, bool build_kr=false, size_t prefix_k=0,
+                     grid_backend backend=GRID_RRR, bool level_grid=false, build_checkpoint* ckpt=nullptr) {
+
+        //the stages "grammar_tree", "suffix_sort" and "grid" of the checkpoint store what the
+        // next stages need, so a resumed construction starts from the last one it finished
+        std::string tree_file = sdsl::cache_file_name("index_tree", config);
+        std::string sfx_file = sdsl::cache_file_name("index_sfx", config);
+        std::string grid_file = sdsl::cache_file_name("index_grid", config);
+        if(ckpt!=nullptr && ckpt->completed("grid")){
+            std::cout << "  Resuming after the stage \"grid\"" << std::endl;
+            sdsl::load_from_file(*this, grid_file);
+            return;
+        }
+        bool tree_done = ckpt!=nullptr && ckpt->completed("grammar_tree");
+        bool sfx_done = tree_done && ckpt->completed("suffix_sort");
+
         m_sigma = p_gram.sigma;
         parsing_rounds = p_gram.rules_per_level.size();
 
@@ -56,19 +117,97 @@ public:
 #endif
         }
 
-        utils::lenght_rules lengths;
-        size_type S;
-        utils::nav_grammar NG = build_nav_grammar(p_gram, S);
-        grammar_tree.build(NG, p_gram, text_length, lengths, S);
         std::vector<utils::sfx> grammar_sfx;
-        //const auto &T = grammar_tree.getT();
-        compute_grammar_sfx(NG, p_gram, lengths, grammar_sfx);
-        NG.clear();
-        lengths.clear();
+        //longest row and column expansions of every level of the grid
+        uint32_t n_levels = 0;
+        std::vector<size_type> max_row_len, max_col_len;
+
+        if(sfx_done){
+            std::cout << "  Resuming after the stage \"suffix_sort\"" << std::endl;
+            std::ifstream in(tree_file, std::ios::binary);
+            grammar_tree.load(in);
+            rules_occ.load(in);
+            m_kr.load(in);
+
+            std::ifstream sfx_in(sfx_file, std::ios::binary);
+            load_pod_vector(grammar_sfx, sfx_in);
+            sfx_in.read((char *)&n_levels, sizeof(n_levels));
+            load_pod_vector(max_row_len, sfx_in);
+            load_pod_vector(max_col_len, sfx_in);
+        }else{
+            utils::lenght_rules lengths;
+            size_type S;
+            utils::nav_grammar NG = build_nav_grammar(p_gram, S);
+            if(tree_done){
+                std::cout << "  Resuming after the stage \"grammar_tree\"" << std::endl;
+                std::ifstream in(tree_file, std::ios::binary);
+                grammar_tree.load(in);
+                rules_occ.load(in);
+                m_kr.load(in);
+                load_pod_vector(lengths, in);
+            }else{
+                grammar_tree.build(NG, p_gram, text_length, lengths, S, config);
+                compute_rules_occ(NG, p_gram, S, rules_occ);
+                if(build_kr) compute_rules_kr(NG, p_gram, lengths, S, kr::base, m_kr);
+                if(ckpt!=nullptr){
+                    {
+                        std::ofstream out(tree_file, std::ios::binary);
+                        grammar_tree.serialize(out, nullptr, "grammar_tree");
+                        rules_occ.serialize(out);
+                        m_kr.serialize(out);
+                        store_pod_vector(lengths, out);
+                    }
+                    ckpt->commit("grammar_tree", {{tree_file, build_checkpoint::WHOLE}});
+                }
+            }
+            std::vector<uint32_t> rule_level;
+            if(level_grid) rule_level = compute_rules_level(NG, p_gram);
+            //const auto &T = grammar_tree.getT();
+            compute_grammar_sfx(NG, p_gram, lengths, grammar_sfx, rule_level);
+
+            if(level_grid){
+                for(auto const& sfx : grammar_sfx) n_levels = std::max<uint32_t>(n_levels, sfx.level);
+                max_row_len.resize(n_levels, 0);
+                max_col_len.resize(n_levels, 0);
+                for(auto const& sfx : grammar_sfx){
+                    size_type row_len = p_gram.isTerminal(sfx.rule) ? 1 : lengths[sfx.rule].second;
+                    max_row_len[sfx.level-1] = std::max(max_row_len[sfx.level-1], row_len);
+                    max_col_len[sfx.level-1] = std::max(max_col_len[sfx.level-1], sfx.len);
+                }
+            }
+            rule_level.clear();
+            //fingerprints of the rules for the suffix sort, with a random base so no input makes
+            // them collide on purpose. They are not the ones of the index (-k), which use kr::base
+            uint64_t sort_base = kr::random_base();
+            sdsl::int_vector<> sort_kr;
+            compute_rules_kr(NG, p_gram, lengths, S, sort_base, sort_kr);
+            NG.clear();
+            utils::lenght_rules().swap(lengths);
 #ifdef DEBUG_INFO
-        std::cout << "sort_suffixes[" << grammar_sfx.size() << "]\n";
+            std::cout << "sort_suffixes[" << grammar_sfx.size() << "]\n";
 #endif
-        utils::sort_suffixes(i_file, grammar_sfx);
+            //the expansions of the suffixes are decoded from the grammar tree
+            auto fetch = [this](size_t off, size_t len, uint8_t *dest){
+                size_t i = 0;
+                extract(off, off + len - 1, [&](const uint8_t& sym){ dest[i++] = sym; });
+            };
+            auto prefix_kr = [this, &sort_kr, sort_base](size_t i){
+                return text_prefix_kr(i, sort_kr, sort_base);
+            };
+            utils::sort_suffixes(grammar_sfx, fetch, prefix_kr, sort_base, n_threads);
+            sdsl::int_vector<>().swap(sort_kr);
+
+            if(ckpt!=nullptr){
+                {
+                    std::ofstream out(sfx_file, std::ios::binary);
+                    store_pod_vector(grammar_sfx, out);
+                    out.write((const char *)&n_levels, sizeof(n_levels));
+                    store_pod_vector(max_row_len, out);
+                    store_pod_vector(max_col_len, out);
+                }
+                ckpt->commit("suffix_sort", {{sfx_file, build_checkpoint::WHOLE}});
+            }
+        }
 #ifdef DEBUG_PRINT
         int i = 0;
         for (const auto &sfx : grammar_sfx) {
@@ -84,8 +223,20 @@ public:
         compute_grid_points(grammar_sfx, points);
 
         grammar_sfx.clear();
-//        grid = grid_t(points,p_gram.rules_per_level.size());
-        m_grid = grid(points);
+//        grid = grid_t(points,p_gram.rules_per_level.size(), config);
+        {
+            thread_pool pool(n_threads);
+            if(level_grid){
+                m_level_grid = grid_t(points, n_levels, max_row_len, max_col_len, pool, backend);
+            }else{
+                m_grid = grid(points, pool, backend);
+            }
+        }
+        if(prefix_k>0) build_prefix_caches(prefix_k, n_threads);
+        if(ckpt!=nullptr){
+            sdsl::store_to_file(*this, grid_file);
+            ckpt->commit("grid", {{grid_file, build_checkpoint::WHOLE}});
+        }
 #ifdef DEBUG_INFO
         std::cout << "build grid\n";
         breakdown_space();
@@ -100,8 +251,25 @@ public:
         std::cout << "Grammar-size," << grammar_tree.get_grammar_size() << std::endl;
         std::cout << "Grammar-Tree," << sdsl::size_in_bytes(grammar_tree) << std::endl;
         grammar_tree.breakdown_space();
-        std::cout << "Grid," << sdsl::size_in_bytes(m_grid) << std::endl;
-        m_grid.breakdown_space();
+        std::cout << "Rules-occ," << sdsl::size_in_bytes(rules_occ) << std::endl;
+        std::cout << "Rules-kr," << sdsl::size_in_bytes(m_kr) << std::endl;
+        if(has_level_grid()){
+            std::cout << "Level-grid," << sdsl::size_in_bytes(m_level_grid) << std::endl;
+            m_level_grid.breakdown_space();
+        }else{
+            std::cout << "Grid," << sdsl::size_in_bytes(m_grid) << std::endl;
+            m_grid.breakdown_space();
+        }
+        if(m_row_cache.enabled()){
+            //every cached probe saves the navigation of the tree to the first symbol of the rule/suffix
+            std::cout << "Prefix-cache-k," << (int)m_row_cache.k() << std::endl;
+            std::cout << "Row-prefix-cache," << sdsl::size_in_bytes(m_row_cache) << std::endl;
+            std::cout << "Col-prefix-cache," << sdsl::size_in_bytes(m_col_cache) << std::endl;
+            std::cout << "Prefix-cache-bytes-per-entry," << (int)m_row_cache.k() + 1 << std::endl;
+        }else{
+            std::cout << "Prefix-cache,0" << std::endl;
+        }
+        std::cout << "Doc-boundaries," << sdsl::size_in_bytes(m_docs) << std::endl;
         std::cout << "symbols_map," << sdsl::size_in_bytes(symbols_map);
         std::cout << "m_sigma," << sizeof(m_sigma);
         std::cout << "parsing_rounds," << sizeof(parsing_rounds);
@@ -171,36 +339,6 @@ public:
         }
     };
 
-    static alpha_t get_alphabet(std::string &i_file) {
-
-        std::cout << "Reading input file" << std::endl;
-
-        //TODO this can be done in parallel if the input is too big
-        size_t alph_frq[256] = {0};
-        alpha_t alphabet;
-
-        i_file_stream<uint8_t> if_stream(i_file, BUFFER_SIZE);
-        for (size_t i = 0; i < if_stream.tot_cells; i++) {
-            alph_frq[if_stream.read(i)]++;
-        }
-
-        for (size_t i = 0; i < 256; i++) {
-            if (alph_frq[i] > 0) alphabet.emplace_back(i, alph_frq[i]);
-        }
-
-        std::cout << "  Number of characters: " << if_stream.size() << std::endl;
-        std::cout << "  Alphabet:             " << alphabet.size() << std::endl;
-        std::cout << "  Smallest symbol:      " << (int) alphabet[0].first << std::endl;
-        std::cout << "  Greatest symbol:      " << (int) alphabet.back().first << std::endl;
-
-        if (if_stream.read(if_stream.size() - 1) != alphabet[0].first) {
-            std::cout << "Error: sep. symbol " << alphabet[0].first << " differs from last symbol in file "
-                      << if_stream.read(if_stream.size() - 1) << std::endl;
-            exit(1);
-        }
-        return alphabet;
-    }
-
     //returns a boolean that indicates if the first symbol could belong to another phrase
     // 0 : the first symbol belong to a phrase in parse
     // 1 : the first symbol belong (or might) to a phrase to the left of the parse
@@ -538,62 +676,122 @@ public:
 public:
     typedef size_t size_type;
 
-    static bool just_one_zero(std::string &input_file){
-        std::string text;
-        utils::readFile(input_file,text);
-        int zero_count = 0;
-        for (const auto &item : text) {
-            if(item == 0 ) zero_count++;
-            if(zero_count > 1)
-                return false;
-        }
-        return true;
-    }
-
-    lpg_index(std::string &input_file, std::string &tmp_folder, size_t n_threads, float hbuff_frac) {
+    lpg_index(std::string &input_file, std::string &tmp_folder, size_t n_threads, float hbuff_frac, size_t scratch_budget=0,
+              collection_mode mode=SINGLE_TEXT, const std::string& doc_names_file="", bool build_kr=false,
+              size_t prefix_k=0, grid_backend backend=GRID_RRR, bool level_grid=false, size_t mem_budget=0,
+              const std::string& resume_dir="", bool shared_dict=false, bool checkpoint=false) {
 
         mem_monitor mem(input_file + "-mem.csv");
         std::cout<<"measuring peak memory\n";
         mem.event("LPG-BUILD-GRAMMAR");
         std::cout << "Input file: " << input_file << std::endl;
-        if (!just_one_zero(input_file)) {
-            std::cout << "More than one zero error" << std::endl;
-            return;
+
+        //create a temporary folder, or reuse the one of the construction to resume
+        std::string temp = resume_dir;
+        bool own_dir = resume_dir.empty();
+        if(own_dir){
+            std::string tmp_path = tmp_folder + "/lpg_index.XXXXXX";
+            char tmp_name[200] = {0};
+            tmp_path.copy(tmp_name, tmp_path.size() + 1);
+            tmp_name[tmp_path.size() + 1] = '\0';
+            auto res = mkdtemp(tmp_name);
+            if (res == nullptr) {
+                std::cout << "Error trying to create a temporal folder" << std::endl;
+                exit(1);
+            }
+            temp = tmp_name;
+        }
+        std::cout << "Temporal folder: " << temp << std::endl;
+
+        if(scratch_budget>0){
+            std::error_code ec;
+            auto space = std::filesystem::space(temp, ec);
+            if(!ec && space.available<scratch_budget){
+                std::cout << "Error: the scratch budget is " << scratch_budget << " bytes, but the volume of "
+                          << temp << " only has " << space.available << " bytes available" << std::endl;
+                if(own_dir) std::filesystem::remove_all(temp);
+                exit(1);
+            }
         }
-        auto alphabet = get_alphabet(input_file);
+        //the budget is also checked while the stages run, so a stage can not fill the volume
+        scratch_monitor scratch(temp, scratch_budget, own_dir);
 
-        /*TODO este if puede reemplazar a just_one_zero
-        if(alphabet[0].first==0 && alphabet[0].second>1){
-            exit(1);
-        }*/
+        //the id of the temporal files is fixed (sdsl uses the process id by default), so a resumed
+        // construction finds the files of the interrupted one
+        sdsl::cache_config config(false, temp, "lpg");
+        std::string g_file = sdsl::cache_file_name("g_file", config);
 
-        size_t n_chars = 0;
-        for (auto const &sym : alphabet) n_chars += sym.second;
+        //with --checkpoint, the stages of the construction are recorded in the temporal folder, so
+        // an interrupted construction can be resumed with the same input and parameters. The
+        // modification time of the input is part of the parameters, so an input that changed
+        // after the interruption is not resumed
+        build_checkpoint ckpt;
+        build_checkpoint* ckpt_ptr = nullptr;
+        if(checkpoint || !resume_dir.empty()){
+            std::error_code ec;
+            std::stringstream params;
+            params << input_file << " " << std::filesystem::file_size(input_file, ec) << " "
+                   << std::filesystem::last_write_time(input_file, ec).time_since_epoch().count() << " " << mode << " "
+                   << build_kr << " " << prefix_k << " " << backend << " " << level_grid;
+            ckpt.open(temp, params.str(), !resume_dir.empty());
+            ckpt_ptr = &ckpt;
+            if(resume_dir.empty()){
+                std::cout << "  An interrupted construction can be resumed with --resume " << temp << std::endl;
+            }
+        }
 
-        //create a temporary folder
-        std::string tmp_path = tmp_folder + "/lpg_index.XXXXXX";
-        char temp[200] = {0};
-        tmp_path.copy(temp, tmp_path.size() + 1);
-        temp[tmp_path.size() + 1] = '\0';
-        auto res = mkdtemp(temp);
-        if (res == nullptr) {
-            std::cout << "Error trying to create a temporal folder" << std::endl;
+        //the documents of a collection are concatenated in a temporal text
+        std::string text_file = input_file;
+        doc_collection docs;
+        if(mode!=SINGLE_TEXT){
+            text_file = sdsl::cache_file_name("collection", config);
+            std::string layout_file = sdsl::cache_file_name("collection_layout", config);
+            if(ckpt.completed("collection")){
+                std::cout << "Resuming with the concatenated collection of the checkpoint" << std::endl;
+                docs.load(layout_file);
+            }else{
+                std::cout << "Concatenating the documents of the collection" << std::endl;
+                docs.build(input_file, mode, text_file);
+                docs.store(layout_file);
+                ckpt.commit("collection", {{text_file,   build_checkpoint::WHOLE},
+                                           {layout_file, build_checkpoint::WHOLE}});
+            }
+            if(!doc_names_file.empty() && !docs.names.empty()){
+                docs.store_names(doc_names_file);
+                std::cout << "  Document names stored in " << doc_names_file << std::endl;
+            }
         }
-        std::cout << "Temporal folder: " << std::string(temp) << std::endl;
-        //
 
-        sdsl::cache_config config(false, temp);
-        std::string g_file = sdsl::cache_file_name("g_file", config);
+        //one pass over the text to get its alphabet and length, and to validate the sentinel
+        std::cout << "Reading input file" << std::endl;
+        text_stats stats(text_file);
+        std::string msg;
+        if (!stats.valid(msg)) {
+            std::cout << "Error: " << msg << std::endl;
+            if(own_dir) std::filesystem::remove_all(temp);
+            exit(1);
+        }
+        stats.print();
+        auto& alphabet = stats.alphabet;
+        size_t n_chars = stats.n_chars;
 
         //maximum amount of RAM allowed to spend in parallel for the hashing step
         auto hbuff_size = std::max<size_t>(64 * n_threads, size_t(std::ceil(float(n_chars) * hbuff_frac)));
 
         std::cout << "Computing the grammar for the self-index" << std::endl;
         auto start = std::chrono::high_resolution_clock::now();
-        lpg_build::compute_LPG(input_file, g_file, n_threads, config, hbuff_size, alphabet);
+        if(ckpt.completed("colex_sort")){
+            std::cout << "  Resuming after the stage \"colex_sort\"" << std::endl;
+        }else{
+            lpg_build::compute_LPG(text_file, g_file, n_threads, config, hbuff_size, alphabet, mem_budget, ckpt_ptr,
+                                   shared_dict);
+            //the stages of the index depend on the grammar that was just built
+            for(auto const& stage : {"grammar_tree", "suffix_sort", "grid"}) ckpt.drop(stage);
+        }
         auto end = std::chrono::high_resolution_clock::now();
         auto elapsed_grammar = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
         std::cout << "  Elap. time (microsec): " << elapsed_grammar.count() << std::endl;
+        scratch.check("the grammar construction");
 
         //plain representation of the grammar
         plain_grammar_t plain_gram;
@@ -606,10 +804,14 @@ public:
         mem.event("LPG-BUILD-INDEX");
         std::cout << "Building the self-index" << std::endl;
         start = std::chrono::high_resolution_clock::now();
-        build_index(input_file, plain_gram, n_chars, config);
+        build_index(text_file, plain_gram, n_chars, config, n_threads, build_kr, prefix_k, backend, level_grid, ckpt_ptr);
+        if(mode!=SINGLE_TEXT) build_doc_starts(docs);
         end = std::chrono::high_resolution_clock::now();
         auto elapsed_index = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
         std::cout << "  Elap. time (microsec): " << elapsed_index.count() << std::endl;
+        scratch.check("the index construction");
+        scratch.stop();
+        std::filesystem::remove_all(temp);
         double text_size = grammar_tree.get_text_len();
         double index_size = sdsl::size_in_bytes(*this);
         std::cout << "  Index size(bytes) " << sdsl::size_in_bytes(*this) << std::endl;
@@ -628,20 +830,40 @@ public:
 
     lpg_index(const lpg_index &other) {
         grammar_tree = other.grammar_tree;
+        rules_occ = other.rules_occ;
+        m_kr = other.m_kr;
         m_grid = other.m_grid;
+        m_level_grid = other.m_level_grid;
+        m_row_cache = other.m_row_cache;
+        m_col_cache = other.m_col_cache;
         symbols_map = other.symbols_map;
         m_sigma = other.m_sigma;
         parsing_rounds = other.parsing_rounds;
         rl_compressed = other.rl_compressed;
+        m_docs = other.m_docs;
+        rank_docs = sdsl::sd_vector<>::rank_1_type(&m_docs);
+        select_docs = sdsl::sd_vector<>::select_1_type(&m_docs);
+        m_doc_sep = other.m_doc_sep;
     }
 
     void swap(lpg_index &&other) {
         std::swap(grammar_tree, other.grammar_tree);
+        std::swap(rules_occ, other.rules_occ);
+        std::swap(m_kr, other.m_kr);
         std::swap(m_grid, other.m_grid);
+        std::swap(m_level_grid, other.m_level_grid);
+        m_row_cache.swap(other.m_row_cache);
+        m_col_cache.swap(other.m_col_cache);
         std::swap(symbols_map, other.symbols_map);
         std::swap(m_sigma, other.m_sigma);
         std::swap(parsing_rounds, other.parsing_rounds);
         std::swap(rl_compressed, other.rl_compressed);
+        m_docs.swap(other.m_docs);
+        rank_docs = sdsl::sd_vector<>::rank_1_type(&m_docs);
+        select_docs = sdsl::sd_vector<>::select_1_type(&m_docs);
+        other.rank_docs = sdsl::sd_vector<>::rank_1_type(&other.m_docs);
+        other.select_docs = sdsl::sd_vector<>::select_1_type(&other.m_docs);
+        std::swap(m_doc_sep, other.m_doc_sep);
     }
 
     lpg_index(lpg_index &&other) noexcept {
@@ -655,14 +877,139 @@ public:
 
     lpg_index &operator=(lpg_index const &other) noexcept = default;
 
-    //statistics about the text: number of symbols, number of documents, etc
-    void text_stats(std::string &list) {}
+    [[nodiscard]] inline bool is_collection() const {
+        return m_docs.size()>0;
+    }
 
-    void locate(const std::string &pattern, std::set<lpg_index::size_type> &pos) const;
-    void locate_all_cuts(const std::string &pattern, std::set<lpg_index::size_type> &pos) const;
-    void locate_split_time(const std::string &pattern, std::set<lpg_index::size_type> &pos, size_t&, size_t&) const;
-    //extract text[start, end] from the index
-    void extract(size_t start, size_t end) {}
+    //number of documents (1 for a single text)
+    [[nodiscard]] inline size_t n_docs() const {
+        return is_collection() ? rank_docs(m_docs.size()) : 1;
+    }
+
+    //map a text position to its document and the offset inside the document
+    [[nodiscard]] inline std::pair<size_t, size_t> doc_offset(size_t pos) const {
+        if(!is_collection()) return {0, pos};
+        size_t doc = rank_docs(pos+1)-1;
+        return {doc, pos-select_docs(doc+1)};
+    }
+
+    //report the occurrences of the pattern as (document, offset) pairs sorted by position.
+    // Every document is followed by the separator (or the final '\0'), and none of the
+    // documents contains those symbols, so an occurrence spans two documents iff the pattern
+    // contains one of them. Those patterns have no valid occurrences
+    void locate_docs(const std::string &pattern, std::vector<std::pair<size_t, size_t>>& occ) const {
+        occ.clear();
+        if(is_collection() && pattern.find_first_of(std::string{(char)m_doc_sep, '\0'})!=std::string::npos) return;
+        occ_vector_sink sink;
+        locate(pattern, sink);
+        sink.finish();
+        occ.reserve(sink.size());
+        for(auto const& pos : sink.pos) occ.push_back(doc_offset(pos));
+    }
+
+    //number of occurrences that do not span two documents
+    [[nodiscard]] size_type count_docs(const std::string &pattern) const {
+        if(is_collection() && pattern.find_first_of(std::string{(char)m_doc_sep, '\0'})!=std::string::npos) return 0;
+        return count(pattern);
+    }
+
+    //report the occurrences of the pattern to a sink (see occ_sinks.hpp)
+    template<class sink_t>
+    void locate(const std::string &pattern, sink_t &sink) const;
+    template<class sink_t>
+    void locate_all_cuts(const std::string &pattern, sink_t &sink) const;
+    template<class sink_t>
+    void locate_split_time(const std::string &pattern, sink_t &sink, size_t&, size_t&) const;
+
+    void locate(const std::string &pattern, std::set<lpg_index::size_type> &pos) const {
+        occ_set_sink sink(pos);
+        locate(pattern, sink);
+    }
+    void locate_all_cuts(const std::string &pattern, std::set<lpg_index::size_type> &pos) const {
+        occ_set_sink sink(pos);
+        locate_all_cuts(pattern, sink);
+    }
+    void locate_split_time(const std::string &pattern, std::set<lpg_index::size_type> &pos, size_t& p_time, size_t& s_time) const {
+        occ_set_sink sink(pos);
+        locate_split_time(pattern, sink, p_time, s_time);
+    }
+    //number of occurrences of the pattern. The positions are not computed
+    [[nodiscard]] size_type count(const std::string &pattern) const;
+    //extract text[start, end] from the index. The function f receives the symbols
+    // of the range from left to right
+    template<typename F>
+    void extract(size_t start, size_t end, const F& f) const {
+        size_t text_len = grammar_tree.get_text_len();
+        if(start > end || start >= text_len) return;
+        if(end >= text_len) end = text_len - 1;
+
+        const auto &T = grammar_tree.getT();
+        size_type remain = end - start + 1;
+        auto emit = [&](const uint64_t &prenode, const uint64_t &node, const uint64_t &X) {
+            f(get_symbol(X));
+            return --remain > 0;
+        };
+
+        //go directly to the leaf covering the start position and
+        // expand the leaves from there on
+        size_type n_leaves = grammar_tree.num_leaves();
+        size_type leaf = grammar_tree.leaf_from_pos(start);
+        size_type skip = start - grammar_tree.selectL(leaf);
+
+        while(remain > 0 && leaf <= n_leaves){
+            size_type node = T.leafselect(leaf);
+            size_type preorder = T.pre_order(node);
+            size_type X = grammar_tree.get_rule_from_preorder_node(preorder);
+            size_type l_end = leaf < n_leaves ? grammar_tree.selectL(leaf + 1) : text_len;
+            size_type l_len = l_end - grammar_tree.selectL(leaf);
+
+            if(is_terminal(X)){
+                //the second child of a run-length node of a terminal covers l_len copies of it
+                for(size_type i = skip; i < l_len; ++i){
+                    if(!emit(preorder, node, X)) break;
+                }
+            }else{
+                auto fpre_node = grammar_tree.first_occ_from_rule(X);
+                auto fnode = T[fpre_node];
+                //the leaf is the second child of a run-length node
+                // when it spans more than one copy of X
+                size_type x_len = grammar_tree.node_len(fnode);
+                size_type reps = l_len / x_len;
+                size_type copy = skip / x_len;
+                if(!dfs_leaf_from(fpre_node, fnode, skip % x_len, emit)) break;
+                for(++copy; copy < reps; ++copy){
+                    if(!dfs_leaf(fpre_node, fnode, emit)) break;
+                }
+            }
+            skip = 0;
+            leaf++;
+        }
+    }
+
+    void extract(size_t start, size_t end, std::string& out) const {
+        out.clear();
+        extract(start, end, [&out](const uint8_t& sym){ out.push_back(char(sym)); });
+    }
+
+    //extract a list of ranges and stream them to out, one range per line
+    void extract(const std::vector<std::pair<size_t, size_t>>& ranges, std::ostream& out) const {
+        std::vector<char> buffer;
+        buffer.reserve(BUFFER_SIZE);
+        auto flush = [&](){
+            out.write(buffer.data(), std::streamsize(buffer.size()));
+            buffer.clear();
+        };
+        for(auto const& range : ranges){
+            extract(range.first, range.second, [&](const uint8_t& sym){
+                buffer.push_back(char(sym));
+                if(buffer.size()==BUFFER_SIZE) flush();
+            });
+            buffer.push_back('\n');
+            if(buffer.size()==BUFFER_SIZE) flush();
+        }
+        flush();
+        out.flush();
+    }
 
     static void bt_search(const std::string &str,const std::string &sub, std::set<size_t> &positions){
         size_t pos = str.find(sub, 0);
@@ -674,7 +1021,8 @@ public:
     }
 
     //search for a list of patterns
-    void search(std::vector<std::string> &list, bool print_ind_patterns=true
+    void search(std::vector<std::string> &list, bool print_ind_patterns=true, size_t n_threads=1, bool count_only=false,
+                bool print_occ=false
 #ifdef CHECK_OCC
             ,const std::string& file
 #endif
@@ -682,26 +1030,87 @@ public:
 #ifdef CHECK_OCC
         std::string data;
         utils::readFile(file,data);
-        int ii = 0;
+        size_t total_occ_bt = 0;
 #endif
         std::cout << "Locating "<<list.size()<<" patterns "<< std::endl;
+
+        //the patterns are located in parallel, but the report is printed afterwards in the
+        // input order, so the output does not depend on the number of threads
+        std::vector<std::pair<size_t, size_t>> results(list.size());
+        //(document, offset) pairs of every pattern, only kept when they are printed
+        std::vector<std::vector<std::pair<size_t, size_t>>> pat_doc_occ(print_occ ? list.size() : 0);
+#ifdef CHECK_OCC
+        std::vector<std::set<size_type>> pat_occ(list.size());
+#endif
+        auto locate_pattern = [&](size_t idx, size_t){
+            auto start = std::chrono::high_resolution_clock::now();
+            if(count_only){
+                size_type n_occ = count_docs(list[idx]);
+                auto end = std::chrono::high_resolution_clock::now();
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                results[idx] = {n_occ, elapsed};
+                return;
+            }
+            if(is_collection() || print_occ){
+                std::vector<std::pair<size_t, size_t>> doc_occ;
+                locate_docs(list[idx], doc_occ);
+                auto end = std::chrono::high_resolution_clock::now();
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                results[idx] = {doc_occ.size(), elapsed};
+#ifdef CHECK_OCC
+                for(auto const& occ : doc_occ){
+                    pat_occ[idx].insert(is_collection() ? select_docs(occ.first+1)+occ.second : occ.second);
+                }
+#endif
+                if(print_occ) pat_doc_occ[idx] = std::move(doc_occ);
+                return;
+            }
+            occ_vector_sink occ;
+            locate(list[idx], occ);
+            occ.finish();
+            auto end = std::chrono::high_resolution_clock::now();
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            results[idx] = {occ.size(), elapsed};
+#ifdef CHECK_OCC
+            pat_occ[idx].insert(occ.pos.begin(), occ.pos.end());
+#endif
+        };
+
+        if(n_threads>1 && list.size()>1){
+            thread_pool pool(std::min(n_threads, list.size()));
+            pool.parallel_for(list.size(), locate_pattern);
+        }else{
+            for(size_t i=0;i<list.size();i++) locate_pattern(i, 0);
+        }
+
         size_t total_occ = 0,total_time = 0;
         size_t ii=0;
         for (auto const &pattern : list) {
 #ifdef DEBUG_PRINT
             std::cout << pattern << ":";
 #endif
-            auto start = std::chrono::high_resolution_clock::now();
-            std::set<size_type> occ;
-            locate(pattern, occ);
-            auto end = std::chrono::high_resolution_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            auto const& res = results[ii];
             if(print_ind_patterns){
-                std::cout<<"  Pattern "<<(++ii)<<": "<<pattern<<std::endl;
-                std::cout<<"    "<<occ.size()<<" occurrences in "<<elapsed<<" microseconds "<<std::endl;
+                std::cout<<"  Pattern "<<(ii+1)<<": "<<pattern<<std::endl;
+                std::cout<<"    "<<res.first<<" occurrences in "<<res.second<<" microseconds "<<std::endl;
             }
-            total_occ += occ.size();
-            total_time+=elapsed;
+            if(print_occ && !count_only){
+                std::cout<<"    Occ:";
+                for(auto const& occ : pat_doc_occ[ii]){
+                    if(is_collection()){
+                        std::cout<<" "<<occ.first<<":"<<occ.second;
+                    }else{
+                        std::cout<<" "<<occ.second;
+                    }
+                }
+                std::cout<<std::endl;
+            }
+            total_occ += res.first;
+            total_time += res.second;
+#ifdef CHECK_OCC
+            auto const& occ = pat_occ[ii];
+#endif
+            ii++;
 
             /*std::set<size_type> occ2;
             locate_all_cuts(pattern, occ2);
@@ -711,7 +1120,6 @@ public:
             }*/
 #ifdef CHECK_OCC
             //
-            size_t total_occ_bt = 0;
             std::set<size_type> positions;
             bt_search(data,pattern,positions);
             total_occ_bt += positions.size();
@@ -835,8 +1243,9 @@ public:
 #endif
 //            std::cout<<++ii<<"--"<<pattern<<std::endl;
             auto start = std::chrono::high_resolution_clock::now();
-            std::set<size_type> occ;
+            occ_vector_sink occ;
             locate_split_time(pattern, occ,total_time_p,total_time_s);
+            occ.finish();
             auto end = std::chrono::high_resolution_clock::now();
             auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
             total_occ += occ.size();
@@ -899,7 +1308,12 @@ public:
 
     void load(std::istream &in) {
         grammar_tree.load(in);
+        rules_occ.load(in);
+        m_kr.load(in);
         m_grid.load(in);
+        m_level_grid.load(in);
+        m_row_cache.load(in);
+        m_col_cache.load(in);
         symbols_map.load(in);
         sdsl::read_member(m_sigma, in);
         sdsl::read_member(parsing_rounds, in);
@@ -909,19 +1323,30 @@ public:
 
 
         rank_Y = bv_y::rank_1_type(&Y);
+        m_docs.load(in);
+        rank_docs = sdsl::sd_vector<>::rank_1_type(&m_docs);
+        select_docs = sdsl::sd_vector<>::select_1_type(&m_docs);
+        sdsl::read_member(m_doc_sep, in);
     }
 
     size_type serialize(std::ostream &out, sdsl::structure_tree_node *v, std::string name) const {
         sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
         size_t written_bytes = 0;
         written_bytes += grammar_tree.serialize(out, child, "grammar_tree");
+        written_bytes += rules_occ.serialize(out, child, "rules_occ");
+        written_bytes += m_kr.serialize(out, child, "m_kr");
         written_bytes += m_grid.serialize(out, child, "m_grid");
+        written_bytes += m_level_grid.serialize(out, child, "m_level_grid");
+        written_bytes += m_row_cache.serialize(out, child, "m_row_cache");
+        written_bytes += m_col_cache.serialize(out, child, "m_col_cache");
         written_bytes += symbols_map.serialize(out, child, "symbols_map");
         written_bytes += sdsl::write_member(m_sigma, out, child, "sigma");
         written_bytes += sdsl::write_member(parsing_rounds, out, child, "sigma");
         written_bytes += sdsl::write_member(rl_compressed, out, child, "sigma");
         written_bytes += Y.serialize(out, child, "Y");
         written_bytes += rank_Y.serialize(out, child, "rank_Y");
+        written_bytes += m_docs.serialize(out, child, "m_docs");
+        written_bytes += sdsl::write_member(m_doc_sep, out, child, "doc_sep");
         return written_bytes;
     }
 
@@ -1014,6 +1439,54 @@ public:
         }
     }
 
+    //like dfs_leaf, but the expansion of the node starts skip symbols to the right. The
+    // function descends directly to the child covering that position
+    template<typename F>
+    bool dfs_leaf_from(const uint64_t &preorder_node, const uint64_t &node, size_type skip, const F &f) const {
+        if(skip == 0) return dfs_leaf(preorder_node, node, f);
+
+        const auto &T = grammar_tree.getT();
+        if (grammar_tree.isLeaf(preorder_node)) {
+            //a terminal has length one, so this is a second mention
+            size_type _x = grammar_tree.get_rule_from_preorder_node(preorder_node);
+            auto fpre_node = grammar_tree.first_occ_from_rule(_x);
+            return dfs_leaf_from(fpre_node, T[fpre_node], skip, f);
+        }
+
+        size_type off = grammar_tree.offset_node(node);
+        auto len = grammar_tree.is_run(preorder_node);
+        if (len) {
+            auto chnode = T.child(node, 1);
+            auto chpre = T.pre_order(chnode);
+            size_type ch_len = grammar_tree.offset_node(T.child(node, 2)) - off;
+            size_type i = skip / ch_len;
+            if(!dfs_leaf_from(chpre, chnode, skip % ch_len, f)) return false;
+            for (++i; i < len; ++i) {
+                if (!dfs_leaf(chpre, chnode, f)) return false;
+            }
+            return true;
+        }
+
+        //binary search for the rightmost child starting at or before skip
+        uint32_t n = T.children(node), lo = 1, hi = n;
+        while(lo < hi){
+            uint32_t mid = (lo + hi + 1) / 2;
+            if(grammar_tree.offset_node(T.child(node, mid)) - off <= skip){
+                lo = mid;
+            }else{
+                hi = mid - 1;
+            }
+        }
+        auto chnode = T.child(node, lo);
+        size_type ch_skip = skip - (grammar_tree.offset_node(chnode) - off);
+        if(!dfs_leaf_from(T.pre_order(chnode), chnode, ch_skip, f)) return false;
+        for (uint32_t i = lo + 1; i <= n; ++i) {
+            chnode = T.child(node, i);
+            if (!dfs_leaf(T.pre_order(chnode), chnode, f)) return false;
+        }
+        return true;
+    }
+
     template<typename F>
     void process_prefix_rule(const size_type &preorder_node, const F & f) const{
         const auto &m_tree = grammar_tree.getT();
@@ -1098,8 +1571,9 @@ public:
         auto pre_parent = T.pre_order(parent);//  compute parent
         size_type len = grammar_tree.is_run(pre_parent);
         if(len){
+            //the suffix starts at the second child, which covers len-1 copies of the first one
+            auto cnode = T.child(parent, 1);
             for (size_type j = 1; j < len; ++j){
-                auto cnode = T.child(parent, j);
                 if(!dfs_leaf(pre_parent + 1, cnode, f)) return 0;
             }
         }else{
@@ -1148,8 +1622,9 @@ public:
 
         size_type len = grammar_tree.is_run(pre_parent);
         if(len){
+            //the suffix starts at the second child, which covers len-1 copies of the first one
+            auto cnode = T.child(parent, 1);
             for (size_type j = 1; j < len; ++j){
-                auto cnode = T.child(parent, j);
                 dfs_leaf(pre_parent + 1, cnode, cmp);
                 // if they have a at least a symbol diferent return r
                 if (r != 0) return r;
@@ -1182,6 +1657,231 @@ public:
         }
     }
 
+    /**
+     * Comparisons with Karp-Rabin fingerprints. A node whose fingerprint matches the next
+     * substring of the pattern is skipped entirely, so the grammar is only expanded along
+     * the path to the first mismatch. The kr_cmp functions return KR_NEXT if the whole
+     * expansion of the node matches (ii moves past it), 0 if the pattern ends inside the
+     * expansion, and -1/1 if the expansion is smaller/greater at the first mismatch
+     * */
+    static constexpr int KR_NEXT = 2;
+
+    [[nodiscard]] inline bool has_kr() const {
+        return !m_kr.empty();
+    }
+
+    //fingerprint of text[0..i-1] in base b, where fp has the fingerprints of the rules in that
+    // base. The grammar tree is traversed from the root to the leaf of position i, adding the
+    // fingerprints of the subtrees on the left of the path
+    [[nodiscard]] uint64_t text_prefix_kr(size_type i, const sdsl::int_vector<>& fp, uint64_t b) const {
+        const auto &T = grammar_tree.getT();
+        uint64_t h = 0;
+        size_type node = T.root();
+        size_type preorder = T.pre_order(node);
+        while(i > 0){
+            if(T.isleaf(node)){//second mention: continue from the first mention of the rule
+                preorder = grammar_tree.first_occ_from_rule(grammar_tree.get_rule_from_preorder_node(preorder));
+                node = T[preorder];
+                continue;
+            }
+            if(auto copies = grammar_tree.is_run(preorder)){
+                node = T.child(node, 1);
+                preorder = T.pre_order(node);
+                size_type ch_len = grammar_tree.node_len(node);
+                size_type k = std::min<size_type>(copies, i / ch_len);
+                uint64_t ch_pow = kr::pow(ch_len, b);
+                h = kr::concat(h, kr::repeat(fp[grammar_tree.get_rule_from_preorder_node(preorder)], ch_pow, k), kr::pow(k * ch_len, b));
+                i -= k * ch_len;
+                continue;
+            }
+            uint32_t n = T.children(node);
+            for(uint32_t j = 1; j <= n; ++j){
+                size_type ch = T.child(node, j);
+                size_type ch_pre = T.pre_order(ch);
+                size_type ch_len = grammar_tree.node_len(ch);
+                if(ch_len > i){
+                    node = ch;
+                    preorder = ch_pre;
+                    break;
+                }
+                h = kr::concat(h, fp[grammar_tree.get_rule_from_preorder_node(ch_pre)], kr::pow(ch_len, b));
+                i -= ch_len;
+            }
+        }
+        return h;
+    }
+
+    [[nodiscard]] inline bool has_level_grid() const {
+        return m_level_grid.get_levels() > 0;
+    }
+
+    //left to right: the pattern continues at str[ii]
+    int kr_cmp_forward(const uint64_t &preorder_node, const uint64_t &node, const kr_pattern &kp, size_type &ii) const {
+        const auto &T = grammar_tree.getT();
+        size_type X = grammar_tree.get_rule_from_preorder_node(preorder_node);
+        bool leaf = T.isleaf(node);
+        if (leaf && is_terminal(X)) {
+            auto c1 = get_symbol(X);
+            auto c2 = (uint8_t) (*kp.str)[ii];
+            if (c1 > c2) return 1;
+            if (c1 < c2) return -1;
+            return ++ii == kp.size() ? 0 : KR_NEXT;
+        }
+        size_type len = grammar_tree.node_len(node);
+        if (len <= kp.size() - ii && m_kr[X] == kp.substr(ii, len)) {
+            ii += len;
+            return ii == kp.size() ? 0 : KR_NEXT;
+        }
+        if (leaf) {//second mention: descend from the first mention of the rule
+            auto fpre_node = grammar_tree.first_occ_from_rule(X);
+            return kr_descend_forward(fpre_node, T[fpre_node], kp, ii);
+        }
+        return kr_descend_forward(preorder_node, node, kp, ii);
+    }
+
+    int kr_descend_forward(const uint64_t &preorder_node, const uint64_t &node, const kr_pattern &kp, size_type &ii) const {
+        const auto &T = grammar_tree.getT();
+        auto len = grammar_tree.is_run(preorder_node);
+        if (len) {
+            auto chnode = T.child(node, 1);
+            return kr_run_forward(T.pre_order(chnode), chnode, len, kp, ii);
+        }
+        uint32_t n = T.children(node);
+        for (uint32_t i = 1; i <= n; ++i) {
+            auto chnode = T.child(node, i);
+            int r = kr_cmp_forward(T.pre_order(chnode), chnode, kp, ii);
+            if (r != KR_NEXT) return r;
+        }
+        return KR_NEXT;//only reachable with a fingerprint collision
+    }
+
+    //compare the pattern against copies consecutive copies of a node. The number of leading copies that match the pattern
+    // is found by exponential search, and the rest is compared from the first mismatching copy
+    int kr_run_forward(const uint64_t &ch_preorder, const uint64_t &chnode, size_type copies, const kr_pattern &kp, size_type &ii) const {
+        size_type X = grammar_tree.get_rule_from_preorder_node(ch_preorder);
+        size_type ch_len = grammar_tree.node_len(chnode);
+        uint64_t ch_kr = is_terminal(X) ? get_symbol(X) : m_kr[X];
+        size_type max_k = std::min(copies, (kp.size() - ii) / ch_len);
+        auto match = [&](size_type k) {
+            return kr::repeat(ch_kr, kp.pows[ch_len], k) == kp.substr(ii, k * ch_len);
+        };
+        size_type lo = 0, hi = 1;
+        while (hi <= max_k && match(hi)) {
+            lo = hi;
+            hi *= 2;
+        }
+        hi = std::min(hi, max_k + 1);
+        while (hi - lo > 1) {
+            size_type mid = lo + (hi - lo) / 2;
+            if (match(mid)) lo = mid; else hi = mid;
+        }
+        ii += lo * ch_len;
+        if (ii == kp.size()) return 0;
+        for (size_type k = lo; k < copies; k++) {
+            int r = kr_cmp_forward(ch_preorder, chnode, kp, ii);
+            if (r != KR_NEXT) return r;
+        }
+        return KR_NEXT;
+    }
+
+    //right to left: the pattern continues at str[ii] towards str[0]
+    int kr_cmp_backward(const uint64_t &preorder_node, const uint64_t &node, const kr_pattern &kp, long &ii) const {
+        const auto &T = grammar_tree.getT();
+        size_type X = grammar_tree.get_rule_from_preorder_node(preorder_node);
+        bool leaf = T.isleaf(node);
+        if (leaf && is_terminal(X)) {
+            auto c1 = get_symbol(X);
+            auto c2 = (uint8_t) (*kp.str)[ii];
+            if (c1 > c2) return 1;
+            if (c1 < c2) return -1;
+            return --ii < 0 ? 0 : KR_NEXT;
+        }
+        size_type len = grammar_tree.node_len(node);
+        if (len <= size_type(ii + 1) && m_kr[X] == kp.substr(ii + 1 - len, len)) {
+            ii -= long(len);
+            return ii < 0 ? 0 : KR_NEXT;
+        }
+        if (leaf) {
+            auto fpre_node = grammar_tree.first_occ_from_rule(X);
+            return kr_descend_backward(fpre_node, T[fpre_node], kp, ii);
+        }
+        return kr_descend_backward(preorder_node, node, kp, ii);
+    }
+
+    int kr_descend_backward(const uint64_t &preorder_node, const uint64_t &node, const kr_pattern &kp, long &ii) const {
+        const auto &T = grammar_tree.getT();
+        auto len = grammar_tree.is_run(preorder_node);
+        if (len) {
+            auto chnode = T.child(node, 1);
+            return kr_run_backward(T.pre_order(chnode), chnode, len, kp, ii);
+        }
+        uint32_t n = T.children(node);
+        for (uint32_t i = n; i > 0; --i) {
+            auto chnode = T.child(node, i);
+            int r = kr_cmp_backward(T.pre_order(chnode), chnode, kp, ii);
+            if (r != KR_NEXT) return r;
+        }
+        return KR_NEXT;
+    }
+
+    int kr_run_backward(const uint64_t &ch_preorder, const uint64_t &chnode, size_type copies, const kr_pattern &kp, long &ii) const {
+        size_type X = grammar_tree.get_rule_from_preorder_node(ch_preorder);
+        size_type ch_len = grammar_tree.node_len(chnode);
+        uint64_t ch_kr = is_terminal(X) ? get_symbol(X) : m_kr[X];
+        size_type max_k = std::min(copies, size_type(ii + 1) / ch_len);
+        auto match = [&](size_type k) {
+            return kr::repeat(ch_kr, kp.pows[ch_len], k) == kp.substr(ii + 1 - k * ch_len, k * ch_len);
+        };
+        size_type lo = 0, hi = 1;
+        while (hi <= max_k && match(hi)) {
+            lo = hi;
+            hi *= 2;
+        }
+        hi = std::min(hi, max_k + 1);
+        while (hi - lo > 1) {
+            size_type mid = lo + (hi - lo) / 2;
+            if (match(mid)) lo = mid; else hi = mid;
+        }
+        ii -= long(lo * ch_len);
+        if (ii < 0) return 0;
+        for (size_type k = lo; k < copies; k++) {
+            int r = kr_cmp_backward(ch_preorder, chnode, kp, ii);
+            if (r != KR_NEXT) return r;
+        }
+        return KR_NEXT;
+    }
+
+    //same as cmp_prefix_rule, but with fingerprints
+    [[nodiscard]] int cmp_prefix_rule(const size_type &preorder_node, const kr_pattern &kp, const uint32_t &i) const {
+        long ii = i;
+        const auto &T = grammar_tree.getT();
+        int r = kr_cmp_backward(preorder_node, T[preorder_node], kp, ii);
+        return r == KR_NEXT ? -1 : r;
+    }
+
+    //same as cmp_suffix_grammar, but with fingerprints
+    [[nodiscard]] int cmp_suffix_grammar(const size_type &preorder_node, const kr_pattern &kp, const uint32_t &i) const {
+        size_type ii = i;
+        const auto &T = grammar_tree.getT();
+        auto node = T[preorder_node];
+        auto fopen = T.bps.find_open(node - 1);
+        auto parent = T.pred0(fopen) + 1;
+        auto pre_parent = T.pre_order(parent);
+        int r = KR_NEXT;
+        size_type len = grammar_tree.is_run(pre_parent);
+        if(len){
+            r = kr_run_forward(pre_parent + 1, T.child(parent, 1), len - 1, kp, ii);
+        }else{
+            uint32_t ch = T.children(parent);
+            uint32_t chr = T.succ0(fopen) - fopen;
+            for (uint32_t j = chr; j <= ch && r == KR_NEXT; ++j) {
+                auto cnode = T.child(parent, j);
+                r = kr_cmp_forward(T.pre_order(cnode), cnode, kp, ii);
+            }
+        }
+        return r == KR_NEXT ? -1 : r;
+    }
+
     [[nodiscard]] inline bool is_terminal(const size_type &X) const {
         return Y[X];
     }
@@ -1191,42 +1891,66 @@ public:
     }
 
     /**
-     * Find the m_grid range to search
+     * Find the m_grid range to search. Level 0 is the global grid, and a level l>0 is the
+     * level l of m_level_grid (rows and columns local to the level)
      * @return grid_query
      * */
 
     bool search_grid_range(const char *pattern, const uint32_t &len, const uint32_t &p, const uint32_t &level,
-                           grid_query &q) const {
+                           grid_query &q, const kr_pattern* kp=nullptr) const {
+        //first bytes of the reversed prefix and of the suffix of the cut, for the prefix caches
+        uint8_t rev_prefix[prefix_cache::MAX_K]={0}, suffix[prefix_cache::MAX_K]={0};
+        if(m_row_cache.enabled()){
+            for(uint32_t j = 0; j < std::min<uint32_t>(p, m_row_cache.k()); j++) rev_prefix[j] = pattern[p - 1 - j];
+            for(uint32_t j = 0; j < std::min<uint32_t>(len - p, m_col_cache.k()); j++) suffix[j] = pattern[p + j];
+        }
+
         // search rules range....
-        auto cmp_rev_prefix_rule = [&p, &pattern, this](const size_type &rule_id) {
+        auto cmp_rev_prefix_rule = [&p, &pattern, &kp, &rev_prefix, &level, this](const size_type &row) {
+            size_type rule_id = level == 0 ? row : m_level_grid.row_id(level, row);
+            if(m_row_cache.enabled()){
+                int r = m_row_cache.cmp(rule_id, rev_prefix, p);
+                if(r != prefix_cache::TIE) return r;
+            }
             // compute node definition preorder of the rule
             uint64_t prenode = grammar_tree.first_occ_from_rule(rule_id);
+            if(kp != nullptr) return cmp_prefix_rule(prenode, *kp, p - 1);
             return cmp_prefix_rule(prenode, pattern, p - 1);
         };
-        uint64_t row_1 = 0, row_2 = grammar_tree.get_size_rules() - 2;
+        uint64_t first_row = level == 0 ? 0 : 1;
+        uint64_t last_row = level == 0 ? grammar_tree.get_size_rules() - 2 : m_level_grid.size_rows(level);
+        uint64_t row_1 = first_row, row_2 = last_row;
         //search lower
         if (!utils::lower_bound(row_1, row_2, cmp_rev_prefix_rule)) return false;
         q.row1 = row_1;
         //search upper
-        row_2 = grammar_tree.get_size_rules() - 2;
+        row_2 = last_row;
         if (!utils::upper_bound(row_1, row_2, cmp_rev_prefix_rule)) return false;
         q.row2 = row_2;
 //
         //search suffixes
-
-        auto cmp_suffix_grammar_rule = [&p, &pattern, this](const size_type &suffix_id) {
+        auto cmp_suffix_grammar_rule = [&p, &len, &pattern, &kp, &suffix, &level, this](const size_type &suffix_id) {
+            if(m_col_cache.enabled()){
+                size_type col = level == 0 ? suffix_id : m_level_grid.col_id(level, suffix_id);
+                int r = m_col_cache.cmp(col - 1, suffix, len - p);
+                if(r != prefix_cache::TIE) return r;
+            }
             //val is just to use the std lower bound method
             // compute node definiton preorder of the rule
-            uint64_t prenode = m_grid.first_label_col(suffix_id);
+            uint64_t prenode = level > 0 ? m_level_grid.get_level(level).first_label_col(suffix_id) :
+                               has_level_grid() ? m_level_grid.first_label_col(suffix_id) : m_grid.first_label_col(suffix_id);
+            if(kp != nullptr) return cmp_suffix_grammar(prenode, *kp, p);
             return cmp_suffix_grammar(prenode, pattern, p);
         };
 
-        uint64_t col_1 = 1, col_2 = m_grid.size_cols();
+        const uint64_t last_col = level > 0 ? m_level_grid.size_cols(level) :
+                                  has_level_grid() ? m_level_grid.size_cols() : m_grid.size_cols();
+        uint64_t col_1 = 1, col_2 = last_col;
         //search lower
         if (!utils::lower_bound(col_1, col_2, cmp_suffix_grammar_rule)) return false;
         q.col1 = col_1;
         //search upper
-        col_2 = m_grid.size_cols();
+        col_2 = last_col;
         if (!utils::upper_bound(col_1, col_2, cmp_suffix_grammar_rule)) return false;
         q.col2 = col_2;
         //search suffixes
@@ -1234,18 +1958,38 @@ public:
         return true;
     }
 
+    //primary occurrences of the pattern whose split is at position cut. With a level grid, the
+    // binary searches run once over the global rows and columns (the points of a cut can be in
+    // several levels), and the range is mapped to the local grid of every level whose rows and
+    // columns can contain the prefix and the suffix of the cut
+    void search_cut(const std::string &pattern, const uint32_t &cut, const kr_pattern* kp,
+                    std::vector<utils::primaryOcc> &occ) const {
+        grid_query range{};
+        if(!search_grid_range(pattern.c_str(), pattern.size(), cut, 0, range, kp)) return;
+        if(!has_level_grid()){
+            grid_search(range, cut, pattern.size(), 0, occ);
+            return;
+        }
+        grid_query local{};
+        for(uint32_t level = 1; level <= m_level_grid.get_levels(); level++){
+            if(m_level_grid.size_cols(level) == 0 || !m_level_grid.fits(level, cut, pattern.size() - cut)) continue;
+            if(m_level_grid.local_range(level, range, local)){
+                grid_search(local, cut, pattern.size(), level, occ);
+            }
+        }
+    }
 
     void grid_search(const grid_query &range, const uint64_t &pattern_off, const uint32_t &m, const uint32_t &level,
                      std::vector<utils::primaryOcc> &occ) const {
         std::vector<lpg_index::size_type> sfx;
-//        m_grid.search(range,level,sfx);
-        m_grid.search_2d(range, sfx);
-        occ.reserve(sfx.size());
+        const grid& g = level == 0 ? m_grid : m_level_grid.get_level(level);
+        g.search_2d(range, sfx);
+        occ.reserve(occ.size() + sfx.size());
         const auto &T = grammar_tree.getT();
 
 
         for (size_type i = 0; i < sfx.size(); ++i) {
-            size_type preorder_node = m_grid.first_label_col(sfx[i]);
+            size_type preorder_node = g.first_label_col(sfx[i]);
 //            std::cout<<"preorder_node:"<<preorder_node<<std::endl;
             size_type node = T[preorder_node];
             size_type leaf = 0;
@@ -1278,7 +2022,8 @@ public:
     }
 
 
-    void find_secondary_occ(const utils::primaryOcc &p_occ, std::set<size_type> &occ) const {
+    template<class sink_t>
+    void find_secondary_occ(const utils::primaryOcc &p_occ, sink_t &occ) const {
 
         //queue for node processing
         std::deque<utils::primaryOcc> Q;
@@ -1293,7 +2038,7 @@ public:
         };
         //initialize the queue
         if (p_occ.preorder == 1) {
-            occ.insert(p_occ.off_pattern);
+            occ.report(p_occ.off_pattern);
             return;
         }
         Q.emplace_back(p_occ); // insert a primary occ for the node and all its second mentions
@@ -1302,7 +2047,7 @@ public:
         while (!Q.empty()) {
             auto top = Q.front(); //first element
             if (top.preorder == 1) { //base case
-                occ.insert(top.off_pattern);
+                occ.report(top.off_pattern);
             } else {
                 //check if parent is run length
                 size_type parent = T.parent(top.node);
@@ -1343,23 +2088,22 @@ public:
 
 
     void compute_grammar_sfx(utils::nav_grammar &grammar, lpg_build::plain_grammar_t &G,
-                             utils::lenght_rules &len, std::vector<utils::sfx> &grammar_sfx) const;
+                             utils::lenght_rules &len, std::vector<utils::sfx> &grammar_sfx,
+                             const std::vector<uint32_t>& rule_level) const;
 
 
 
     typedef sdsl::int_vector_buffer<1>                   bvb_t;
     typedef sdsl::int_vector_buffer<>                    ivb_t;
-    typedef std::unordered_map<size_type,std::vector<size_type>>  nav_grammar;
+    typedef utils::nav_grammar                           nav_grammar;
 
     static nav_grammar build_nav_grammar(const lpg_build::plain_grammar_t& G, size_type& S) {
 
-        sdsl::int_vector<> rules_buff;
-        std::ifstream _buf(G.rules_file,std::ios::in);
-        sdsl::load(rules_buff,_buf);
-//        ivb_t rules_buff(G.rules_file);
+        nav_grammar NG;
+        NG.load(G.rules_file, G.rules_lim_file);
 
         size_type zero_count = 0;
-        for (auto && i : rules_buff) {
+        for (auto && i : NG.symbols()) {
             if(i == 0) zero_count++;
         }
 
@@ -1368,37 +2112,163 @@ public:
             exit(1);
         }
 
-        bvb_t rules_lim_buff(G.rules_lim_file);
-        size_type id = 0;
-        nav_grammar NG;
-        std::vector<size_type> right_hand;
-        zero_count = 0;
-        for (size_t i = 0; i < rules_lim_buff.size(); ++i) {
-            right_hand.push_back(rules_buff[i]);
-            if(rules_buff[i] == 0) {
-                zero_count++;
-                /*std::cout<<"right hand"<<std::endl;
-                for (const auto &item : right_hand) {
-                    std::cout<<item<<" ";
+        S = NG[NG.size()-1][0];
+        return NG;
+    }
+
+    //compute the number of times every rule appears in the parse tree of the text. The rules
+    // are visited in topological order (reverse postorder from S) so the count of a rule
+    // is complete before it is propagated to its right-hand side
+    static void compute_rules_occ(nav_grammar& NG, const plain_grammar_t& G, const size_type& S, sdsl::int_vector<>& r_occ) {
+        sdsl::int_vector_buffer<1> is_rules_len(G.is_rl_file);
+        sdsl::int_vector<> occ(G.r, 0, 64);
+        sdsl::bit_vector visited(G.r, false);
+        std::vector<size_type> order;
+        order.reserve(G.r);
+
+        //iterative postorder over the nonterminals
+        std::vector<std::pair<size_type, size_type>> stack;
+        stack.emplace_back(S, 0);
+        visited[S] = true;
+        while(!stack.empty()){
+            auto& top = stack.back();
+            auto const& rhs = NG[top.first];
+            bool is_rl = is_rules_len[top.first] && rhs.size() == 2;
+            size_type n_children = is_rl ? 1 : rhs.size();
+            if(top.second < n_children){
+                size_type child = rhs[top.second++];
+                if(!visited[child] && !G.isTerminal(child)){
+                    visited[child] = true;
+                    stack.emplace_back(child, 0);
                 }
-                std::cout<<std::endl;*/
+            }else{
+                order.push_back(top.first);
+                stack.pop_back();
             }
-            if(rules_lim_buff[i] == 1){
-                NG[id] = right_hand;
-                right_hand.clear();
-                id++;
+        }
+
+        occ[S] = 1;
+        for(auto it = order.rbegin(); it != order.rend(); ++it){
+            auto const& rhs = NG[*it];
+            if(is_rules_len[*it] && rhs.size() == 2){
+                occ[rhs[0]] += occ[*it] * rhs[1];
+            }else{
+                for(auto const& sym : rhs) occ[sym] += occ[*it];
             }
         }
-        S = NG[id-1][0];
-        /*std::cout<<"plain-grammar"<<std::endl;
-        for (const auto &item : NG) {
-            std::cout<<item.first<<"->";
-            for (const auto &second : item.second) {
-                std::cout<<second<<" ";
+        sdsl::util::bit_compress(occ);
+        r_occ.swap(occ);
+    }
+
+    //store the first k bytes of the reversed expansion of every row and of the suffix
+    // expansion of every column of the grid
+    void build_prefix_caches(size_t k, size_t n_threads){
+        const auto &T = grammar_tree.getT();
+        size_type n_rows = grammar_tree.get_size_rules() - 1;
+        size_type n_cols = has_level_grid() ? m_level_grid.size_cols() : m_grid.size_cols();
+        m_row_cache.init(n_rows, k);
+        m_col_cache.init(n_cols, k);
+
+        //the entries are filled in blocks, so two threads never write to the same word
+        size_t block = 4096;
+        thread_pool pool(n_threads);
+        pool.parallel_for((n_rows + block - 1) / block, [&](size_t b, size_t){
+            for(size_type row = b * block; row < std::min(n_rows, (b + 1) * block); row++){
+                m_row_cache.set(row, [&](const auto& g){
+                    uint64_t prenode = grammar_tree.first_occ_from_rule(row);
+                    dfs_mirror_leaf(prenode, T[prenode], [&](const uint64_t &, const uint64_t &, const uint64_t &X){
+                        return g(get_symbol(X));
+                    });
+                });
             }
-            std::cout<<std::endl;
-        }*/
-        return NG;
+        });
+        pool.parallel_for((n_cols + block - 1) / block, [&](size_t b, size_t){
+            for(size_type col = b * block + 1; col <= std::min(n_cols, (b + 1) * block); col++){
+                m_col_cache.set(col - 1, [&](const auto& g){
+                    uint64_t prenode = has_level_grid() ? m_level_grid.first_label_col(col) : m_grid.first_label_col(col);
+                    process_suffix_grammar(prenode, [&](const uint64_t &, const uint64_t &, const uint64_t &X){
+                        return g(get_symbol(X));
+                    });
+                });
+            }
+        });
+    }
+
+    //Karp-Rabin fingerprint in base b of the expansion of every rule. The rules are processed in
+    // postorder, so the fingerprints of the children are ready when their parent is visited
+    void compute_rules_kr(nav_grammar& NG, const plain_grammar_t& G, utils::lenght_rules& lengths, const size_type& S,
+                          uint64_t b, sdsl::int_vector<>& kr_out) const {
+        sdsl::int_vector_buffer<1> is_rules_len(G.is_rl_file);
+        sdsl::int_vector<> fp(G.r, 0, 64);
+        sdsl::bit_vector visited(G.r, false);
+
+        for(auto const& sym : G.sym_map) fp[sym.first] = get_symbol(sym.first);
+
+        auto rule_len = [&](const size_type& X) -> size_type {
+            return G.isTerminal(X) ? 1 : lengths[X].second;
+        };
+
+        std::vector<std::pair<size_type, size_type>> stack;
+        stack.emplace_back(S, 0);
+        visited[S] = true;
+        while(!stack.empty()){
+            auto& top = stack.back();
+            auto const& rhs = NG[top.first];
+            bool is_rl = is_rules_len[top.first] && rhs.size() == 2;
+            size_type n_children = is_rl ? 1 : rhs.size();
+            if(top.second < n_children){
+                size_type child = rhs[top.second++];
+                if(!visited[child] && !G.isTerminal(child)){
+                    visited[child] = true;
+                    stack.emplace_back(child, 0);
+                }
+            }else{
+                if(is_rl){
+                    fp[top.first] = kr::repeat(fp[rhs[0]], kr::pow(rule_len(rhs[0]), b), rhs[1]);
+                }else{
+                    uint64_t h = 0;
+                    for(auto const& sym : rhs) h = kr::concat(h, fp[sym], kr::pow(rule_len(sym), b));
+                    fp[top.first] = h;
+                }
+                stack.pop_back();
+            }
+        }
+        sdsl::util::bit_compress(fp);
+        kr_out.swap(fp);
+    }
+
+    //level of every rule: the terminals have level 0, and a nonterminal has one level more
+    // than its highest child. The rules are processed in postorder from every unvisited rule
+    static std::vector<uint32_t> compute_rules_level(nav_grammar& NG, const plain_grammar_t& G) {
+        sdsl::int_vector_buffer<1> is_rules_len(G.is_rl_file);
+        std::vector<uint32_t> level(G.r, 0);
+        sdsl::bit_vector visited(G.r, false);
+
+        std::vector<std::pair<size_type, size_type>> stack;
+        for(size_type root = 0; root < G.r; root++){
+            if(visited[root] || G.isTerminal(root) || root >= NG.size()) continue;
+            stack.emplace_back(root, 0);
+            visited[root] = true;
+            while(!stack.empty()){
+                auto& top = stack.back();
+                auto const& rhs = NG[top.first];
+                bool is_rl = is_rules_len[top.first] && rhs.size() == 2;
+                size_type n_children = is_rl ? 1 : rhs.size();
+                if(top.second < n_children){
+                    size_type child = rhs[top.second++];
+                    if(!visited[child] && !G.isTerminal(child)){
+                        visited[child] = true;
+                        stack.emplace_back(child, 0);
+                    }
+                }else{
+                    uint32_t lvl = 0;
+                    for(size_type j = 0; j < n_children; j++) lvl = std::max(lvl, level[rhs[j]]);
+                    level[top.first] = lvl + 1;
+                    stack.pop_back();
+                }
+            }
+        }
+        return level;
     }
 
     void uncompress_grammar(const std::string & file_dir) const {
@@ -1423,7 +2293,8 @@ void lpg_index::compute_grammar_sfx(
         utils::nav_grammar & grammar,
         lpg_build::plain_grammar_t& G,
         utils::lenght_rules& len,
-        std::vector<utils::sfx>& grammar_sfx
+        std::vector<utils::sfx>& grammar_sfx,
+        const std::vector<uint32_t>& rule_level
 )const{
 
 //    utils::cuts_rules cuts;
@@ -1431,37 +2302,40 @@ void lpg_index::compute_grammar_sfx(
 
     const auto& m_tree = grammar_tree.getT();
     sdsl::int_vector_buffer<1> is_rules_len(G.is_rl_file);
-    for (const auto &r : grammar) {
-        if(G.sym_map.find(r.first) == G.sym_map.end() && r.second.size() > 1) {
+    for (size_type id = 0; id < grammar.size(); id++) {
+        auto rhs = grammar[id];
+        if(G.sym_map.find(id) == G.sym_map.end() && rhs.size() > 1) {
 
-            size_type preorder = grammar_tree.first_occ_from_rule(r.first);
+            size_type preorder = grammar_tree.first_occ_from_rule(id);
             auto node = m_tree[preorder];//preorder select
 //            auto run_len = grammar_tree.is_run(preorder);
+            //the level of the cuts of a rule is the level of the rule
+            size_type lvl = rule_level.empty() ? 0 : rule_level[id];
 
-            if( is_rules_len[r.first] == true ){
+            if( is_rules_len[id] == true ){
 
                 size_type  off = grammar_tree.offset_node(node);
                 size_type  _child = m_tree.child(node,2);
                 size_type ch_off = grammar_tree.offset_node(_child);
-                size_type l = (ch_off-off) * (r.second[1] - 1);
+                size_type l = (ch_off-off) * (rhs[1] - 1);
                 size_type  _ch_pre = m_tree.pre_order(_child);
-                utils::sfx s(ch_off,l,r.second[0],_ch_pre,0);
+                utils::sfx s(ch_off,l,rhs[0],_ch_pre,lvl);
                 grammar_sfx.push_back(s);
 
             }else{
                 size_type acc_len = 0;
 
-                for (size_type i = 1; i < r.second.size(); ++i) {
+                for (size_type i = 1; i < rhs.size(); ++i) {
                     size_type  _child = m_tree.child(node, i + 1);
                     size_type  _ch_pre = m_tree.pre_order(_child);
                     size_type off  = grammar_tree.offset_node(_child);
-                    acc_len += len[r.second[i-1]].second;
+                    acc_len += len[rhs[i-1]].second;
                     utils::sfx s(
                             off,//rule off
-                            len[r.first].second - acc_len,// len of parent - len of prev-sibling
-                            r.second[i-1], //prev-sibling id
+                            len[id].second - acc_len,// len of parent - len of prev-sibling
+                            rhs[i-1], //prev-sibling id
                             _ch_pre,//preorder
-                            0
+                            lvl
                     );
 
                     grammar_sfx.push_back(s);
@@ -1516,7 +2390,8 @@ void lpg_index::compute_grammar_sfx(
 
 
 
-void lpg_index::locate(const std::string &pattern, std::set<lpg_index::size_type> &pos)  const {
+template<class sink_t>
+void lpg_index::locate(const std::string &pattern, sink_t &pos)  const {
 
     //get_cuts(pattern);
     //std::string test="AAGAAAGAAAGAAAGAAAGAAAGAAAGAAAAATACAAGGTTTGAGAGCCC";
@@ -1540,26 +2415,19 @@ void lpg_index::locate(const std::string &pattern, std::set<lpg_index::size_type
     }
     std::cout<<""<<std::endl;*/
 
-    uint32_t level = partitions.second;
+    kr_pattern kp;
+    if(has_kr()) kp = kr_pattern(pattern);
     for (const auto &cut : partitions.first) {
 //        std::cout<<item<<" ";
-        grid_query range{};
+        if(cut==0) continue;
 
-        bool res = false;
+        //range search and grid search
+        std::vector<utils::primaryOcc> pOcc;
+        search_cut(pattern, cut, has_kr() ? &kp : nullptr, pOcc);
 
-        //range search
-        if(cut>0){
-            res = search_grid_range(pattern.c_str(), pattern.size(), cut ,level, range);
-        }
-
-        if(res){
-            std::vector<utils::primaryOcc> pOcc;
-            // grid search
-            grid_search(range, cut , pattern.size(), level, pOcc);
-            // find secondary occ
-            for (const auto &occ : pOcc) {
-                find_secondary_occ(occ,pos);
-            }
+        // find secondary occ
+        for (const auto &occ : pOcc) {
+            find_secondary_occ(occ,pos);
         }
     }
 //        std::cout<<std::endl;
@@ -1567,51 +2435,66 @@ void lpg_index::locate(const std::string &pattern, std::set<lpg_index::size_type
 
 
 
-void lpg_index::locate_all_cuts(const std::string &pattern, std::set<lpg_index::size_type> &pos)  const {
+lpg_index::size_type lpg_index::count(const std::string &pattern) const {
+    auto partitions  = get_cuts(pattern);
+    size_type n_occ = 0;
+    kr_pattern kp;
+    if(has_kr()) kp = kr_pattern(pattern);
+    std::vector<utils::primaryOcc> pOcc;
+    for (const auto &cut : partitions.first) {
+        if(cut==0) continue;
+        search_cut(pattern, cut, has_kr() ? &kp : nullptr, pOcc);
+    }
+    //locate reports every position once, so a primary occurrence found by more than one cut
+    // (same node and same offset of the pattern) has to be counted once too
+    std::sort(pOcc.begin(), pOcc.end(), [](const utils::primaryOcc& a, const utils::primaryOcc& b){
+        return a.preorder < b.preorder || (a.preorder == b.preorder && a.off_pattern < b.off_pattern);
+    });
+    auto last = std::unique(pOcc.begin(), pOcc.end(), [](const utils::primaryOcc& a, const utils::primaryOcc& b){
+        return a.preorder == b.preorder && a.off_pattern == b.off_pattern;
+    });
+    //every primary occurrence is copied as many times as its rule appears in the text
+    for (auto it = pOcc.begin(); it != last; ++it) {
+        n_occ += rules_occ[grammar_tree.get_rule_from_preorder_node(it->preorder)];
+    }
+    return n_occ;
+}
+
+template<class sink_t>
+void lpg_index::locate_all_cuts(const std::string &pattern, sink_t &pos)  const {
     //find primary occ
 //    auto partitions  = compute_pattern_cuts(pattern);
-    uint32_t level = 0;
+    kr_pattern kp;
+    if(has_kr()) kp = kr_pattern(pattern);
     for(uint64_t item = 0; item < pattern.size() - 1; ++item) {
-        grid_query range{};
-        //range search
-        if(search_grid_range(pattern.c_str(),pattern.size(), item + 1,level, range)){
-            std::vector<utils::primaryOcc> pOcc;
+        //range search and grid search
+        std::vector<utils::primaryOcc> pOcc;
+        search_cut(pattern, item + 1, has_kr() ? &kp : nullptr, pOcc);
 
-            // grid search
-            grid_search(range, item + 1,pattern.size(),level,pOcc);
-
-            /*if(!pOcc.empty()){
-                std::cout<<"AllvsAll cut "<<item+1<<" yielded cuts"<<std::endl;
-            }*/
+        /*if(!pOcc.empty()){
+            std::cout<<"AllvsAll cut "<<item+1<<" yielded cuts"<<std::endl;
+        }*/
 
-            // find secondary occ
-            for (const auto &occ : pOcc) {
-                find_secondary_occ(occ, pos);
-            }
+        // find secondary occ
+        for (const auto &occ : pOcc) {
+            find_secondary_occ(occ, pos);
         }
     }
 
 }
 
-void lpg_index::locate_split_time(const std::string &pattern, std::set<lpg_index::size_type> &pos, size_t& p_time, size_t& s_time) const {
+template<class sink_t>
+void lpg_index::locate_split_time(const std::string &pattern, sink_t &pos, size_t& p_time, size_t& s_time) const {
 
     auto start = std::chrono::high_resolution_clock::now();
     //find primary occ
     std::vector<utils::primaryOcc> prim_occ;
     auto partitions  = compute_pattern_cuts(pattern);
-    uint32_t level = partitions.second;
+    kr_pattern kp;
+    if(has_kr()) kp = kr_pattern(pattern);
     for (const auto &item : partitions.first) {
-        grid_query range{};
-        //range search
-        if(search_grid_range(pattern.c_str(),pattern.size(),item + 1,level, range)){
-            std::vector<utils::primaryOcc> pOcc;
-            // grid search
-            grid_search(range,item + 1,pattern.size(),level,pOcc);
-            // find secondary occ
-            size_t prev_size = prim_occ.size();
-            prim_occ.resize(prev_size + pOcc.size());
-            std::copy(pOcc.begin(),pOcc.end(),prim_occ.begin()+(std::streamsize)prev_size);
-        }
+        //range search and grid search
+        search_cut(pattern, item + 1, has_kr() ? &kp : nullptr, prim_occ);
     }
     auto end = std::chrono::high_resolution_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
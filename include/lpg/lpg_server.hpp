@@ -0,0 +1,292 @@
+#ifndef LPG_COMPRESSOR_LPG_SERVER_HPP
+#define LPG_COMPRESSOR_LPG_SERVER_HPP
+
+#include <csignal>
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "lpg_index.hpp"
+#include "cdt/thread_pool.hpp"
+
+//Long-running query server. It keeps an lpg_index in memory and answers requests received
+// through the standard input or a Unix domain socket. Every request is executed as an
+// independent task of a thread pool, so the requests of one or several clients are
+// resolved concurrently. The responses carry the id of the request as they can arrive
+// in a different order.
+//
+// Requests (one header line each, payloads are raw bytes):
+//   L <id> <len>\n<pattern>   locate the pattern (len bytes)
+//   C <id> <len>\n<pattern>   count the occurrences of the pattern
+//   D <id> <len>\n<pattern>   locate the pattern in the documents of a collection
+//   E <id> <start> <end>\n    extract text[start..end] (inclusive)
+//   Q\n                       close the connection
+//
+// Responses:
+//   <id> L <n> <pos_1> ... <pos_n>\n   sorted text positions
+//   <id> C <n>\n
+//   <id> D <n> <doc_1>:<off_1> ... <doc_n>:<off_n>\n   (document, offset) pairs
+//   <id> E <len>\n<bytes>\n
+//   <id> ERR <message>\n
+//
+// A pattern has between 1 and max_pattern_len bytes. A longer pattern can not be skipped
+// safely, so the server answers with an error and closes the connection. Every connection
+// has at most max_in_flight requests in the pool; the reader waits for one of them to
+// finish before it submits the next one.
+class lpg_server{
+
+    static constexpr size_t max_pattern_len = 1UL<<20UL;
+    static constexpr size_t max_in_flight = 64;
+
+    //a client connection. The input is read by a single thread and the responses are
+    // written by the workers of the pool, one complete response at a time
+    struct connection{
+        int                     in_fd;
+        int                     out_fd;
+        std::mutex              out_mtx;
+        std::vector<char>       buffer;
+        size_t                  buff_pos=0;
+        size_t                  buff_len=0;
+        //requests of the connection submitted to the pool and not answered yet
+        size_t                  in_flight=0;
+        std::mutex              flight_mtx;
+        std::condition_variable flight_cv;
+
+        connection(int in_fd_, int out_fd_): in_fd(in_fd_), out_fd(out_fd_), buffer(1<<16){}
+
+        ~connection(){
+            if(in_fd>STDERR_FILENO) close(in_fd);
+            if(out_fd>STDERR_FILENO && out_fd!=in_fd) close(out_fd);
+        }
+
+        bool fill(){
+            ssize_t n;
+            do{
+                n = ::read(in_fd, buffer.data(), buffer.size());
+            }while(n<0 && errno==EINTR);
+            if(n<=0) return false;
+            buff_pos = 0;
+            buff_len = size_t(n);
+            return true;
+        }
+
+        //read a line without the trailing '\n'
+        bool read_line(std::string& line){
+            line.clear();
+            while(true){
+                if(buff_pos==buff_len && !fill()) return !line.empty();
+                char *start = buffer.data()+buff_pos;
+                char *nl = (char *)memchr(start, '\n', buff_len-buff_pos);
+                if(nl!=nullptr){
+                    line.append(start, nl);
+                    buff_pos += (nl-start)+1;
+                    return true;
+                }
+                line.append(start, buff_len-buff_pos);
+                buff_pos = buff_len;
+            }
+        }
+
+        bool read_bytes(std::string& data, size_t len){
+            data.clear();
+            while(data.size()<len){
+                if(buff_pos==buff_len && !fill()) return false;
+                size_t n = std::min(len-data.size(), buff_len-buff_pos);
+                data.append(buffer.data()+buff_pos, n);
+                buff_pos += n;
+            }
+            return true;
+        }
+
+        //wait until the connection can submit another request to the pool
+        void acquire(){
+            std::unique_lock<std::mutex> lck(flight_mtx);
+            flight_cv.wait(lck, [this](){ return in_flight<max_in_flight; });
+            in_flight++;
+        }
+
+        void release(){
+            {
+                std::lock_guard<std::mutex> lck(flight_mtx);
+                in_flight--;
+            }
+            flight_cv.notify_one();
+        }
+
+        void write_response(const std::string& resp){
+            std::lock_guard<std::mutex> lck(out_mtx);
+            size_t written = 0;
+            while(written<resp.size()){
+                ssize_t n = ::write(out_fd, resp.data()+written, resp.size()-written);
+                if(n<0){
+                    if(errno==EINTR) continue;
+                    return;//the client is gone
+                }
+                written += size_t(n);
+            }
+        }
+    };
+
+    const lpg_index& m_idx;
+    thread_pool      m_pool;
+
+    std::string locate(const std::string& id, const std::string& pattern) const{
+        occ_vector_sink occ;
+        m_idx.locate(pattern, occ);
+        occ.finish();
+        std::string resp = id + " L " + std::to_string(occ.size());
+        for(auto const& pos : occ.pos){
+            resp.push_back(' ');
+            resp.append(std::to_string(pos));
+        }
+        resp.push_back('\n');
+        return resp;
+    }
+
+    std::string locate_docs(const std::string& id, const std::string& pattern) const{
+        std::vector<std::pair<size_t, size_t>> occ;
+        m_idx.locate_docs(pattern, occ);
+        std::string resp = id + " D " + std::to_string(occ.size());
+        for(auto const& pair : occ){
+            resp.push_back(' ');
+            resp.append(std::to_string(pair.first));
+            resp.push_back(':');
+            resp.append(std::to_string(pair.second));
+        }
+        resp.push_back('\n');
+        return resp;
+    }
+
+    std::string count(const std::string& id, const std::string& pattern) const{
+        return id + " C " + std::to_string(m_idx.count(pattern)) + "\n";
+    }
+
+    std::string extract(const std::string& id, size_t start, size_t end) const{
+        std::string text;
+        m_idx.extract(start, end, text);
+        std::string resp = id + " E " + std::to_string(text.size()) + "\n";
+        resp.append(text);
+        resp.push_back('\n');
+        return resp;
+    }
+
+    static std::string error(const std::string& id, const std::string& msg){
+        return (id.empty() ? "-" : id) + " ERR " + msg + "\n";
+    }
+
+    //read the requests of a connection until the client closes it
+    void serve_connection(const std::shared_ptr<connection>& conn){
+        std::string line, payload;
+        while(conn->read_line(line)){
+            if(line.empty()) continue;
+
+            std::stringstream ss(line);
+            std::string op, id;
+            ss >> op >> id;
+
+            if(op=="Q") break;
+
+            if(op=="L" || op=="C" || op=="D"){
+                size_t len;
+                if(!(ss >> len)){
+                    conn->write_response(error(id, "missing pattern length"));
+                    continue;
+                }
+                if(len==0){
+                    conn->write_response(error(id, "empty pattern"));
+                    continue;
+                }
+                if(len>max_pattern_len){
+                    //the payload can not be skipped without reading it, so the stream is lost
+                    conn->write_response(error(id, "pattern longer than "+std::to_string(max_pattern_len)+" bytes"));
+                    break;
+                }
+                if(!conn->read_bytes(payload, len)) break;
+                char type = op[0];
+                conn->acquire();
+                m_pool.submit([this, conn, id, type, pattern = std::move(payload)](size_t){
+                    if(type=='L'){
+                        conn->write_response(locate(id, pattern));
+                    }else if(type=='C'){
+                        conn->write_response(count(id, pattern));
+                    }else{
+                        conn->write_response(locate_docs(id, pattern));
+                    }
+                    conn->release();
+                });
+            }else if(op=="E"){
+                size_t start, end;
+                if(!(ss >> start >> end) || start>end){
+                    conn->write_response(error(id, "invalid range"));
+                    continue;
+                }
+                conn->acquire();
+                m_pool.submit([this, conn, id, start, end](size_t){
+                    conn->write_response(extract(id, start, end));
+                    conn->release();
+                });
+            }else{
+                conn->write_response(error(id, "unknown request "+op));
+            }
+        }
+    }
+
+public:
+
+    lpg_server(const lpg_index& idx, size_t n_threads): m_idx(idx), m_pool(n_threads){
+        //a client that closes its socket should not kill the server
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    //answer the requests of the standard input through the standard output
+    void serve_stdio(){
+        auto conn = std::make_shared<connection>(STDIN_FILENO, STDOUT_FILENO);
+        serve_connection(conn);
+        m_pool.wait();
+    }
+
+    //listen in a Unix domain socket. Every client gets a reader thread, and the requests of
+    // all the clients share the thread pool
+    void serve_socket(const std::string& path){
+        int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(sfd<0){
+            std::cout<<"Error: could not create the socket"<<std::endl;
+            exit(1);
+        }
+
+        struct sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if(path.size()>=sizeof(addr.sun_path)){
+            std::cout<<"Error: the socket path "<<path<<" is too long"<<std::endl;
+            exit(1);
+        }
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+        unlink(path.c_str());
+
+        if(bind(sfd, (struct sockaddr *)&addr, sizeof(addr))<0 || listen(sfd, SOMAXCONN)<0){
+            std::cout<<"Error: could not listen in the socket "<<path<<std::endl;
+            exit(1);
+        }
+        std::cout<<"Listening in "<<path<<std::endl;
+
+        while(true){
+            int cfd = accept(sfd, nullptr, nullptr);
+            if(cfd<0){
+                if(errno==EINTR) continue;
+                std::cout<<"Error: accept() failed"<<std::endl;
+                break;
+            }
+            auto conn = std::make_shared<connection>(cfd, cfd);
+            std::thread([this, conn](){ serve_connection(conn); }).detach();
+        }
+        close(sfd);
+        unlink(path.c_str());
+    }
+};
+#endif //LPG_COMPRESSOR_LPG_SERVER_HPP
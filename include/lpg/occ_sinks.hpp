@@ -0,0 +1,103 @@
+#ifndef LPG_COMPRESSOR_OCC_SINKS_HPP
+#define LPG_COMPRESSOR_OCC_SINKS_HPP
+
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <sdsl/int_vector.hpp>
+
+//Destinations for the text positions reported by lpg_index::locate. A sink only needs a
+// report(pos) member. The same position can be reported more than once (different cuts
+// of the pattern can yield the same occurrence), so every sink decides how to deal with
+// the duplicates
+
+//append-only vector. The duplicates are removed by a sort at the end (finish())
+struct occ_vector_sink{
+    std::vector<size_t> pos;
+
+    inline void report(const size_t& p){
+        pos.push_back(p);
+    }
+
+    //sort the positions and remove the duplicates
+    void finish(){
+        std::sort(pos.begin(), pos.end());
+        pos.erase(std::unique(pos.begin(), pos.end()), pos.end());
+    }
+
+    [[nodiscard]] inline size_t size() const{
+        return pos.size();
+    }
+
+    inline void clear(){
+        pos.clear();
+    }
+};
+
+//stream every position to a function as soon as it is found. The positions are not
+// sorted nor deduplicated
+template<class F>
+struct occ_callback_sink{
+    const F& f;
+
+    explicit occ_callback_sink(const F& f_): f(f_){}
+
+    inline void report(const size_t& p){
+        f(p);
+    }
+};
+
+//dense bitmap over the text. It uses n bits regardless of the number of occurrences,
+// which pays off for very frequent patterns
+struct occ_bitmap_sink{
+    sdsl::bit_vector bits;
+    size_t           n_occ=0;
+
+    explicit occ_bitmap_sink(size_t text_len): bits(text_len, false){}
+
+    inline void report(const size_t& p){
+        if(!bits[p]){
+            bits[p] = true;
+            n_occ++;
+        }
+    }
+
+    [[nodiscard]] inline size_t size() const{
+        return n_occ;
+    }
+
+    //visit the positions in increasing order
+    template<class F>
+    void for_each(const F& f) const {
+        const uint64_t* data = bits.data();
+        size_t n_words = (bits.size()+63)/64;
+        for(size_t i=0;i<n_words;i++){
+            uint64_t word = data[i];
+            while(word){
+                f(i*64 + __builtin_ctzll(word));
+                word &= word-1;
+            }
+        }
+    }
+
+    inline void clear(){
+        sdsl::util::set_to_value(bits, 0);
+        n_occ = 0;
+    }
+};
+
+//sorted set of positions
+struct occ_set_sink{
+    std::set<size_t>& pos;
+
+    explicit occ_set_sink(std::set<size_t>& pos_): pos(pos_){}
+
+    inline void report(const size_t& p){
+        pos.insert(p);
+    }
+
+    [[nodiscard]] inline size_t size() const{
+        return pos.size();
+    }
+};
+#endif //LPG_COMPRESSOR_OCC_SINKS_HPP
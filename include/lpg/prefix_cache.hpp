@@ -0,0 +1,129 @@
+#ifndef LPG_COMPRESSOR_PREFIX_CACHE_HPP
+#define LPG_COMPRESSOR_PREFIX_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <sdsl/int_vector.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//First k bytes of a set of strings (the expansions of the grid rows and columns) stored
+// in a flat array with stride k, plus the length of every string truncated to k+1. A
+// comparison against a pattern is decided from the array unless the first k bytes are
+// equal and both strings are longer than k (a tie)
+class prefix_cache{
+
+    uint8_t             m_k=0;
+    sdsl::int_vector<8> m_bytes; //string i is in m_bytes[i*k..(i+1)*k-1] (zero padded)
+    sdsl::int_vector<8> m_lens;  //min(|string i|, k+1)
+
+public:
+
+    static constexpr int TIE = 2;
+    static constexpr uint8_t MAX_K = 64;
+    typedef size_t size_type;
+
+    prefix_cache() = default;
+
+    [[nodiscard]] inline bool enabled() const {
+        return m_k>0;
+    }
+
+    [[nodiscard]] inline uint8_t k() const {
+        return m_k;
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return m_lens.size();
+    }
+
+    //allocate n entries of k bytes (k is rounded up to a multiple of 8)
+    void init(size_t n, size_t k){
+        m_k = std::min<size_t>(((k+7)/8)*8, MAX_K);
+        m_bytes = sdsl::int_vector<8>(n*m_k, 0);
+        m_lens = sdsl::int_vector<8>(n, 0);
+    }
+
+    //store the prefix of string i. f(g) has to call g(sym) with the symbols of the string
+    // in order until g returns false
+    template<class F>
+    void set(size_t i, const F& f){
+        auto *dst = reinterpret_cast<uint8_t *>(m_bytes.data()) + i*m_k;
+        size_t len=0;
+        f([&](uint8_t sym){
+            if(len<m_k) dst[len] = sym;
+            len++;
+            return len<=m_k;
+        });
+        m_lens[i] = len;
+    }
+
+    //compare string i with a pattern of length pat_len whose first min(pat_len, k) bytes
+    // are in pat (the buffer must have k bytes). The result follows the convention of the
+    // grammar comparisons: 0 if the pattern is a prefix of the string, -1 if the string is
+    // a proper prefix of the pattern or the string is smaller, 1 if the string is greater,
+    // and TIE if the first k bytes are not enough to decide
+    [[nodiscard]] inline int cmp(size_t i, const uint8_t* pat, size_t pat_len) const {
+        const auto *str = reinterpret_cast<const uint8_t *>(m_bytes.data()) + i*m_k;
+        size_t str_len = m_lens[i];
+        size_t n = std::min<size_t>(std::min<size_t>(str_len, pat_len), m_k);
+
+        size_t diff = m_k;
+#ifdef __SSE2__
+        for(size_t j=0;j<m_k;j+=16){
+            if(m_k-j>=16){
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str+j));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pat+j));
+                auto mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFFU;
+                if(mask){
+                    diff = j + __builtin_ctz(mask);
+                    break;
+                }
+            }else{
+                uint64_t a, b;
+                memcpy(&a, str+j, 8);
+                memcpy(&b, pat+j, 8);
+                if(a!=b){
+                    diff = j + (__builtin_ctzll(a^b)>>3UL);
+                    break;
+                }
+            }
+        }
+#else
+        for(size_t j=0;j<m_k;j++){
+            if(str[j]!=pat[j]){
+                diff = j;
+                break;
+            }
+        }
+#endif
+        if(diff<n) return str[diff]>pat[diff] ? 1 : -1;
+        if(pat_len<=n) return 0;          //the pattern is exhausted
+        if(str_len<=m_k) return -1;       //the whole string is cached and it is shorter
+        return TIE;
+    }
+
+    void swap(prefix_cache& other){
+        std::swap(m_k, other.m_k);
+        m_bytes.swap(other.m_bytes);
+        m_lens.swap(other.m_lens);
+    }
+
+    void load(std::istream &in){
+        sdsl::read_member(m_k, in);
+        m_bytes.load(in);
+        m_lens.load(in);
+    }
+
+    size_type serialize(std::ostream &out, sdsl::structure_tree_node *v=nullptr, const std::string& name="") const {
+        sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += sdsl::write_member(m_k, out, child, "k");
+        written_bytes += m_bytes.serialize(out, child, "bytes");
+        written_bytes += m_lens.serialize(out, child, "lens");
+        sdsl::structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+};
+#endif //LPG_COMPRESSOR_PREFIX_CACHE_HPP
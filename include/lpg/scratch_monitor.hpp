@@ -0,0 +1,105 @@
+#ifndef LPG_COMPRESSOR_SCRATCH_MONITOR_HPP
+#define LPG_COMPRESSOR_SCRATCH_MONITOR_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//Enforce the scratch budget of a construction (the bytes of temporal files it can keep in its
+// folder). Like mem_monitor, a thread samples the folder every granularity milliseconds, so a
+// stage that writes more than the budget is stopped while it runs, not when it finishes. The
+// construction can also check the folder explicitly at the end of its stages. The folder is
+// removed only if the construction created it (a resumed folder keeps its checkpoint)
+class scratch_monitor{
+
+    std::string               m_dir;
+    size_t                    m_budget;
+    bool                      m_own_dir;
+    std::chrono::milliseconds m_granularity;
+    std::mutex                m_mutex;
+    std::condition_variable   m_cv;
+    std::thread               m_thread;
+    bool                      m_run = true;
+
+    void monitor(){
+        while(true){
+            {
+                std::unique_lock<std::mutex> lk(m_mutex);
+                if(m_cv.wait_for(lk, m_granularity, [this]{ return !m_run; })) return;
+            }
+            size_t usage = scratch_usage(m_dir);
+            if(usage>m_budget){
+                report(usage, "during the construction");
+                //the other threads of the construction are still running, so the process can not
+                // run the exit handlers and the destructors of the static objects
+                std::_Exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    void report(size_t usage, const std::string& stage) const {
+        std::cout<<"Error: the temporal files use "<<usage<<" bytes "<<stage
+                 <<", but the scratch budget is "<<m_budget<<" bytes"<<std::endl;
+        if(m_own_dir){
+            std::error_code ec;
+            std::filesystem::remove_all(m_dir, ec);
+        }
+    }
+
+public:
+
+    scratch_monitor(const scratch_monitor&) = delete;
+    scratch_monitor& operator=(const scratch_monitor&) = delete;
+
+    //budget=0 means no limit, and then no thread is started
+    scratch_monitor(const std::string& dir, size_t budget, bool own_dir,
+                    std::chrono::milliseconds granularity = std::chrono::milliseconds(200)):
+            m_dir(dir), m_budget(budget), m_own_dir(own_dir), m_granularity(granularity){
+        if(m_budget>0) m_thread = std::thread(&scratch_monitor::monitor, this);
+    }
+
+    ~scratch_monitor(){
+        stop();
+    }
+
+    //stop the sampling thread (before the construction removes its folder)
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_run = false;
+        }
+        m_cv.notify_one();
+        if(m_thread.joinable()) m_thread.join();
+    }
+
+    //abort the construction if the folder exceeds the budget after the given stage
+    void check(const std::string& stage){
+        if(m_budget==0) return;
+        size_t usage = scratch_usage(m_dir);
+        if(usage>m_budget){
+            stop();
+            report(usage, "after "+stage);
+            exit(1);
+        }
+    }
+
+    //bytes currently stored in the folder
+    static size_t scratch_usage(const std::string& dir){
+        size_t bytes = 0;
+        std::error_code ec;
+        for(auto const& entry : std::filesystem::recursive_directory_iterator(dir, ec)){
+            std::error_code f_ec;
+            if(entry.is_regular_file(f_ec)){
+                size_t size = entry.file_size(f_ec);
+                if(!f_ec) bytes += size;
+            }
+        }
+        return bytes;
+    }
+};
+#endif //LPG_COMPRESSOR_SCRATCH_MONITOR_HPP
@@ -0,0 +1,180 @@
+#ifndef LPG_COMPRESSOR_TEXT_STATS_HPP
+#define LPG_COMPRESSOR_TEXT_STATS_HPP
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lpg_build.hpp"
+
+//Statistics of the input text, computed in one streaming pass over the file. The pass
+// uses two buffers of BUFFER_SIZE bytes: a reader thread fills one while the other is
+// being scanned, so the memory is bounded regardless of the size of the text. The
+// result is kept by the construction and reused by its stages (alphabet, text length)
+// instead of re-reading the file
+struct text_stats{
+
+    typedef lpg_build::alpha_t alpha_t;
+
+    alpha_t alphabet;         //symbols of the text with their frequencies
+    size_t  freqs[256]={0};
+    size_t  n_chars=0;        //length of the text
+    size_t  n_lines=0;        //number of '\n' symbols
+    size_t  longest_run=0;    //longest equal-symbol run
+    size_t  first_zero=0;     //position of the first '\0' (n_chars if absent)
+    uint8_t last_sym=0;
+
+    text_stats() = default;
+
+    explicit text_stats(const std::string& i_file){
+        compute(i_file);
+    }
+
+    //scan the file and fill the statistics
+    void compute(const std::string& i_file){
+
+        int fd = open(i_file.c_str(), O_RDONLY);
+        if(fd<0){
+            std::cout<<"Error trying to open file "<<i_file<<std::endl;
+            exit(1);
+        }
+        struct stat st{};
+        fstat(fd, &st);
+        size_t file_size = st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        std::vector<uint8_t> buffers[2];
+        size_t buff_len[2]={0, 0};
+        bool   ready[2]={false, false};
+        size_t buff_size = std::min<size_t>(BUFFER_SIZE, std::max<size_t>(file_size, 1));
+        buffers[0].resize(buff_size);
+        buffers[1].resize(buff_size);
+        std::mutex mtx;
+        std::condition_variable cv;
+
+        //the reader fills the buffers in turns, and waits until the scanner releases them
+        std::thread reader([&](){
+            size_t off=0, b=0;
+            while(off<file_size){
+                {
+                    std::unique_lock<std::mutex> lck(mtx);
+                    cv.wait(lck, [&]{ return !ready[b]; });
+                }
+                size_t to_read = std::min(buff_size, file_size-off), n=0;
+                while(n<to_read){
+                    ssize_t r = pread(fd, buffers[b].data()+n, to_read-n, off+n);
+                    if(r<=0){
+                        if(r<0 && errno==EINTR) continue;
+                        break;
+                    }
+                    n += size_t(r);
+                }
+                {
+                    std::lock_guard<std::mutex> lck(mtx);
+                    buff_len[b] = n;
+                    ready[b] = true;
+                }
+                cv.notify_all();
+                if(n<to_read) break;
+                off += n;
+                b ^= 1UL;
+            }
+        });
+
+        n_chars = 0;
+        n_lines = 0;
+        longest_run = 0;
+        std::fill(std::begin(freqs), std::end(freqs), 0);
+        first_zero = std::numeric_limits<size_t>::max();
+        size_t run=0, b=0;
+        int prev_sym=-1;
+
+        while(n_chars<file_size){
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                cv.wait(lck, [&]{ return ready[b]; });
+            }
+            size_t expected = std::min(buff_size, file_size-n_chars);
+            size_t len = buff_len[b];
+
+            const uint8_t *data = buffers[b].data();
+            for(size_t i=0;i<len;i++){
+                uint8_t sym = data[i];
+                freqs[sym]++;
+                if(sym==prev_sym){
+                    run++;
+                }else{
+                    if(run>longest_run) longest_run = run;
+                    run = 1;
+                    prev_sym = sym;
+                }
+                if(sym==0 && first_zero==std::numeric_limits<size_t>::max()) first_zero = n_chars+i;
+            }
+            n_chars += len;
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                ready[b] = false;
+            }
+            cv.notify_all();
+            if(len<expected) break;//the reader stopped
+            b ^= 1UL;
+        }
+        reader.join();
+        close(fd);
+
+        if(n_chars!=file_size){
+            std::cout<<"Error: could read only "<<n_chars<<" of the "<<file_size<<" bytes of "<<i_file<<std::endl;
+            exit(1);
+        }
+
+        if(run>longest_run) longest_run = run;
+        if(first_zero==std::numeric_limits<size_t>::max()) first_zero = n_chars;
+        n_lines = freqs[(uint8_t)'\n'];
+        last_sym = prev_sym<0 ? 0 : uint8_t(prev_sym);
+
+        alphabet.clear();
+        for(size_t i=0;i<256;i++){
+            if(freqs[i]>0) alphabet.emplace_back(i, freqs[i]);
+        }
+    }
+
+    //the text has to end with its smallest symbol, and if that symbol is '\0', it can not
+    // appear anywhere else
+    [[nodiscard]] bool valid(std::string& msg) const {
+        if(n_chars==0){
+            msg = "the input file is empty";
+            return false;
+        }
+        if(freqs[0]>1){
+            msg = "the symbol '\\0' appears "+std::to_string(freqs[0])+" times (first at position "+
+                  std::to_string(first_zero)+"), but it can only appear at the end of the text";
+            return false;
+        }
+        if(last_sym!=alphabet[0].first){
+            msg = "sep. symbol "+std::to_string(alphabet[0].first)+" differs from last symbol in file "+
+                  std::to_string(last_sym);
+            return false;
+        }
+        return true;
+    }
+
+    void print() const {
+        std::cout << "  Number of characters: " << n_chars << std::endl;
+        std::cout << "  Alphabet:             " << alphabet.size() << std::endl;
+        std::cout << "  Smallest symbol:      " << (int) alphabet[0].first << std::endl;
+        std::cout << "  Greatest symbol:      " << (int) alphabet.back().first << std::endl;
+        std::cout << "  Number of lines:      " << n_lines << std::endl;
+        std::cout << "  Longest run:          " << longest_run << std::endl;
+    }
+};
+#endif //LPG_COMPRESSOR_TEXT_STATS_HPP
@@ -13,18 +13,92 @@
 #include <sdsl/csa_wt.hpp>
 #include <sdsl/suffix_arrays.hpp>
 #include <sdsl/wavelet_trees.hpp>
+#include <functional>
+#include <cstring>
+#include "cdt/parallel_sort.hpp"
+#include "kr_fingerprint.hpp"
 
 namespace utils {
 
     typedef size_t          size_type;
     typedef sdsl::int_vector_buffer<1>                   bvb_t;
     typedef sdsl::int_vector_buffer<>                    ivb_t;
-    typedef std::unordered_map<size_type,std::vector<size_type>>  nav_grammar;
-    typedef std::unordered_map<size_type,std::pair<size_type,size_type>> lenght_rules; //off,len
+    typedef std::vector<std::pair<size_type,size_type>> lenght_rules; //off,len of every rule
     typedef std::unordered_map<size_type,std::vector<size_type>> cuts_rules; //off,len
 //    typedef sdsl::csa_wt<sdsl::wt_huff<sdsl::rrr_vector<127> >, 512, 1024> TestIndex;
 
 
+    //Grammar in compressed sparse row form: the right-hand side of rule i is
+    // symbols[offsets[i]..offsets[i+1]-1]. It is loaded straight from the rules files of the
+    // plain grammar, so it costs two packed arrays instead of one heap vector (and one hash
+    // node) per rule
+    class nav_grammar{
+
+        sdsl::int_vector<> m_symbols; //right-hand sides of the rules, one after the other
+        sdsl::int_vector<> m_offsets; //m_offsets[i] is the position in m_symbols where rule i starts
+
+    public:
+
+        //read-only view of a right-hand side
+        class rhs_t{
+            const sdsl::int_vector<>* m_syms = nullptr;
+            size_type m_start = 0, m_end = 0;
+
+        public:
+            struct const_iterator{
+                const sdsl::int_vector<>* syms;
+                size_type pos;
+                inline size_type operator*() const { return (*syms)[pos]; }
+                inline const_iterator& operator++() { ++pos; return *this; }
+                inline bool operator!=(const const_iterator& other) const { return pos != other.pos; }
+            };
+
+            rhs_t() = default;
+            rhs_t(const sdsl::int_vector<>* syms, size_type start, size_type end): m_syms(syms), m_start(start), m_end(end){}
+
+            [[nodiscard]] inline size_type size() const { return m_end - m_start; }
+            [[nodiscard]] inline bool empty() const { return m_end == m_start; }
+            inline size_type operator[](const size_type& i) const { return (*m_syms)[m_start + i]; }
+            [[nodiscard]] inline const_iterator begin() const { return {m_syms, m_start}; }
+            [[nodiscard]] inline const_iterator end() const { return {m_syms, m_end}; }
+        };
+
+        nav_grammar() = default;
+
+        //load the right-hand sides from rules_file, and their limits from rules_lim_file
+        void load(const std::string& rules_file, const std::string& rules_lim_file){
+            sdsl::load_from_file(m_symbols, rules_file);
+            sdsl::bit_vector r_lim;
+            sdsl::load_from_file(r_lim, rules_lim_file);
+
+            size_type n_rules = sdsl::util::cnt_one_bits(r_lim);
+            m_offsets = sdsl::int_vector<>(n_rules + 1, 0, sdsl::bits::hi(m_symbols.size()) + 1);
+            size_type id = 1;
+            for (size_type i = 0; i < r_lim.size(); ++i) {
+                if(r_lim[i]) m_offsets[id++] = i + 1;
+            }
+        }
+
+        //number of rules
+        [[nodiscard]] inline size_type size() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+
+        //number of symbols in all the right-hand sides
+        [[nodiscard]] inline size_type n_symbols() const { return m_symbols.size(); }
+
+        [[nodiscard]] inline size_type rhs_len(const size_type& id) const { return m_offsets[id + 1] - m_offsets[id]; }
+
+        inline rhs_t operator[](const size_type& id) const {
+            return {&m_symbols, m_offsets[id], m_offsets[id + 1]};
+        }
+
+        [[nodiscard]] const sdsl::int_vector<>& symbols() const { return m_symbols; }
+
+        void clear(){
+            sdsl::util::clear(m_symbols);
+            sdsl::util::clear(m_offsets);
+        }
+    };
+
     struct path_element{
         uint64_t preorder;
         uint64_t node;
@@ -64,15 +138,13 @@ namespace utils {
     };
 
     void build_nav_cuts_rules(lpg_build::plain_grammar_t& ,cuts_rules& );
-    nav_grammar build_nav_grammar(const lpg_build::plain_grammar_t&);
-    void sort_suffixes(const std::string& i_file, std::vector<sfx> &grammar_sfx);
+    template<class fetch_t, class kr_t> void sort_suffixes(std::vector<sfx> &grammar_sfx, const fetch_t& fetch, const kr_t& prefix_kr, uint64_t kr_base, size_t n_threads);
     template <typename F>void dfs_posorder(const size_type& , nav_grammar&, const F&);
     template <typename F>void dfs(const size_type& , nav_grammar&, const F&);
     template <typename F>void dfs_2v(const size_type& , nav_grammar&, const F&);
     template<typename O>void pretty_printer_v( O&bv, const std::string &header);
     template<typename O>void pretty_printer_bv( O&bv, const std::string &header);
     size_type readFile(const std::string& i_file,std::string &text);
-    void compute_grammar_sfx(nav_grammar &,lpg_build::plain_grammar_t&,const dfuds_tree&,lenght_rules&,std::vector<sfx>&);
     void compute_grid_points(const std::vector<sfx>&, std::vector<grid_point>&);
 
 
@@ -110,45 +182,6 @@ namespace utils {
                           std::istreambuf_iterator<char>(f2.rdbuf()));
     }
 
-    nav_grammar build_nav_grammar(const lpg_build::plain_grammar_t& G, size_type& S){
-        ivb_t rules_buff(G.rules_file);
-        bvb_t rules_lim_buff(G.rules_lim_file);
-        size_type id = 0;
-        size_type zero_count = 0;
-        nav_grammar NG;
-        std::vector<size_type> right_hand;
-
-        for (size_t i = 0; i < rules_lim_buff.size(); ++i) {
-            right_hand.push_back(rules_buff[i]);
-            if(rules_buff[i] == 0) {
-                zero_count++;
-//                std::cout<<"right hand"<<std::endl;
-//                for (const auto &item : right_hand) {
-//                    std::cout<<item<<" ";
-//                }
-//                std::cout<<std::endl;
-            }
-            if(rules_lim_buff[i] == 1){
-                NG[id] = right_hand;
-                right_hand.clear();
-                id++;
-            }
-        }
-        S = NG[id-1][0];
-        if(zero_count != 2) std::cout<<"ERROR 0 APPEARS MORE THAN 1 TIME IN THE GRAMMAR:"<<zero_count<<std::endl;
-//        std::cout<<"plain-grammar"<<std::endl;
-//        for (const auto &item : NG) {
-//            std::cout<<item.first<<"->";
-//            for (const auto &second : item.second) {
-//                std::cout<<second<<" ";
-//            }
-//            std::cout<<std::endl;
-//        }
-
-
-        return NG;
-    }
-
     void build_nav_cuts_rules(lpg_build::plain_grammar_t& G,cuts_rules& cuts){
         ivb_t breaks_buff(G.lvl_breaks_file);
         size_type i = 0;
@@ -163,211 +196,306 @@ namespace utils {
         }
     }
 
-    void compute_grammar_sfx(
-                             nav_grammar & grammar,
-                             lpg_build::plain_grammar_t& G,
-                             const dfuds_tree& m_tree,
-                             lenght_rules& len,
-                             std::vector<sfx>& grammar_sfx,
-                             const size_t & init_r
-                             ){
-
-        cuts_rules cuts;
-        build_nav_cuts_rules(G,cuts); //read the cuts of each rule
-        uint64_t preorder = 0;
-        std::set<uint64_t> mark;
-
-
-        dfs(init_r,grammar,[&G,&grammar,&m_tree, &mark,&preorder,&cuts,&len,&grammar_sfx](const size_type& id){
-
-            auto it_rule = grammar.find(id);
-            ++preorder;
-            if(mark.find(id) != mark.end())
-                return false; // stop descending if it is second mention
-            mark.insert(id);
-
-            if(G.sym_map.find(id) != G.sym_map.end()) return false;
-
-            size_type n_children = it_rule->second.size();
-            if(n_children <= 0) return false; // if leaf break and stop descending
-            auto node = m_tree[preorder];//preorder select
-            for(size_type j = 1; j < n_children; ++j){
-                auto _child = m_tree.child(node, j + 1);
-                sfx s(
-
-                        len[it_rule->second[j]].first, //rule off
-                        len[it_rule->first].second - len[it_rule->second[j-1]].second,// len of parent - len of prev-sibling
-                        it_rule->second[j-1], //prev-sibling id
-                        m_tree.pre_order(_child),//preorder
-                        cuts[it_rule->first][j-1]//cut level
-                    );
-                grammar_sfx.push_back(s);
+    //sort the grammar suffixes in lexicographical order of their expansions (a suffix that is a
+    // prefix of another goes first). fetch(off, len, dest) copies text[off..off+len-1] into dest,
+    // so the expansions can be decoded straight from the grammar, without a suffix array of the
+    // text. The suffixes are sorted by rounds of a multikey radix sort: every round refines the
+    // groups of suffixes sharing a prefix with the next chunk of their expansions, and every
+    // group is an independent task of the thread pool.
+    // The radix rounds stop at max_depth symbols, so they decode at most max_depth symbols of
+    // every suffix. The groups still tied at that depth are sorted by comparisons, where
+    // prefix_kr(i) returns the Karp-Rabin fingerprint in base kr_base of text[0..i-1] and the
+    // longest common prefix of two suffixes is found by an exponential search over the
+    // fingerprints. A comparison then costs O(log lcp) fingerprints, not O(lcp) symbols
+    template<class fetch_t, class kr_t>
+    void sort_suffixes(std::vector<sfx> &grammar_sfx, const fetch_t& fetch, const kr_t& prefix_kr, uint64_t kr_base, size_t n_threads) {
+
+        size_t n = grammar_sfx.size();
+        if(n < 2) return;
+
+        //max. number of bytes of the chunks decoded for one group
+        const size_t group_budget = 64UL<<20UL;
+        const size_t max_chunk = 4096;
+        const size_t max_depth = 1024;
+
+        thread_pool pool(n_threads);
+
+        //first round: the first 8 symbols of every suffix, packed so that comparing
+        // the integers is equivalent to comparing the strings
+        struct sfx_key{
+            uint64_t key;
+            size_t   idx;
+            uint8_t  len;
+        };
+        std::vector<sfx_key> keys(n);
+        const size_t block = 1UL<<16UL;
+        pool.parallel_for((n + block - 1)/block, [&](size_t b, size_t){
+            uint8_t chunk[8];
+            for(size_t i=b*block, end=std::min(n, (b+1)*block); i<end; i++){
+                auto const& s = grammar_sfx[i];
+                uint8_t len = std::min<size_t>(8, s.len);
+                if(len > 0) fetch(s.off, len, chunk);
+                uint64_t key = 0;
+                for(size_t j=0;j<8;j++){
+                    key = (key<<8UL) | (j < len ? chunk[j] : 0);
+                }
+                keys[i] = {key, i, len};
             }
-            return true;
         });
-#ifdef DEGUG_INFO
-        std::cout<<"compute_grammar_sfx\n";
-#endif
-    }
 
-    void sort_suffixes(const std::string& i_file, std::vector<sfx> &grammar_sfx) {
-        std::string text; char c = 1;
-        readFile(i_file, text);
-        text =  text + c;
-#ifdef DEBUG_PRINT
-        std::cout<<"T\n"<<text<<std::endl;
-#endif
-        sdsl::int_vector<> SA;
-        sdsl::int_vector<> SA_1;
-        sdsl::lcp_bitcompressed<> LCP;
-        sdsl::rmq_succinct_sada<> rmq;
-
-        sdsl::cache_config config(false, ".", "cache-normal");
-        sdsl::store_to_file((const char *)text.c_str(), sdsl::conf::KEY_TEXT);
-        sdsl::register_cache_file(sdsl::conf::KEY_TEXT, config);
-        sdsl::construct(LCP, sdsl::conf::KEY_TEXT, config, 1);
-        if (sdsl::cache_file_exists(sdsl::conf::KEY_SA, config)) {
-            sdsl::load_from_cache(SA, sdsl::conf::KEY_SA, config);
-            SA_1 = SA;
-            for (uint32_t i = 0; i < SA.size(); i++) {
-                SA_1[SA[i]] = i;
+        parallel_sort(keys.begin(), keys.end(), [](const sfx_key& a, const sfx_key& b){
+            return a.key < b.key || (a.key == b.key && a.len < b.len);
+        }, pool);
+
+        {
+            std::vector<sfx> tmp(n);
+            pool.parallel_for((n + block - 1)/block, [&](size_t b, size_t){
+                for(size_t i=b*block, end=std::min(n, (b+1)*block); i<end; i++){
+                    tmp[i] = grammar_sfx[keys[i].idx];
+                }
+            });
+            grammar_sfx.swap(tmp);
+        }
+
+        //order of two suffixes sharing their first depth symbols, compared symbol by symbol
+        auto cmp_plain = [&](const sfx& sa, const sfx& sb, size_t depth){
+            uint8_t ba[256], bb[256];
+            size_t m = std::min(sa.len, sb.len);
+            for(size_t d = depth; d < m; d += sizeof(ba)){
+                size_t len = std::min(sizeof(ba), m - d);
+                fetch(sa.off + d, len, ba);
+                fetch(sb.off + d, len, bb);
+                int r = memcmp(ba, bb, len);
+                if(r != 0) return r < 0;
             }
-#ifdef DEBUG_PRINT
-            std::cout<<"SA"<<std::endl;
-            for (const auto &item : SA) {
-                std::cout<<item<<" ";
+            return sa.len < sb.len;
+        };
+
+        //sort grammar_sfx[start..end-1], whose suffixes share their first depth symbols, with
+        // the fingerprints of their expansions. The symbols after the LCP found with the
+        // fingerprints are decoded to confirm it: if they are equal, the fingerprints collided
+        // and the suffixes are compared symbol by symbol. A group with at least par_group
+        // suffixes uses all the workers of the pool, so it must be sorted outside of the pool
+        const size_t par_group = 1UL<<16UL;
+        auto kr_sort = [&](size_t start, size_t end, size_t depth, bool par){
+            size_t g_size = end - start;
+            std::vector<uint64_t> d_kr(g_size);//fingerprint of text[0..off+depth-1]
+            std::vector<uint32_t> order(g_size);
+            auto init = [&](size_t i){
+                d_kr[i] = prefix_kr(grammar_sfx[start+i].off + depth);
+                order[i] = i;
+            };
+            if(par){
+                pool.parallel_for((g_size + block - 1)/block, [&](size_t blk, size_t){
+                    for(size_t i=blk*block, e=std::min(g_size, (blk+1)*block); i<e; i++) init(i);
+                });
+            }else{
+                for(size_t i=0;i<g_size;i++) init(i);
+            }
+
+            auto cmp_kr = [&](const uint32_t& a, const uint32_t& b){
+                auto const& sa = grammar_sfx[start+a];
+                auto const& sb = grammar_sfx[start+b];
+                size_t m = std::min(sa.len, sb.len) - depth;
+                //the next l symbols of both suffixes are equal
+                auto match = [&](size_t l){
+                    uint64_t b_pow = kr::pow(l, kr_base);
+                    return kr::sub(prefix_kr(sa.off + depth + l), kr::mul(d_kr[a], b_pow)) ==
+                           kr::sub(prefix_kr(sb.off + depth + l), kr::mul(d_kr[b], b_pow));
+                };
+                size_t lo = 0, hi = 1;
+                while(hi <= m && match(hi)){
+                    lo = hi;
+                    hi *= 2;
+                }
+                hi = std::min(hi, m + 1);
+                while(hi - lo > 1){
+                    size_t mid = lo + (hi - lo)/2;
+                    if(match(mid)) lo = mid; else hi = mid;
+                }
+                if(lo == m) return sa.len < sb.len;
+                uint8_t ca, cb;
+                fetch(sa.off + depth + lo, 1, &ca);
+                fetch(sb.off + depth + lo, 1, &cb);
+                if(ca == cb) return cmp_plain(sa, sb, depth);
+                return ca < cb;
+            };
+            if(par){
+                parallel_sort(order.begin(), order.end(), cmp_kr, pool);
+            }else{
+                std::sort(order.begin(), order.end(), cmp_kr);
+            }
+
+            std::vector<sfx> tmp(g_size);
+            for(size_t i=0;i<g_size;i++) tmp[i] = grammar_sfx[start + order[i]];
+            std::copy(tmp.begin(), tmp.end(), grammar_sfx.begin() + (long)start);
+        };
+        //groups of at least par_group suffixes left for kr_sort after the refinement
+        std::vector<std::pair<size_t, size_t>> large_groups;
+        std::mutex large_mtx;
+
+        //refine grammar_sfx[start..end-1], whose suffixes share their first depth symbols
+        std::function<void(size_t, size_t, size_t)> refine;
+        refine = [&](size_t start, size_t end, size_t depth){
+            if(depth >= max_depth){
+                if(end - start >= par_group){
+                    std::lock_guard<std::mutex> lck(large_mtx);
+                    large_groups.emplace_back(start, end);
+                }else{
+                    kr_sort(start, end, depth, false);
+                }
+                return;
             }
-            std::cout<<std::endl;
-            std::cout<<"SA_1"<<std::endl;
-            for (const auto &item : SA_1) {
-                std::cout<<item<<" ";
+            size_t g_size = end - start;
+            size_t chunk = 8;
+            while(chunk < max_chunk && (chunk*2)*g_size <= group_budget) chunk*=2;
+            chunk = std::min(chunk, max_depth - depth);
+
+            std::vector<uint8_t> buffer(g_size*chunk);
+            std::vector<uint32_t> c_len(g_size);
+            std::vector<uint32_t> order(g_size);
+            for(size_t i=0;i<g_size;i++){
+                auto const& s = grammar_sfx[start+i];
+                c_len[i] = std::min<size_t>(chunk, s.len - depth);
+                if(c_len[i] > 0) fetch(s.off + depth, c_len[i], buffer.data() + i*chunk);
+                order[i] = i;
+            }
+
+            auto cmp_chunks = [&](const uint32_t& a, const uint32_t& b){
+                int r = memcmp(buffer.data() + a*chunk, buffer.data() + b*chunk, std::min(c_len[a], c_len[b]));
+                if(r != 0) return r;
+                return int(c_len[a] > c_len[b]) - int(c_len[a] < c_len[b]);
+            };
+            std::sort(order.begin(), order.end(), [&](const uint32_t& a, const uint32_t& b){
+                return cmp_chunks(a, b) < 0;
+            });
+
+            std::vector<sfx> tmp(g_size);
+            for(size_t i=0;i<g_size;i++) tmp[i] = grammar_sfx[start + order[i]];
+            std::copy(tmp.begin(), tmp.end(), grammar_sfx.begin() + (long)start);
+
+            //the suffixes ending inside the chunk are already in their final position
+            size_t i=0;
+            while(i < g_size){
+                size_t j = i+1;
+                while(j < g_size && cmp_chunks(order[i], order[j]) == 0) j++;
+                if(j - i > 1 && c_len[order[i]] == chunk){
+                    size_t g_start = start + i, g_end = start + j;
+                    pool.submit([&refine, g_start, g_end, depth, chunk](size_t){
+                        refine(g_start, g_end, depth + chunk);
+                    });
+                }
+                i = j;
             }
-            std::cout<<std::endl;
-#endif
+        };
 
-            sdsl::util::clear(SA);
+        size_t i=0;
+        while(i < n){
+            size_t j = i+1;
+            while(j < n && keys[j].key == keys[i].key && keys[j].len == keys[i].len) j++;
+            if(j - i > 1 && keys[i].len == 8){
+                pool.submit([&refine, i, j](size_t){ refine(i, j, 8); });
+            }
+            i = j;
         }
+        pool.wait();
 
-        // Builds the RMQ Support.
-        rmq = sdsl::rmq_succinct_sada<>(&LCP);
-        sdsl::remove(sdsl::cache_file_name(sdsl::conf::KEY_SA, config));
-        sdsl::remove(sdsl::cache_file_name(sdsl::conf::KEY_TEXT, config));
-        sdsl::remove(sdsl::cache_file_name(sdsl::conf::KEY_LCP, config));
-#ifdef DEBUG_PRINT
-        std::cout<<"LCP"<<std::endl;
-        for (const auto &item : LCP) {
-            std::cout<<item<<" ";
+        //the groups tied at max_depth are disjoint, so sorting them one after the other with
+        // all the workers gives the same result as sorting them in separate tasks
+        for(auto const& g : large_groups){
+            kr_sort(g.first, g.second, max_depth, true);
         }
-        std::cout<<std::endl;
-#endif
-#ifdef DEBUG_INFO
-        std::cout<<"...sorting_suffixes\n";
-#endif
-
-        std::sort(grammar_sfx.begin(), grammar_sfx.end(),
-                  [&SA_1,&LCP,&rmq](const sfx &lhs, const sfx &rhs) {
-                      if (SA_1[lhs.off] == SA_1[rhs.off]) {
-                          return lhs.len < rhs.len;
-                      }
-                      size_type _rmq;
-                      if (SA_1[lhs.off] < SA_1[rhs.off]) {
-                          _rmq = rmq(SA_1[lhs.off] + 1, SA_1[rhs.off]);
-                      } else {
-                          _rmq = rmq(SA_1[rhs.off] + 1, SA_1[lhs.off]);
-                      }
-                      if (lhs.len <= LCP[_rmq] && rhs.len <= LCP[_rmq]) {
-                          return lhs.len < rhs.len;
-                      } else if (lhs.len <= LCP[_rmq]) {
-                          return true;
-                      } else if (rhs.len <= LCP[_rmq]) {
-                          return false;
-                      } else {
-                          /***
-                           * Neither is a prefix of the other. Use ISA to find
-                           *the order
-                           ***/
-                          return SA_1[lhs.off] < SA_1[rhs.off];
-                      }
-                  });
-#ifdef DEBUG_INFO
-        std::cout<<"sort_suffixes\n";
-#endif
     }
 
 
 
+    //The traversals of the grammar use an explicit stack of (rule, next child) frames, so
+    // their depth is not bounded by the size of the call stack
+
     template <typename F>
     void dfs_posorder(const size_type& id, nav_grammar& G, const F& f)  {
-        std::function< void (const size_type& )> dfs_aux;
-        dfs_aux = [&dfs_aux,& G,& f](const size_type& id){
-
-            auto it = G.find(id);
-            if(it != G.end()){
-                // non - terminal case
-                for (const auto &item : it->second) dfs_aux(item);
+        std::vector<std::pair<size_type, size_type>> stack;
+        stack.emplace_back(id, 0);
+        while(!stack.empty()){
+            auto& top = stack.back();
+            if(top.first < G.size() && top.second < G.rhs_len(top.first)){
+                size_type child = G[top.first][top.second++];
+                stack.emplace_back(child, 0);
+            }else{
+                size_type sym = top.first;
+                stack.pop_back();
+                f(sym);
             }
-            f(id);
-        };
-        dfs_aux(id);
+        }
     }
 
 
     template <typename F>
     void dfs(const size_type& id, nav_grammar& G, const F& f)  {
-        std::function< void (const size_type& )> dfs_aux;
-        dfs_aux = [&dfs_aux,& G,& f](const size_type& id){
-            if(!f(id)) return ;
-            auto it = G.find(id);
-            if(it != G.end()){
-                // non - terminal case
-                for (const auto &item : it->second) dfs_aux(item);
+        std::vector<std::pair<size_type, size_type>> stack;
+        if(f(id)) stack.emplace_back(id, 0);
+        while(!stack.empty()){
+            auto& top = stack.back();
+            if(top.first < G.size() && top.second < G.rhs_len(top.first)){
+                size_type child = G[top.first][top.second++];
+                if(f(child)) stack.emplace_back(child, 0);
+            }else{
+                stack.pop_back();
             }
-        };
-        dfs_aux(id);
+        }
     }
 
     template <typename F>
     void dfs_2v(const size_type& id, nav_grammar& G, const F& f)  {
-        std::function< void (const size_type& )> dfs_aux;
-        dfs_aux = [&dfs_aux,& G,& f](const size_type& id){
-            if(!f(id,1)) return ;
-            auto it = G.find(id);
-            if(it != G.end()){
-                // non - terminal case
-                for (const auto &item : it->second){
-                    dfs_aux(item);
-                }
+        std::vector<std::pair<size_type, size_type>> stack;
+        if(f(id,1)) stack.emplace_back(id, 0);
+        while(!stack.empty()){
+            auto& top = stack.back();
+            if(top.first < G.size() && top.second < G.rhs_len(top.first)){
+                size_type child = G[top.first][top.second++];
+                if(f(child,1)) stack.emplace_back(child, 0);
+            }else{
+                size_type sym = top.first;
+                stack.pop_back();
+                f(sym,0);
             }
-            f(id,0);
-        };
-
-        dfs_aux(id);
-
+        }
     }
 
+    //same as above, but the run-length rules X -> Y^l are visited as X -> Y Y (the second
+    // copy stands for the remaining l-1 copies)
     template <typename F>
     void dfs_2v(const size_type& id, nav_grammar& G, sdsl::int_vector_buffer<1> &is_rules_len, const F& f)  {
-        std::function< void (const size_type& )> dfs_aux;
-        dfs_aux = [&dfs_aux,& G,& f,&is_rules_len](const size_type& id){
-            if(!f(id,1)) return ;
-            auto it = G.find(id);
-            if(it != G.end()){
-                if(is_rules_len[id] && it->second.size() == 2 ){
-                    dfs_aux(it->second[0]);
-                    dfs_aux(it->second[0]);
-//                    dfs_aux(it->second[0],it->second[1] - 1);
-                }else{
-                    // non - terminal case
-                    for (const auto &item : it->second){
-                        dfs_aux(item);
-                    }
-                }
+        struct frame{
+            size_type id;
+            size_type next;
+            size_type n_children;
+            bool      rl;
+        };
+        std::vector<frame> stack;
+        auto push = [&](const size_type& sym){
+            if(!f(sym,1)) return;
+            if(sym >= G.size()){
+                f(sym,0);
+                return;
             }
-            f(id,0);
+            bool rl = is_rules_len[sym] && G.rhs_len(sym) == 2;
+            stack.push_back({sym, 0, G.rhs_len(sym), rl});
         };
 
-        dfs_aux(id);
-
+        push(id);
+        while(!stack.empty()){
+            auto& top = stack.back();
+            if(top.next < top.n_children){
+                size_type child = G[top.id][top.rl ? 0 : top.next];
+                top.next++;
+                push(child);
+            }else{
+                size_type sym = top.id;
+                stack.pop_back();
+                f(sym,0);
+            }
+        }
     }
 
 //    size_type compute_rule_offsets( const plain_grammar& _Gr,utils::nav_grammar& grammar, const size_t& text_length,
@@ -4,9 +4,14 @@
 
 #include "lpg/lpg_build.hpp"
 #include <cmath>
+#include <filesystem>
+#include <sstream>
+#include <chrono>
 #include <sdsl/select_support_mcl.hpp>
 #include "cdt/parallel_string_sort.hpp"
+#include "cdt/parallel_sort.hpp"
 #include "lpg/repair_algo.hpp"
+#include "lpg/checkpoint.hpp"
 
 
 //pthread_mutex_t thread_mutex=PTHREAD_MUTEX_INITIALIZER;
@@ -93,7 +98,8 @@ void lpg_build::check_plain_grammar(plain_grammar_t& p_gram, std::string& uncomp
 }
 
 void lpg_build::compute_LPG(std::string &i_file, std::string &p_gram_file, size_t n_threads, sdsl::cache_config &config,
-                            size_t hbuff_size, alpha_t &alphabet) {
+                            size_t hbuff_size, alpha_t &alphabet, size_t mem_budget, build_checkpoint* ckpt,
+                            bool shared_dict) {
 
     std::cout<<"  Generating the LMS-based locally consistent grammar:    "<<std::endl;
 
@@ -101,105 +107,256 @@ void lpg_build::compute_LPG(std::string &i_file, std::string &p_gram_file, size_
     std::string rules_len_file = sdsl::cache_file_name("rules_len", config);
     std::string lvl_breaks_file = sdsl::cache_file_name("lvl_breaks", config);
     std::string is_rl_file = sdsl::cache_file_name("is_rl", config);
+    std::string state_file = sdsl::cache_file_name("gram_state", config);
 
     plain_grammar_t p_gram(rules_file, rules_len_file, is_rl_file, lvl_breaks_file);
-    p_gram.sigma = alphabet.size();
 
-    // given an index i in symbol_desc
-    //0 symbol i is in alphabet is unique
-    //1 symbol i is repeated
-    //>2 symbol i is sep symbol
-    sdsl::int_vector<2> symbol_desc(alphabet.back().first+1,0);
+    //the workers are created once and reused by the phases of all the rounds and by the
+    // passes that post-process the grammar
+    thread_pool pool(n_threads);
 
-    for(auto & sym : alphabet){
-        p_gram.sym_map[sym.first] = sym.first;
-        symbol_desc[sym.first] = sym.second > 1;
-    }
-    p_gram.max_tsym = alphabet.back().first;
-    p_gram.r = p_gram.max_tsym + 1;
-    symbol_desc[alphabet[0].first]+=2;
-
-    ivb_t rules(p_gram.rules_file, std::ios::out, BUFFER_SIZE);
-    bvb_t rules_lim(p_gram.rules_lim_file, std::ios::out);
-    for(size_t i=0;i<p_gram.r; i++){
-        rules.push_back(i);
-        rules_lim.push_back(true);
-    }
-    for(auto const& pair : p_gram.sym_map){
-        rules[pair.first] = pair.first;
-    }
+    //every round writes its parse, its symbol descriptions and the state of the grammar to
+    // its own files, so the checkpoint of a round remains valid while the next one runs
+    auto round_file = [&](const std::string& key, size_t round){
+        return sdsl::cache_file_name(key+"_"+std::to_string(round), config);
+    };
+    auto round_stage = [](size_t round){
+        return "lms_round_"+std::to_string(round);
+    };
+    auto remove_round_files = [&](size_t round){
+        for(auto const& key : {"lms_parse", "symbol_desc", "gram_state"}){
+            std::string file = round_file(key, round);
+            if(std::filesystem::exists(file)) remove(file.c_str());
+        }
+    };
 
-    std::string output_file = sdsl::cache_file_name("tmp_output", config);
-    std::string tmp_i_file = sdsl::cache_file_name("tmp_input", config);
-
-    size_t iter=1;
-    size_t rem_phrases;
-
-    std::cout<<"    Parsing round "<<iter++<<std::endl;
-    rem_phrases = compute_LPG_int<uint8_t>(i_file, tmp_i_file,
-                                           n_threads, hbuff_size,
-                                           p_gram, rules, rules_lim,
-                                           symbol_desc, config);
-
-    while (rem_phrases > 0) {
-        std::cout<<"    Parsing round "<<iter++<<std::endl;
-        rem_phrases = compute_LPG_int<size_t>(tmp_i_file, output_file,
-                                              n_threads, hbuff_size,
-                                              p_gram, rules, rules_lim,
-                                              symbol_desc, config);
-        remove(tmp_i_file.c_str());
-        rename(output_file.c_str(), tmp_i_file.c_str());
+    //the stages after the parsing rounds rewrite the grammar files in place, so their
+    // checkpoint is a copy of those files
+    auto snapshot = [&](const std::string& stage){
+        if(ckpt==nullptr) return;
+        build_checkpoint::file_list files;
+        for(auto const& file : {p_gram.rules_file, p_gram.rules_lim_file, p_gram.is_rl_file}){
+            std::filesystem::copy_file(file, file+"."+stage, std::filesystem::copy_options::overwrite_existing);
+            files.emplace_back(file+"."+stage, build_checkpoint::WHOLE);
+        }
+        std::string st_file = state_file+"."+stage;
+        p_gram.save_to_file(st_file);
+        files.emplace_back(st_file, build_checkpoint::WHOLE);
+        ckpt->commit(stage, files);
+    };
+    auto remove_snapshot = [&](const std::string& stage){
+        if(ckpt==nullptr) return;
+        ckpt->drop(stage);
+        for(auto const& file : {p_gram.rules_file, p_gram.rules_lim_file, p_gram.is_rl_file, state_file}){
+            remove((file+"."+stage).c_str());
+        }
+    };
+
+    //find the most advanced stage that a previous (interrupted) construction left
+    std::string post_stage;
+    size_t round=0;
+    if(ckpt!=nullptr){
+        for(auto const& stage : {"simplify", "run_length"}){
+            if(ckpt->completed(stage)){
+                post_stage = stage;
+                break;
+            }
+        }
+        if(post_stage.empty()){
+            auto stages = ckpt->stages();
+            for(auto it=stages.rbegin();it!=stages.rend();++it){
+                if(it->rfind("lms_round_", 0)==0 && ckpt->completed(*it)){
+                    round = std::stoul(it->substr(10));
+                    break;
+                }
+            }
+        }
     }
-    sdsl::util::clear(symbol_desc);
-
-    {//put the compressed string at end
-        std::ifstream c_vec(tmp_i_file, std::ifstream::binary);
-        c_vec.seekg(0, std::ifstream::end);
-        size_t tot_bytes = c_vec.tellg();
-        c_vec.seekg(0, std::ifstream::beg);
-        auto *buffer = reinterpret_cast<size_t*>(malloc(BUFFER_SIZE));
-        size_t read_bytes =0;
-        p_gram.c=0;
-        while(read_bytes<tot_bytes){
-            c_vec.read((char *) buffer, BUFFER_SIZE);
-            read_bytes+=c_vec.gcount();
-            assert((c_vec.gcount() % sizeof(size_t))==0);
-            for(size_t i=0;i<c_vec.gcount()/sizeof(size_t);i++){
-                rules.push_back(buffer[i]);
+
+    if(!post_stage.empty()){
+        std::cout<<"    Resuming after the stage \""<<post_stage<<"\""<<std::endl;
+        std::string st_file = state_file+"."+post_stage;
+        p_gram.load_from_file(st_file);
+        for(auto const& file : {p_gram.rules_file, p_gram.rules_lim_file, p_gram.is_rl_file}){
+            std::filesystem::copy_file(file+"."+post_stage, file, std::filesystem::copy_options::overwrite_existing);
+        }
+    }else{
+        // given an index i in symbol_desc
+        //0 symbol i is in alphabet is unique
+        //1 symbol i is repeated
+        //>2 symbol i is sep symbol
+        sdsl::int_vector<2> symbol_desc;
+
+        size_t rem_phrases=1, psize=0;
+        bool in_memory=false;
+        sdsl::int_vector<> mem_parse, mem_output;
+
+        if(round>0){
+            std::string stage = round_stage(round);
+            std::istringstream info(ckpt->info(stage));
+            info>>rem_phrases>>psize>>in_memory;
+
+            std::string st_file = round_file("gram_state", round);
+            p_gram.load_from_file(st_file);
+            sdsl::load_from_file(symbol_desc, round_file("symbol_desc", round));
+            if(in_memory) sdsl::load_from_file(mem_parse, round_file("lms_parse", round));
+
+            //a round that was interrupted could have appended rules to the files
+            ckpt->restore_lengths(stage);
+            std::cout<<"    Resuming after the parsing round "<<round<<std::endl;
+        }else{
+            p_gram.sigma = alphabet.size();
+            symbol_desc = sdsl::int_vector<2>(alphabet.back().first+1,0);
+
+            for(auto & sym : alphabet){
+                p_gram.sym_map[sym.first] = sym.first;
+                symbol_desc[sym.first] = sym.second > 1;
+                psize+=sym.second;
+            }
+            p_gram.max_tsym = alphabet.back().first;
+            p_gram.r = p_gram.max_tsym + 1;
+            symbol_desc[alphabet[0].first]+=2;
+        }
+
+        ivb_t rules(p_gram.rules_file, round>0 ? std::ios::in : std::ios::out, BUFFER_SIZE);
+        bvb_t rules_lim(p_gram.rules_lim_file, round>0 ? std::ios::in : std::ios::out);
+        if(round==0){
+            for(size_t i=0;i<p_gram.r; i++){
+                rules.push_back(i);
+                rules_lim.push_back(true);
+            }
+            for(auto const& pair : p_gram.sym_map){
+                rules[pair.first] = pair.first;
+            }
+        }
+
+        phase_timings tot_timings;
+
+        //once the parse fits in the memory budget, the rounds keep it in RAM. The threads
+        // write their parse chunks as size_t cells, so a round whose input has n symbols
+        // needs at most n*sizeof(size_t) bytes for its output. A budget of 0 keeps every
+        // round on disk
+        auto fits_in_memory = [&](size_t n_syms){
+            return mem_budget>0 && n_syms*sizeof(size_t) <= mem_budget;
+        };
+
+        while (rem_phrases > 0) {
+            bool out_memory = in_memory || fits_in_memory(psize);
+            if(out_memory && !in_memory){
+                std::cout<<"    The parse fits in the memory budget, the next rounds will run in RAM"<<std::endl;
+            }
+            std::string o_file = round_file("lms_parse", round+1);
+            std::cout<<"    Parsing round "<<round+1<<std::endl;
+            if(round==0){
+                rem_phrases = compute_LPG_int<uint8_t>(i_file, o_file, nullptr, out_memory ? &mem_output : nullptr,
+                                                       pool, hbuff_size, shared_dict,
+                                                       p_gram, rules, rules_lim,
+                                                       symbol_desc, config, tot_timings, psize);
+            }else{
+                std::string in_file = round_file("lms_parse", round);
+                rem_phrases = compute_LPG_int<size_t>(in_file, o_file,
+                                                      in_memory ? &mem_parse : nullptr,
+                                                      out_memory ? &mem_output : nullptr,
+                                                      pool, hbuff_size, shared_dict,
+                                                      p_gram, rules, rules_lim,
+                                                      symbol_desc, config, tot_timings, psize);
+            }
+            if(out_memory){
+                mem_parse.swap(mem_output);
+                sdsl::util::clear(mem_output);
+                in_memory = true;
+            }
+            round++;
+
+            if(ckpt!=nullptr){
+                rules.close();
+                rules_lim.close();
+
+                std::string st_file = round_file("gram_state", round);
+                std::string desc_file = round_file("symbol_desc", round);
+                p_gram.save_to_file(st_file);
+                sdsl::store_to_file(symbol_desc, desc_file);
+                if(in_memory) sdsl::store_to_file(mem_parse, o_file);
+
+                ckpt->commit(round_stage(round), {{p_gram.rules_file,      build_checkpoint::IV_DYN},
+                                                  {p_gram.rules_lim_file,  build_checkpoint::IV_FIXED},
+                                                  {o_file,                 build_checkpoint::WHOLE},
+                                                  {desc_file,              build_checkpoint::WHOLE},
+                                                  {st_file,                build_checkpoint::WHOLE}},
+                             std::to_string(rem_phrases)+" "+std::to_string(psize)+" "+std::to_string(in_memory));
+
+                if(round>1){
+                    ckpt->drop(round_stage(round-1));
+                    remove_round_files(round-1);
+                }
+                rules = ivb_t(p_gram.rules_file, std::ios::in, BUFFER_SIZE);
+                rules_lim = bvb_t(p_gram.rules_lim_file, std::ios::in);
+            }else if(round>1){
+                remove_round_files(round-1);
+            }
+        }
+        sdsl::util::clear(symbol_desc);
+
+        std::cout<<"    Time per phase in all the rounds (microsec):"<<std::endl;
+        tot_timings.print("      ");
+
+        {//put the compressed string at end
+            std::string c_file = round_file("lms_parse", round);
+            packed_file_stream c_vec = in_memory ? packed_file_stream(mem_parse) : packed_file_stream(c_file, BUFFER_SIZE);
+            p_gram.c=0;
+            for(size_t i=0;i<c_vec.size();i++){
+                rules.push_back(c_vec.read(i));
                 rules_lim.push_back(false);
                 p_gram.c++;
             }
+            rules_lim[rules_lim.size() - 1] = true;
+            p_gram.r++;
+            c_vec.close();
+            sdsl::util::clear(mem_parse);
         }
-        rules_lim[rules_lim.size() - 1] = true;
-        p_gram.r++;
-        c_vec.close();
-        free(buffer);
-    }
-    p_gram.g = rules.size();
+        p_gram.g = rules.size();
 
-    rules.close();
-    rules_lim.close();
+        rules.close();
+        rules_lim.close();
 
-    std::cout<<"  Resulting locally consistent grammar:    "<<std::endl;
-    std::cout<<"    Number of terimnals:    "<<(int)p_gram.sigma<<std::endl;
-    std::cout<<"    Number of nonterminals: "<<p_gram.r-p_gram.sigma<<std::endl;
-    std::cout<<"    Grammar size:           "<<p_gram.g<<std::endl;
-    std::cout<<"    Compressed string:      "<<p_gram.c<<std::endl;
+        std::cout<<"  Resulting locally consistent grammar:    "<<std::endl;
+        std::cout<<"    Number of terimnals:    "<<(int)p_gram.sigma<<std::endl;
+        std::cout<<"    Number of nonterminals: "<<p_gram.r-p_gram.sigma<<std::endl;
+        std::cout<<"    Grammar size:           "<<p_gram.g<<std::endl;
+        std::cout<<"    Compressed string:      "<<p_gram.c<<std::endl;
 
-    run_length_compress(p_gram, config);
-//    repair(p_gram, config);
+        run_length_compress(p_gram, pool);
+//        repair(p_gram, config);
 
-    bv_t rem_nts = mark_nonterminals(p_gram);
-    bv_t::rank_1_type rem_nts_rs(&rem_nts);
+        snapshot("run_length");
+        if(ckpt!=nullptr) ckpt->drop(round_stage(round));
+        remove_round_files(round);
+    }
+
+    if(post_stage!="simplify"){
+        bv_t rem_nts = mark_nonterminals(p_gram, pool);
+        bv_t::rank_1_type rem_nts_rs(&rem_nts);
 
-    simplify_grammar(p_gram, rem_nts, rem_nts_rs);
+        simplify_grammar(p_gram, rem_nts, rem_nts_rs, pool);
 
-    sdsl::util::clear(rem_nts_rs);
-    sdsl::util::clear(rem_nts);
+        sdsl::util::clear(rem_nts_rs);
+        sdsl::util::clear(rem_nts);
+
+        snapshot("simplify");
+        remove_snapshot("run_length");
+    }
 
-    colex_nt_sort(p_gram);
+    colex_nt_sort(p_gram, pool);
     p_gram.save_to_file(p_gram_file);
 
+    if(ckpt!=nullptr){
+        ckpt->commit("colex_sort", {{p_gram_file,           build_checkpoint::WHOLE},
+                                    {p_gram.rules_file,     build_checkpoint::WHOLE},
+                                    {p_gram.rules_lim_file, build_checkpoint::WHOLE},
+                                    {p_gram.is_rl_file,     build_checkpoint::WHOLE}});
+        remove_snapshot("simplify");
+    }
+
     //TODO testing
 //    check_plain_grammar(p_gram, i_file);
     //
@@ -209,22 +366,38 @@ void lpg_build::compute_LPG(std::string &i_file, std::string &p_gram_file, size_
     std::cout <<"    Number of nonterminals: " << p_gram.r - p_gram.sigma << std::endl;
     std::cout <<"    Grammar size:           " << p_gram.g - p_gram.sigma << std::endl;
     std::cout <<"    Compressed string:      " << p_gram.c << std::endl;
-
-    if(remove(tmp_i_file.c_str())){
-        std::cout<<"Error trying to delete file "<<tmp_i_file<<std::endl;
-    }
 }
 
 template<class sym_type>
-size_t lpg_build::compute_LPG_int(std::string &i_file, std::string &o_file,
-                                  size_t n_threads, size_t hbuff_size,
+size_t lpg_build::compute_LPG_int(std::string &i_file, std::string &o_file, const sdsl::int_vector<> *mem_in,
+                                  sdsl::int_vector<> *mem_out, thread_pool &pool, size_t hbuff_size, bool shared_dict,
                                   plain_grammar_t &p_gram, ivb_t &rules,
                                   bvb_t &rules_lim, sdsl::int_vector<2> &phrase_desc,
-                                  sdsl::cache_config &config) {
+                                  sdsl::cache_config &config, phase_timings& timings, size_t &psize) {
 
-    phrase_map_t mp_table(0, "", 0.85);
+    typedef typename parse_stream<sym_type>::type stream_t;
+    auto open_input = [&]() -> stream_t {
+        if constexpr (std::is_same<stream_t, packed_file_stream>::value){
+            if(mem_in!=nullptr) return stream_t(*mem_in);
+        }
+        return stream_t(i_file, BUFFER_SIZE);
+    };
+
+    //one shard of the dictionary per worker, or SHARED_DICT_STRIPES shards per worker if
+    // the workers insert their phrases into the shared dictionary (to keep the contention
+    // for the locks of the shards low)
+    phrase_dict mp_table(shared_dict ? pool.size()*SHARED_DICT_STRIPES : pool.size(), shared_dict);
+    phase_timings r_timings;
+    auto elapsed = [](std::chrono::high_resolution_clock::time_point start){
+        auto end = std::chrono::high_resolution_clock::now();
+        return (size_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    };
 
-    auto thread_ranges = compute_thread_ranges<sym_type>(n_threads, i_file, phrase_desc);
+    std::vector<std::pair<size_t, size_t>> thread_ranges;
+    {
+        stream_t is = open_input();
+        thread_ranges = compute_thread_ranges(pool.size(), is, phrase_desc);
+    }
 
     std::vector<lms_info<sym_type>> threads_data;
     threads_data.reserve(thread_ranges.size());
@@ -232,10 +405,10 @@ size_t lpg_build::compute_LPG_int(std::string &i_file, std::string &o_file,
     //how many size_t cells we can fit in the buffer
     size_t buff_cells = hbuff_size/sizeof(size_t);
 
-    //number of bytes per thread
-    size_t hb_bytes = (buff_cells / thread_ranges.size()) * sizeof(size_t);
+    //number of bytes per thread (the threads of a shared dictionary do not need a buffer)
+    size_t hb_bytes = shared_dict ? 0 : (buff_cells / thread_ranges.size()) * sizeof(size_t);
 
-    void *buff_addr = malloc(hbuff_size);
+    void *buff_addr = shared_dict ? nullptr : malloc(hbuff_size);
     auto tmp_addr = reinterpret_cast<char*>(buff_addr);
 
     size_t k=0;
@@ -244,103 +417,103 @@ size_t lpg_build::compute_LPG_int(std::string &i_file, std::string &o_file,
         std::stringstream ss;
         ss << o_file.substr(0, o_file.size() - 5) << "_range_" << range.first << "_" << range.second;
         std::string tmp_o_file = ss.str();
-        threads_data.emplace_back(i_file, tmp_o_file, mp_table, range.first, range.second,
-                                  p_gram.r, hb_bytes, tmp_addr + (k*hb_bytes), phrase_desc);
+        threads_data.emplace_back(open_input(), tmp_o_file, mem_out!=nullptr, mp_table, range.first, range.second,
+                                  p_gram.r, hb_bytes, shared_dict ? nullptr : tmp_addr + (k*hb_bytes), phrase_desc);
         k++;
     }
 
     std::cout<<"      Computing the LMS phrases in the text"<<std::endl;
     {
-        std::vector<pthread_t> threads(threads_data.size());
-        for(size_t i=0;i<threads_data.size();i++){
-            int ret =  pthread_create(&threads[i],
-                                      nullptr,
-                                      &hash_phrases<sym_type>,
-                                      (void*)&threads_data[i]);
-            if(ret != 0) {
-                printf("Error: pthread_create() failed\n");
-                exit(EXIT_FAILURE);
+        //every task splits the dictionary of its range by shard as soon as it finishes, and
+        // then every shard merges the pieces it received from all the ranges. With a shared
+        // dictionary, the phrases are already in their shards when the tasks finish
+        auto start = std::chrono::high_resolution_clock::now();
+        pool.parallel_for(threads_data.size(), [&](size_t i, size_t){
+            hash_phrases(threads_data[i]);
+            if(!shared_dict) partition_thread_phrases(mp_table, threads_data[i].thread_map.dump_file());
+        });
+        r_timings.hash = elapsed(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        pool.parallel_for(mp_table.n_shards(), [&](size_t s, size_t){
+            if(!shared_dict){
+                for(auto const& data : threads_data){
+                    std::string file = data.thread_map.dump_file();
+                    if(mp_table.n_shards()>1) file += "_shard_"+std::to_string(s);
+                    merge_thread_phrases(*mp_table.shards[s], file);
+                }
             }
-        }
-
-        for(size_t i=0;i<threads_data.size();i++) {
-            pthread_join(threads[i], nullptr);
-        }
+            mp_table.shards[s]->shrink_databuff();
+        });
+        r_timings.merge = elapsed(start);
     }
     free(buff_addr);
 
-    //join the different phrase files
-    std::vector<std::string> phrases_files;
-    for(size_t i=0;i<threads_data.size();i++){
-        phrases_files.push_back(threads_data[i].thread_map.dump_file());
-    }
-    join_thread_phrases(mp_table, phrases_files);
-
-    size_t psize=0;//<- for the iter stats
+    psize=0;//<- for the iter stats
     if(mp_table.size()>0){
 
         p_gram.rules_per_level.push_back(mp_table.size());
         size_t width = sdsl::bits::hi(p_gram.r+1)+1;
-        const bitstream<buff_t>& stream = mp_table.get_data();
-        key_wrapper key_w{width, mp_table.description_bits(), stream};
+        phrase_keys key_w(width, mp_table);
 
-        //temporal unload of the hash table (not the data)
+        //temporal unload of the hash tables (not the data)
         std::string st_table = sdsl::cache_file_name("ht_data", config);
-        mp_table.unload_table(st_table);
+        mp_table.unload_tables(st_table);
 
         //rename phrases according to their lexicographical ranks
         std::cout<<"      Assigning identifiers to the phrases"<<std::endl;
-        assign_ids(mp_table, p_gram.r-1,  key_w, rules, rules_lim, n_threads, config);
+        auto start = std::chrono::high_resolution_clock::now();
+        assign_ids(mp_table, p_gram.r-1,  key_w, rules, rules_lim, pool, config);
+        r_timings.assign = elapsed(start);
 
-        //reload the hash table
-        mp_table.load_table(st_table);
-        if(remove(st_table.c_str())){
-            std::cout<<"Error trying to remove temporal file"<<std::endl;
-            std::cout<<"Aborting"<<std::endl;
-            exit(1);
-        }
+        //reload the hash tables
+        mp_table.load_tables(st_table);
 
         std::cout<<"      Creating the parse of the text"<<std::endl;
-        {//store the phrases into a new file
-            std::vector<pthread_t> threads(threads_data.size());
-            for(size_t i=0;i<threads_data.size();i++){
-                int ret =  pthread_create(&threads[i],
-                                          nullptr,
-                                          &record_phrases<sym_type>,
-                                          (void*)&threads_data[i]);
-                if(ret != 0) {
-                    printf("Error: pthread_create() failed\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            for(size_t i=0;i<threads_data.size();i++) {
-                pthread_join(threads[i], nullptr);
-            }
-        }
+        start = std::chrono::high_resolution_clock::now();
+        pool.parallel_for(threads_data.size(), [&](size_t i, size_t){
+            record_phrases(threads_data[i]);
+        });
+        r_timings.record = elapsed(start);
 
+        start = std::chrono::high_resolution_clock::now();
         std::vector<std::string> chunk_files;
         for(size_t i=0;i<threads_data.size();i++){
             chunk_files.push_back(threads_data[i].ofs.file);
         }
-        join_parse_chunks(o_file, chunk_files);
 
-        {// this is just to get the size of the resulting parse
-           i_file_stream<size_t> ifs(o_file, BUFFER_SIZE);
-           psize = ifs.tot_cells;
-        }
+        //the concatenation of the parse chunks is pure I/O, so one worker does it while
+        // this thread updates the description of the symbols for the next round
+        //the width of the parse is the width of the symbols in the next round
+        auto p_width = uint8_t(sdsl::bits::hi(p_gram.r+mp_table.size())+1);
+        pool.submit([&, p_width](size_t){
+            if(mem_out!=nullptr){
+                //the chunks are in reverse order
+                size_t len=0;
+                for(auto const& data : threads_data) len += data.mem_ofs.size();
+                *mem_out = sdsl::int_vector<>(len, 0, p_width);
+                size_t pos=0;
+                for(auto & data : threads_data){
+                    for(size_t i=data.mem_ofs.size();i-->0;){
+                        (*mem_out)[pos++] = data.mem_ofs[i];
+                    }
+                    std::vector<size_t>().swap(data.mem_ofs);
+                }
+                psize = len;
+            }else{
+                join_parse_chunks(o_file, p_width, chunk_files);
+                // this is just to get the size of the resulting parse
+                packed_file_stream ifs(o_file, BUFFER_SIZE);
+                psize = ifs.tot_cells;
+            }
+        });
 
         {
             //keep track of the lms phrases that have to be rephrased
             phrase_desc.resize(p_gram.r+mp_table.size());
             std::cout << "      Updating symbols status" << std::endl;
-            auto it = mp_table.begin();
-            auto it_end = mp_table.end();
-            size_t tmp_value, sym;
-
-            while (it != it_end) {
-                tmp_value = 0;
-                auto val = it.value();
+            mp_table.for_each([&](size_t phrase, size_t val){
+                size_t tmp_value = 0;
 
                 //more than one occurrence of the phrase
                 if (val & 1UL) {
@@ -348,41 +521,49 @@ size_t lpg_build::compute_LPG_int(std::string &i_file, std::string &o_file,
                 }
 
                 //read the (reversed) last symbol
-                sym = key_w.read(*it, 0);
+                size_t sym = key_w.read(phrase, 0);
                 if (phrase_desc[sym] & 2U) {//phrase is suffix of some string
                     tmp_value += 2;
                 }
 
                 phrase_desc[val >> 1UL] = tmp_value;
-                ++it;
-            }
+            });
         }
-    }else{ //just copy the input
-        std::ifstream in(i_file, std::ios_base::binary);
-        std::ofstream out(o_file, std::ios_base::binary);
-
-        auto buffer = reinterpret_cast<char*>(malloc(BUFFER_SIZE));
-        do {
-            in.read(&buffer[0], BUFFER_SIZE);
-            out.write(&buffer[0], in.gcount());
-            psize+=in.gcount();
-        } while (in.gcount() > 0);
-        free(buffer);
-        psize/=sizeof(sym_type);
-
-        //remove remaining files
-        for(size_t i=0;i<threads_data.size();i++){
-            std::string tmp_file =  threads_data[i].ofs.file;
-            if(remove(tmp_file.c_str())){
-                std::cout<<"Error trying to delete file "<<tmp_file<<std::endl;
+        pool.wait();
+        r_timings.update = elapsed(start);
+    }else{ //just copy the input (as a bit-packed parse, in case it is the text)
+        stream_t in = open_input();
+        psize = in.size();
+        if(mem_out!=nullptr){
+            *mem_out = sdsl::int_vector<>(psize, 0, sdsl::bits::hi(p_gram.r)+1);
+            for(size_t i=0;i<psize;i++){
+                (*mem_out)[i] = in.read(i);
+            }
+        }else{
+            ivb_t out(o_file, std::ios::out, BUFFER_SIZE, sdsl::bits::hi(p_gram.r)+1);
+            for(size_t i=0;i<psize;i++){
+                out.push_back(in.read(i));
+            }
+            out.close();
+
+            //remove remaining files
+            for(size_t i=0;i<threads_data.size();i++){
+                std::string tmp_file =  threads_data[i].ofs.file;
+                if(remove(tmp_file.c_str())){
+                    std::cout<<"Error trying to delete file "<<tmp_file<<std::endl;
+                }
             }
         }
+        in.close();
     }
 
     p_gram.r +=mp_table.size();
     std::cout<<"      Stats:"<<std::endl;
     std::cout<<"        Parse size:          "<<psize<<std::endl;
     std::cout<<"        New nonterminals:    "<<mp_table.size()<<std::endl;
+    std::cout<<"        Time per phase (microsec):"<<std::endl;
+    r_timings.print("          ");
+    timings+=r_timings;
 
     if(psize>1){
         return mp_table.size();
@@ -392,15 +573,15 @@ size_t lpg_build::compute_LPG_int(std::string &i_file, std::string &o_file,
 }
 
 void
-lpg_build::assign_ids(phrase_map_t &mp_map, size_t max_sym, key_wrapper &key_w, ivb_t &r,
-                      bvb_t &r_lim, size_t n_threads, sdsl::cache_config &config) {
+lpg_build::assign_ids(phrase_dict &mp_map, size_t max_sym, phrase_keys &key_w, ivb_t &r,
+                      bvb_t &r_lim, thread_pool &pool, sdsl::cache_config &config) {
 
     std::string syms_file = sdsl::cache_file_name("syms_file", config);
     {
         sdsl::int_vector_buffer<> syms_buff(syms_file, std::ios::out);
-        for (auto const &phrase : mp_map) {
+        mp_map.for_each([&](size_t phrase, size_t){
             syms_buff.push_back(phrase);
-        }
+        });
         syms_buff.close();
     }
     auto compare = [&](const size_t &l, const size_t &r) -> bool {
@@ -409,7 +590,7 @@ lpg_build::assign_ids(phrase_map_t &mp_map, size_t max_sym, key_wrapper &key_w,
     auto access = [&](const size_t &val, size_t idx) -> size_t {
         return key_w.read(val, key_w.size(val)-1-idx);
     };
-    parallel_str_sort(syms_file, compare, access, max_sym+1, n_threads, config);
+    parallel_str_sort(syms_file, compare, access, max_sym+1, pool, config);
 
     sdsl::int_vector<> k_list;
     sdsl::load_from_file(k_list, syms_file);
@@ -418,7 +599,8 @@ lpg_build::assign_ids(phrase_map_t &mp_map, size_t max_sym, key_wrapper &key_w,
         std::cout<<"Error trying to remove file "<<syms_file<<std::endl;
     }
 
-    for(size_t m_pos=0; m_pos < mp_map.size(); m_pos++){
+    size_t n_phrases = mp_map.size();
+    for(size_t m_pos=0; m_pos < n_phrases; m_pos++){
 
         size_t len = key_w.size(k_list[m_pos]);
         for(size_t i=len; i-- > 1;){
@@ -437,10 +619,11 @@ lpg_build::assign_ids(phrase_map_t &mp_map, size_t max_sym, key_wrapper &key_w,
     }
 }
 
-void lpg_build::join_parse_chunks(const std::string &output_file, std::vector<std::string> &chunk_files) {
+void lpg_build::join_parse_chunks(const std::string &output_file, uint8_t width,
+                                  std::vector<std::string> &chunk_files) {
 
     //concatenate the files
-    std::ofstream of(output_file, std::ofstream::binary);
+    ivb_t of(output_file, std::ios::out, BUFFER_SIZE, width);
     size_t buff_size = BUFFER_SIZE/sizeof(size_t);
     size_t len, rem, to_read, start, end;
     auto *buffer = new size_t[buff_size];
@@ -456,7 +639,7 @@ void lpg_build::join_parse_chunks(const std::string &output_file, std::vector<st
         rem=len;
         to_read = std::min<size_t>(buff_size, len);
 
-        while(true){
+        while(to_read>0){
 
             i_file.seekg( (rem - to_read) * sizeof(size_t));
             i_file.read((char *)buffer, sizeof(size_t)*to_read);
@@ -468,12 +651,12 @@ void lpg_build::join_parse_chunks(const std::string &output_file, std::vector<st
                 std::swap(buffer[start++], buffer[end--]);
             }
 
-            of.write((char *)buffer, sizeof(size_t)*to_read);
-            assert(of.good());
+            for(size_t i=0;i<to_read;i++){
+                of.push_back(buffer[i]);
+            }
 
             rem -= i_file.gcount()/sizeof(size_t);
             to_read = std::min<size_t>(buff_size, rem);
-            if(to_read == 0) break;
         }
         i_file.close();
 
@@ -488,15 +671,16 @@ void lpg_build::join_parse_chunks(const std::string &output_file, std::vector<st
 }
 
 template<class sym_t>
-void * lpg_build::hash_phrases(void * data) {
+void lpg_build::hash_phrases(lms_info<sym_t>& data) {
 
-    auto lms_data = (lms_info<sym_t> *) data;
+    auto lms_data = &data;
 
     bool s_type, prev_s_type = S_TYPE;
     sym_t curr_sym, prev_sym;
 
     string_t curr_lms(2, lms_data->sym_width);
 
+    lms_data->ifs.set_backward(true);
     prev_sym = lms_data->ifs.read(lms_data->end);
     curr_lms.push_back(prev_sym);
 
@@ -545,85 +729,68 @@ void * lpg_build::hash_phrases(void * data) {
         lms_data->hash_phrase(curr_lms);
     }
     lms_data->thread_map.flush();
-
-    pthread_exit(nullptr);
 }
 
-void lpg_build::join_thread_phrases(phrase_map_t& map, std::vector<std::string> &files) {
+void lpg_build::partition_thread_phrases(const phrase_dict& map, const std::string &file) {
 
-    bool rep;
+    if(map.n_shards()==1) return;
 
-    for(auto const& file : files){
-
-        std::ifstream text_i(file, std::ios_base::binary);
-
-        text_i.seekg (0, std::ifstream::end);
-        size_t tot_bytes = text_i.tellg();
-        text_i.seekg (0, std::ifstream::beg);
-
-        auto buffer = reinterpret_cast<char *>(malloc(tot_bytes));
-
-        text_i.read(buffer, tot_bytes);
-
-        bitstream<buff_t> bits;
-        bits.stream = reinterpret_cast<buff_t*>(buffer);
+    std::vector<phrase_dump_writer> writers;
+    writers.reserve(map.n_shards());
+    for(size_t s=0;s<map.n_shards();s++){
+        writers.emplace_back(file+"_shard_"+std::to_string(s), BUFFER_SIZE/map.n_shards());
+    }
 
-        size_t next_bit = 32;
-        size_t tot_bits = tot_bytes*8;
+    {
+        phrase_dump_reader reader(file);
+        const void* key;
         size_t key_bits;
-        void* key=nullptr;
-        size_t max_key_bits=0;
-
-        while(next_bit<tot_bits){
-
-            key_bits = bits.read(next_bit-32, next_bit-1);
-
-            size_t n_bytes = INT_CEIL(key_bits, bitstream<buff_t>::word_bits)*sizeof(buff_t);
-            if(key_bits>max_key_bits){
-                if(key==nullptr){
-                    key = malloc(n_bytes);
-                }else {
-                    key = realloc(key, n_bytes);
-                }
-                max_key_bits = key_bits;
-            }
+        bool rep;
+        while(reader.next(key, key_bits, rep)){
+            writers[map.shard_of(key, key_bits)].push(key, key_bits, rep);
+        }
+    }
+    for(auto & writer : writers) writer.close();
 
-            char *tmp = reinterpret_cast<char*>(key);
-            tmp[INT_CEIL(key_bits, 8)-1] = 0;
+    if(remove(file.c_str())){
+        std::cout<<"Error trying to remove temporal file"<<std::endl;
+        std::cout<<"Aborting"<<std::endl;
+        exit(1);
+    }
+}
 
-            bits.read_chunk(key, next_bit, next_bit+key_bits-1);
-            next_bit+=key_bits;
-            rep = bits.read(next_bit, next_bit);
-            next_bit+=33;
+void lpg_build::merge_thread_phrases(phrase_map_t& map, const std::string &file) {
 
+    {
+        phrase_dump_reader reader(file);
+        const void* key;
+        size_t key_bits;
+        bool rep;
+        while(reader.next(key, key_bits, rep)){
             auto res = map.insert(key, key_bits, rep);
             if(!res.second){
                 map.insert_value_at(*res.first, 1UL);
             }
         }
-        text_i.close();
-
-        if(remove(file.c_str())){
-            std::cout<<"Error trying to remove temporal file"<<std::endl;
-            std::cout<<"Aborting"<<std::endl;
-            exit(1);
-        }
+    }
 
-        free(key);
-        free(buffer);
+    if(remove(file.c_str())){
+        std::cout<<"Error trying to remove temporal file"<<std::endl;
+        std::cout<<"Aborting"<<std::endl;
+        exit(1);
     }
-    map.shrink_databuff();
 }
 
 template<class sym_t>
-void * lpg_build::record_phrases(void *data) {
+void lpg_build::record_phrases(lms_info<sym_t>& data) {
 
-    auto lms_data = (lms_info<sym_t> *) data;
+    auto lms_data = &data;
 
     bool s_type, prev_s_type = S_TYPE;
     sym_t curr_sym, prev_sym;
 
     string_t curr_lms(2, lms_data->sym_width);
+    lms_data->ifs.set_backward(true);
     prev_sym = lms_data->ifs.read(lms_data->end);
     curr_lms.push_back(prev_sym);
 
@@ -670,15 +837,13 @@ void * lpg_build::record_phrases(void *data) {
 
     lms_data->ofs.close();
     lms_data->ifs.close();
-    pthread_exit(nullptr);
 }
 
-template<class sym_type>
-std::vector<std::pair<size_t, size_t>> lpg_build::compute_thread_ranges(size_t n_threads, std::string& i_file,
+template<class stream_t>
+std::vector<std::pair<size_t, size_t>> lpg_build::compute_thread_ranges(size_t n_threads, stream_t& is,
                                                                         sdsl::int_vector<2>& phrase_desc) {
     std::vector<std::pair<size_t, size_t>> thread_ranges;
 
-    i_file_stream<sym_type> is(i_file, BUFFER_SIZE);
     size_t n_chars = is.tot_cells;
     assert(n_chars>0);
     size_t sym_per_thread = INT_CEIL(n_chars, n_threads);
@@ -700,9 +865,50 @@ std::vector<std::pair<size_t, size_t>> lpg_build::compute_thread_ranges(size_t n
     return thread_ranges;
 }
 
-void lpg_build::decomp(size_t nt, sdsl::int_vector<> &rules, bv_t::select_1_type &rlim_ss, bv_t &rem_nt,
-                       bv_t::rank_1_type &rem_nt_rs,
-                       ivb_t &dec) {
+std::vector<lpg_build::rule_range> lpg_build::rule_ranges(size_t first, size_t last, const bv_t::select_1_type& r_lim_ss,
+                                                          size_t n_parts) {
+    auto rule_start = [&](size_t rule){
+        return rule==0 ? 0 : r_lim_ss(rule)+1;
+    };
+
+    std::vector<rule_range> ranges;
+    if(first>=last) return ranges;
+
+    size_t f_pos = rule_start(first), l_pos = rule_start(last);
+    size_t rule = first, pos = f_pos, lo, hi, mid;
+    for(size_t p=1; p<=n_parts && rule<last; p++){
+        //first rule that starts at or after the target position
+        size_t target = f_pos + (p*(l_pos-f_pos))/n_parts;
+        lo = rule+1;
+        hi = last;
+        while(lo<hi){
+            mid = lo + (hi-lo)/2;
+            if(rule_start(mid)<target){
+                lo = mid+1;
+            }else{
+                hi = mid;
+            }
+        }
+        if(p==n_parts) lo = last;
+        size_t next_pos = rule_start(lo);
+        ranges.push_back({rule, pos, next_pos});
+        rule = lo;
+        pos = next_pos;
+    }
+    return ranges;
+}
+
+void lpg_build::split_rule(size_t rule, size_t start, size_t end, size_t n_parts, std::vector<rule_range>& ranges) {
+    for(size_t p=0;p<n_parts;p++){
+        size_t r_start = start + (p*(end-start))/n_parts;
+        size_t r_end = start + ((p+1)*(end-start))/n_parts;
+        if(r_start<r_end) ranges.push_back({rule, r_start, r_end});
+    }
+}
+
+template<class F>
+void lpg_build::decomp(size_t nt, const sdsl::int_vector<> &rules, const bv_t::select_1_type &rlim_ss,
+                       const bv_t &rem_nt, const bv_t::rank_1_type &rem_nt_rs, const F& f) {
 
     std::stack<size_t> stack;
     stack.push(nt);
@@ -717,14 +923,16 @@ void lpg_build::decomp(size_t nt, sdsl::int_vector<> &rules, bv_t::select_1_type
                 stack.push(rules[j]);
             }
         }else{
-            dec.push_back(tmp - rem_nt_rs(tmp));
+            f(tmp - rem_nt_rs(tmp));
         }
     }
 }
 
-void lpg_build::simplify_grammar(lpg_build::plain_grammar_t &p_gram, bv_t &rem_nts, bv_t::rank_1_type &rem_nts_rs) {
+void lpg_build::simplify_grammar(lpg_build::plain_grammar_t &p_gram, bv_t &rem_nts, bv_t::rank_1_type &rem_nts_rs,
+                                 thread_pool& pool) {
 
     std::cout<<"  Simplifying the grammar"<<std::endl;
+    pass_stats p_stats;
 
     bv_t r_lim;
     sdsl::load_from_file(r_lim, p_gram.rules_lim_file);
@@ -736,10 +944,6 @@ void lpg_build::simplify_grammar(lpg_build::plain_grammar_t &p_gram, bv_t &rem_n
 
     bv_t is_rl;
     sdsl::load_from_file(is_rl, p_gram.is_rl_file);
-    sdsl::int_vector_buffer<1> new_is_rl(p_gram.is_rl_file, std::ios::out);
-
-    ivb_t new_rules(p_gram.rules_file, std::ios::out);
-    sdsl::int_vector_buffer<1> new_r_lim(p_gram.rules_lim_file, std::ios::out);
 
     //compress the alphabet
     size_t cont=0;
@@ -756,65 +960,85 @@ void lpg_build::simplify_grammar(lpg_build::plain_grammar_t &p_gram, bv_t &rem_n
     std::swap(new_sym_map, p_gram.sym_map);
     assert(p_gram.sym_map.size()==p_gram.sigma);
 
-    for(size_t k=0;k<p_gram.sigma;k++){
-        new_r_lim.push_back(true);
-        new_rules.push_back(k);
-    }
-
-    size_t pos, tr_rule=p_gram.sigma;
-    for(size_t i=max_tsym+1,curr_rule=max_tsym+1;i<rules.size();curr_rule++){
-        assert(r_lim[i-1]);
-        pos = i;
-        while(!r_lim[i]) i++;
-        i++;
+    std::vector<rule_range> ranges = rule_ranges(max_tsym+1, p_gram.r-1, r_lim_ss, 4*pool.size());
+    split_rule(p_gram.r-1, r_lim_ss(p_gram.r-1)+1, rules.size(), pool.size(), ranges);
 
-
-        if(!rem_nts[curr_rule]){
-            if(!is_rl[curr_rule]){//regular rule
-                for(size_t j=pos;j<i;j++){
-                    if(rem_nts[rules[j]]){
-                        decomp(rules[j], rules, r_lim_ss, rem_nts, rem_nts_rs, new_rules);
+    //call sym(x) for every symbol that a range of rules produces in the new grammar, and
+    // end_rule(rl) every time one of its rules ends
+    auto simplify_range = [&](const rule_range& range, auto&& sym, auto&& end_rule){
+        size_t curr_rule = range.rule;
+        for(size_t k=range.start;k<range.end;k++){
+            if(!rem_nts[curr_rule]){
+                if(!is_rl[curr_rule]){//regular rule
+                    if(rem_nts[rules[k]]){
+                        decomp(rules[k], rules, r_lim_ss, rem_nts, rem_nts_rs, sym);
                     }else{
-                        new_rules.push_back(rules[j]-rem_nts_rs(rules[j]));
+                        sym(rules[k]-rem_nts_rs(rules[k]));
                     }
+                }else{//run-length rule
+                    assert(r_lim[k+1]);
+                    sym(rules[k]-rem_nts_rs(rules[k]));
+                    sym(rules[++k]);
                 }
-            }else{//run-length rule
-                assert((i-pos)==2);
-                new_rules.push_back(rules[pos]-rem_nts_rs(rules[pos]));
-                new_rules.push_back(rules[pos+1]);
-                new_is_rl[tr_rule] = true;
+                if(r_lim[k]) end_rule(is_rl[curr_rule]);
             }
-            new_r_lim[new_rules.size()-1]=true;
-            tr_rule++;
+            if(r_lim[k]) curr_rule++;
         }
+    };
+
+    //the ranges first count the symbols and the rules they keep, and then they write their
+    // part of the new grammar at the offsets given by the prefix sums of the counts
+    std::vector<size_t> range_syms(ranges.size()+1, 0), range_rules(ranges.size()+1, 0);
+    pool.parallel_for(ranges.size(), [&](size_t r_id, size_t){
+        size_t n_syms=0, n_rules=0;
+        simplify_range(ranges[r_id], [&](size_t){ n_syms++; }, [&](bool){ n_rules++; });
+        range_syms[r_id+1] = n_syms;
+        range_rules[r_id+1] = n_rules;
+    });
+    range_syms[0] = range_rules[0] = p_gram.sigma;
+    for(size_t i=1;i<range_syms.size();i++){
+        range_syms[i] += range_syms[i-1];
+        range_rules[i] += range_rules[i-1];
     }
 
-    //mark the compressed string as a non-run-length rule
-    new_is_rl[tr_rule-1]=false;
+    //the cells have 64 bits, so two ranges never write the same word of new_rules
+    sdsl::int_vector<> new_rules(range_syms.back(), 0, 64);
+    bv_t new_r_lim(new_rules.size(), false);
+    bv_t new_is_rl(range_rules.back(), false);
+
+    for(size_t k=0;k<p_gram.sigma;k++){
+        new_rules[k] = k;
+        new_r_lim[k] = true;
+    }
+
+    pool.parallel_for(ranges.size(), [&](size_t r_id, size_t){
+        size_t pos = range_syms[r_id], tr_rule = range_rules[r_id];
+        simplify_range(ranges[r_id], [&](size_t sym){
+            new_rules[pos++] = sym;
+        }, [&](bool rl){
+            atomic_set(new_r_lim, pos-1);
+            if(rl) atomic_set(new_is_rl, tr_rule);
+            tr_rule++;
+        });
+        assert(pos==range_syms[r_id+1] && tr_rule==range_rules[r_id+1]);
+    });
 
     size_t rm_nt =rem_nts_rs(rem_nts.size());
     float rm_per = float(rm_nt)/float(p_gram.r)*100;
     float comp_rat = float(new_rules.size())/float(rules.size());
 
     std::cout<<"    Stats:"<<std::endl;
-    std::cout<<"      Grammar size before:  "<<p_gram.g<<std::endl;
-    std::cout<<"      Grammar size after:   "<<new_rules.size()<<std::endl;
-    std::cout<<"      Deleted nonterminals: "<<rm_nt<<" ("<<rm_per<<"%)"<<std::endl;
-    std::cout<<"      Compression ratio:    "<<comp_rat<<std::endl;
-
-    /*cont=0;
-    for(auto && new_rule : new_rules){
-        if(new_rule==0){
-            cont++;
-        }
-    }
-    std::cout<<"there are "<<cont<<" zeroes"<<std::endl;*/
+    std::cout<<"      Grammar size before:        "<<p_gram.g<<std::endl;
+    std::cout<<"      Grammar size after:         "<<new_rules.size()<<std::endl;
+    std::cout<<"      Deleted nonterminals:       "<<rm_nt<<" ("<<rm_per<<"%)"<<std::endl;
+    std::cout<<"      Compression ratio:          "<<comp_rat<<std::endl;
 
-    new_rules.close();
-    new_r_lim.close();
-    new_is_rl.close();
+    sdsl::store_to_file(new_rules, p_gram.rules_file);
+    sdsl::store_to_file(new_r_lim, p_gram.rules_lim_file);
+    sdsl::store_to_file(new_is_rl, p_gram.is_rl_file);
     p_gram.r -= rm_nt;
     p_gram.g = new_rules.size();
+    p_stats.print("      ");
 }
 
 //TODO: this functions are just for debugging
@@ -957,7 +1181,10 @@ void lpg_build::create_lvl_breaks(plain_grammar_t &p_gram, bv_t &rem_nts, bv_t::
     }
 }
 
-lpg_build::bv_t lpg_build::mark_nonterminals(lpg_build::plain_grammar_t &p_gram) {
+lpg_build::bv_t lpg_build::mark_nonterminals(lpg_build::plain_grammar_t &p_gram, thread_pool& pool) {
+
+    std::cout<<"  Marking the nonterminals to remove"<<std::endl;
+    pass_stats p_stats;
 
     size_t max_tsym = p_gram.max_tsym;
 
@@ -968,7 +1195,8 @@ lpg_build::bv_t lpg_build::mark_nonterminals(lpg_build::plain_grammar_t &p_gram)
     sdsl::int_vector<> rules;
     sdsl::load_from_file(rules, p_gram.rules_file);
 
-    sdsl::int_vector_buffer<1> is_rl(p_gram.is_rl_file, std::ios::in);
+    bv_t is_rl;
+    sdsl::load_from_file(is_rl, p_gram.is_rl_file);
     size_t rl_rule=max_tsym+1;
     for(unsigned long freq : p_gram.rules_per_level){
         rl_rule+=freq;
@@ -977,72 +1205,86 @@ lpg_build::bv_t lpg_build::mark_nonterminals(lpg_build::plain_grammar_t &p_gram)
 
     bv_t rem_nts(p_gram.r, false);
 
+    //the frequency of every symbol, saturated at two: a symbol is in once after its first
+    // occurrence and in twice after the second one
+    bv_t once(p_gram.r + 1, false), twice(p_gram.r + 1, false);
+
+    std::vector<rule_range> c_ranges;
+    split_rule(p_gram.r-1, r_lim_ss(p_gram.r-1)+1, rules.size(), pool.size(), c_ranges);
+    std::vector<rule_range> ranges = rule_ranges(max_tsym+1, p_gram.r-1, r_lim_ss, 4*pool.size());
+    ranges.insert(ranges.end(), c_ranges.begin(), c_ranges.end());
+
     //compute which nonterminals are repeated and
     // which have a rule of length 1
-    sdsl::int_vector<2> rep_nts(p_gram.r + 1, 0);
-
-    size_t r_len=1, cont=0, curr_rule=max_tsym+1,k=max_tsym+1;
-    while(k<rules.size()){
-        if(curr_rule>=rl_rule && curr_rule<p_gram.r-1){//run-length compressed rules
-            rep_nts[rules[k++]] = 2;
-            assert(r_lim[k] && r_len==1);
-            r_len=0;
-            curr_rule++;
-        }else{
-            //get the frequency of every symbol
-            if(rep_nts[rules[k]]<2){
-                rep_nts[rules[k]]++;
-            }
+    pool.parallel_for(ranges.size(), [&](size_t r_id, size_t){
+        size_t r_len=1, curr_rule=ranges[r_id].rule, k=ranges[r_id].start;
+        while(k<ranges[r_id].end){
+            if(curr_rule>=rl_rule && curr_rule<p_gram.r-1){//run-length compressed rules
+                assert(r_lim[k+1]);
+                atomic_set(once, rules[k]);
+                atomic_set(twice, rules[k]);
+                k+=2;
+                curr_rule++;
+            }else{
+                //get the frequency of every symbol
+                if(atomic_test_set(once, rules[k])) atomic_set(twice, rules[k]);
 
-            if(r_lim[k]){
-                //mark the rules with a right-hand side of length 1
-                if(r_len==1 && rules[k]>=max_tsym){
-                    rem_nts[curr_rule] = true;
-                    cont++;
-                    assert(r_lim[k-1]);
+                if(r_lim[k]){
+                    //mark the rules with a right-hand side of length 1
+                    if(r_len==1 && rules[k]>=max_tsym){
+                        atomic_set(rem_nts, curr_rule);
+                    }
+                    r_len=0;
+                    curr_rule++;
                 }
-                r_len=0;
-                curr_rule++;
+                r_len++;
+                k++;
             }
         }
-        r_len++;
-        k++;
-    }
+    });
 
     //mark the rules to remove
     //1) rules whose left-hand side has length one
     //2) terminal symbols between [min_sym..max_sym] with
     // frequency zero: to compress the alphabet
-    for(size_t i=0;i<p_gram.r;i++){
-        //mark the rules with frequency one
-        if(!rem_nts[i]){
-            rem_nts[i] = rep_nts[i]==0 || (rep_nts[i]==1 && i > max_tsym);
+    //but keep the run-length rules. Every task takes whole words of rem_nts
+    size_t n_words = INT_CEIL(p_gram.r, 64);
+    size_t n_parts = std::min(n_words, 4*pool.size());
+    pool.parallel_for(n_parts, [&](size_t part, size_t){
+        size_t start = ((part*n_words)/n_parts)*64;
+        size_t end = std::min<size_t>(p_gram.r, (((part+1)*n_words)/n_parts)*64);
+        for(size_t i=start;i<end;i++){
+            if(i>=rl_rule && i<p_gram.r-1 && is_rl[i]){
+                rem_nts[i] = false;
+            }else if(!rem_nts[i]){
+                //mark the rules with frequency one
+                rem_nts[i] = !once[i] || (!twice[i] && i > max_tsym);
+            }
         }
-    }
+    });
 
     //unmark unique nonterminals that
     // appear in the compressed string
-    for(size_t i=r_lim_ss(p_gram.r-1)+1; i<rules.size();i++){
-        rem_nts[rules[i]] = false;
-    }
-
-    //unmark the run-length rules
-    while(rl_rule<p_gram.r-1){
-        if(is_rl[rl_rule]){
-            rem_nts[rl_rule] = false;
+    pool.parallel_for(c_ranges.size(), [&](size_t r_id, size_t){
+        for(size_t i=c_ranges[r_id].start; i<c_ranges[r_id].end;i++){
+            atomic_unset(rem_nts, rules[i]);
         }
-        rl_rule++;
-    }
+    });
 
     rem_nts[p_gram.r-1] = false;//unmark the compressed string
 
+    std::cout<<"    Stats:"<<std::endl;
+    std::cout<<"      Marked nonterminals:        "<<sdsl::util::cnt_one_bits(rem_nts)<<std::endl;
+    p_stats.print("      ");
+
     return rem_nts;
 }
 
-void lpg_build::colex_nt_sort(plain_grammar_t &p_gram) {
+void lpg_build::colex_nt_sort(plain_grammar_t &p_gram, thread_pool& pool) {
 
     //that this point, the grammar is supposed to be collapsed
     std::cout<<"  Reordering nonterimnals in Colex"<<std::endl;
+    pass_stats p_stats;
 
     //sort the nonterminals in reverse lexicographical order
     bv_t r_lim;
@@ -1055,52 +1297,50 @@ void lpg_build::colex_nt_sort(plain_grammar_t &p_gram) {
     bv_t is_rl;
     sdsl::load_from_file(is_rl, p_gram.is_rl_file);
 
-    std::stack<size_t> stack;
-    std::vector<uint8_t> tmp_buff;
-    std::vector<std::pair<size_t, std::vector<uint8_t>>> nt_pairs;
-    size_t start, end, tmp_sym, curr_rule=0;
+    size_t n_nts = p_gram.r-1;
+    auto rule_start = [&](size_t rule){
+        return rule==0 ? 0 : rlim_ss(rule)+1;
+    };
 
     //decompress all the nonterinals
-    while(curr_rule<p_gram.r-1){
-
-        stack.push(curr_rule);
-
-        while(!stack.empty()){
-            tmp_sym = stack.top();
-            stack.pop();
-
-            if(tmp_sym>=p_gram.sigma){
-                start = rlim_ss(tmp_sym)+1;
-                if(!is_rl[tmp_sym]){
-                    end = rlim_ss(tmp_sym+1);
-                    for(size_t j=end+1;j-->start;){
-                        stack.push(rules[j]);
-                    }
-                }else{
-                    assert(r_lim[start+1]);
-                    for(size_t j=0;j<rules[start+1];j++){
-                        stack.push(rules[start]);
+    std::vector<std::pair<size_t, std::vector<uint8_t>>> nt_pairs(n_nts);
+    std::vector<rule_range> ranges = rule_ranges(0, n_nts, rlim_ss, 4*pool.size());
+    pool.parallel_for(ranges.size(), [&](size_t r_id, size_t){
+        std::stack<size_t> stack;
+        size_t start, end, tmp_sym;
+        size_t last_rule = r_id+1<ranges.size() ? ranges[r_id+1].rule : n_nts;
+
+        for(size_t curr_rule=ranges[r_id].rule; curr_rule<last_rule; curr_rule++){
+            std::vector<uint8_t> tmp_buff;
+            stack.push(curr_rule);
+
+            while(!stack.empty()){
+                tmp_sym = stack.top();
+                stack.pop();
+
+                if(tmp_sym>=p_gram.sigma){
+                    start = rlim_ss(tmp_sym)+1;
+                    if(!is_rl[tmp_sym]){
+                        end = rlim_ss(tmp_sym+1);
+                        for(size_t j=end+1;j-->start;){
+                            stack.push(rules[j]);
+                        }
+                    }else{
+                        assert(r_lim[start+1]);
+                        for(size_t j=0;j<rules[start+1];j++){
+                            stack.push(rules[start]);
+                        }
                     }
+                }else{//we reach a terminal
+                    tmp_buff.push_back((uint8_t)tmp_sym);
                 }
-            }else{//we reach a terminal
-                tmp_buff.push_back((uint8_t)tmp_sym);
             }
+            nt_pairs[curr_rule] = {curr_rule, std::move(tmp_buff)};
         }
-
-        /*if(curr_rule==1182963) {
-            std::cout << curr_rule << " : ";
-            for (char sym : tmp_buff) {
-                std::cout << (size_t) sym << " ";
-            }
-            std::cout << "" << std::endl;
-        }*/
-
-        nt_pairs.emplace_back(curr_rule, std::move(tmp_buff));
-        curr_rule++;
-    }
+    });
 
     //sort them in reverse lexicographical order
-    std::sort(nt_pairs.begin(), nt_pairs.end(), [](auto& left, auto& right){
+    parallel_sort(nt_pairs.begin(), nt_pairs.end(), [](auto& left, auto& right){
         size_t l1=left.second.size()-1;
         size_t l2=right.second.size()-1;
         for(size_t len=std::min(l1,l2)+1; len-->0;l1--,l2--){
@@ -1109,199 +1349,207 @@ void lpg_build::colex_nt_sort(plain_grammar_t &p_gram) {
             }
         }
         return left.second.size()<right.second.size();
-    });
-
-    //TODO testing
-    /*std::cout<<"the string: "<<nt_pairs[0].first<<std::endl;
-    for(size_t i=0;i<nt_pairs[0].second.size();i++){
-        std::cout<<(size_t)nt_pairs[0].second[i]<<std::endl;
-    }*/
-    //
+    }, pool);
 
-    ivb_t new_rules(p_gram.rules_file, std::ios::out);
-    sdsl::int_vector_buffer<1> new_rlim(p_gram.rules_lim_file, std::ios::out);
-    bv_t new_is_rl(is_rl.size(), false);
-
-    //set terminal symbols
+    //the rank of a nonterminal in colex order is its new name, and new_starts[rank] is the
+    // position of its rule in the new rules array
+    size_t n_parts = 4*pool.size();
     std::vector<size_t> renames(p_gram.r, 0);
-
-    //reorder nonterminal symbols
-    size_t pos, rank=0;
-    std::unordered_map<size_t, uint8_t> new_map;
-    for(auto const &nt_data : nt_pairs){
-
-        //update the bit vector with the rl-rules
-        if(is_rl[nt_data.first]) new_is_rl[rank] = true;
-
-        //store the new nonterimnal value
-        // for terminal symbols
-        if(nt_data.first<p_gram.sigma){
-            uint8_t byte_sym = p_gram.sym_map[nt_data.first];
-            new_map[rank] = byte_sym;
+    std::vector<size_t> sorted_nts(n_nts);
+    std::vector<size_t> new_starts(n_nts+1, 0);
+    pool.parallel_for(n_parts, [&](size_t part, size_t){
+        for(size_t rank=(part*n_nts)/n_parts; rank<((part+1)*n_nts)/n_parts; rank++){
+            size_t nt = nt_pairs[rank].first;
+            sorted_nts[rank] = nt;
+            renames[nt] = rank;
+            new_starts[rank+1] = rlim_ss(nt+1)+1-rule_start(nt);
         }
+    });
+    //the expansions are not needed anymore
+    std::vector<std::pair<size_t, std::vector<uint8_t>>>().swap(nt_pairs);
+    for(size_t rank=1;rank<=n_nts;rank++) new_starts[rank] += new_starts[rank-1];
 
-        //rename the nonterminal
-        renames[nt_data.first] = rank++;
-
-        pos = nt_data.first==0?  0 : rlim_ss(nt_data.first)+1;
+    size_t c_start = rlim_ss(p_gram.r-1)+1;
+    assert(new_starts[n_nts]==c_start);
 
-        while(!r_lim[pos]){
-            new_rules.push_back(rules[pos++]);
-        }
-        new_rules.push_back(rules[pos]);
-        assert(r_lim[pos]);
-        new_rlim[new_rules.size()-1] = true;
-
-        /*std::cout<<nt_data.first<<" = "<<rank-1<<" -> ";
-        for(size_t j=nt_data.second.size();j-->0;){
-            std::cout<<(int)nt_data.second[j]<<" ";
+    //store the new nonterimnal value
+    // for terminal symbols
+    std::unordered_map<size_t, uint8_t> new_map;
+    for(size_t rank=0;rank<n_nts;rank++){
+        if(sorted_nts[rank]<p_gram.sigma){
+            new_map[rank] = p_gram.sym_map[sorted_nts[rank]];
         }
-        std::cout<<""<<std::endl;*/
     }
     std::swap(p_gram.sym_map, new_map);
     assert(p_gram.sym_map.size()==p_gram.sigma);
 
-    //insert compressed string
-    for(size_t i=rlim_ss(p_gram.r-1)+1;i<rules.size();i++){
-        new_rules.push_back(rules[i]);
-    }
-    new_rlim[new_rules.size()-1] = true;
-
-    assert(new_rules.size()==rules.size());
-
-    //rename nonterminal references
-    curr_rule=0;
-    size_t k=0;
-    while(k<new_rules.size()){
-        /*if(renames[new_rules[k]]==0){
-            std::cout<<new_rules[k]<<" "<<p_gram.r<<" "<<rlim_ss(new_rules[k])+1<<" "<<rlim_ss(new_rules[k]+1)<<std::endl;
-        }*/
-        new_rules[k] = renames[new_rules[k]];
-        if(new_is_rl[curr_rule]){
-            assert(!new_rlim[k] && new_rlim[k+1]);
-            k++;
-        }
-        if(new_rlim[k]){
-            curr_rule++;
+    //reorder the rules and rename the nonterminal references (the second symbol of a
+    // run-length rule is a length). The cells have 64 bits, so the parts never write
+    // the same word of new_rules
+    sdsl::int_vector<> new_rules(rules.size(), 0, 64);
+    bv_t new_rlim(rules.size(), false);
+    bv_t new_is_rl(is_rl.size(), false);
+    pool.parallel_for(n_parts, [&](size_t part, size_t){
+        for(size_t rank=(part*n_nts)/n_parts; rank<((part+1)*n_nts)/n_parts; rank++){
+            size_t nt = sorted_nts[rank];
+            size_t pos = rule_start(nt), new_pos = new_starts[rank], len = new_starts[rank+1]-new_pos;
+            if(is_rl[nt]){
+                assert(len==2);
+                atomic_set(new_is_rl, rank);
+                new_rules[new_pos] = renames[rules[pos]];
+                new_rules[new_pos+1] = rules[pos+1];
+            }else{
+                for(size_t j=0;j<len;j++){
+                    new_rules[new_pos+j] = renames[rules[pos+j]];
+                }
+            }
+            atomic_set(new_rlim, new_pos+len-1);
         }
-        k++;
-    }
+    });
 
-    //TODO testing
-    /*size_t cont=0;
-    for(auto && new_rule : new_rules){
-        if(new_rule==0){
-            cont++;
+    //insert compressed string
+    std::vector<rule_range> c_ranges;
+    split_rule(p_gram.r-1, c_start, rules.size(), pool.size(), c_ranges);
+    pool.parallel_for(c_ranges.size(), [&](size_t r_id, size_t){
+        for(size_t i=c_ranges[r_id].start;i<c_ranges[r_id].end;i++){
+            new_rules[i] = renames[rules[i]];
         }
-    }
-    std::cout<<"there are "<<cont<<" zeroes"<<std::endl;*/
-    //
-
-    //renaming the rules in the lvl_breaks
-    /*ivb_t lvl_breaks(p_gram.lvl_breaks_file, std::ios::in | std::ios::out);
-    k=0;
-    while(k<lvl_breaks.size()){
-        lvl_breaks[k] = renames[lvl_breaks[k]];
-        k++;
-        k+=lvl_breaks[k]+1;
-    }
-    assert(k==lvl_breaks.size());
-    lvl_breaks.close();*/
+    });
+    new_rlim[new_rules.size()-1] = true;
 
     sdsl::store_to_file(new_is_rl, p_gram.is_rl_file);
-    new_rules.close();
-    new_rlim.close();
+    sdsl::store_to_file(new_rules, p_gram.rules_file);
+    sdsl::store_to_file(new_rlim, p_gram.rules_lim_file);
+
+    std::cout<<"    Stats:"<<std::endl;
+    p_stats.print("      ");
 }
 
-void lpg_build::run_length_compress(lpg_build::plain_grammar_t &p_gram, sdsl::cache_config& config) {
+void lpg_build::run_length_compress(lpg_build::plain_grammar_t &p_gram, thread_pool& pool) {
 
     std::cout<<"  Run-length compressing the grammar"<<std::endl;
+    pass_stats p_stats;
 
-    sdsl::int_vector_buffer<> rules(p_gram.rules_file, std::ios::in);
-    sdsl::int_vector_buffer<1> r_lim(p_gram.rules_lim_file, std::ios::in);
-    sdsl::int_vector_buffer<1> is_rl_bv(p_gram.is_rl_file, std::ios::out);
-
-    std::string rl_rules_file = sdsl::cache_file_name("tmp_rl_file", config);
-    sdsl::int_vector_buffer<> rl_rules(rl_rules_file, std::ios::out);
-    std::string rl_r_lim_file = sdsl::cache_file_name("tmp_rl_lim_file", config);
-    sdsl::int_vector_buffer<1> rl_r_lim(rl_r_lim_file, std::ios::out);
+    bv_t r_lim;
+    sdsl::load_from_file(r_lim, p_gram.rules_lim_file);
+    bv_t::select_1_type r_lim_ss(&r_lim);
 
-    size_t run_len=1;
-    size_t new_id = p_gram.r-1;
-    size_t tmp_sym;
-    bit_hash_table<size_t, 44> ht;
-    string_t pair(2,sdsl::bits::hi(rules.size())+1);
+    sdsl::int_vector<> rules;
+    sdsl::load_from_file(rules, p_gram.rules_file);
 
-    for(size_t i=0;i<p_gram.sigma;i++){
-        rl_rules.push_back(i);
-        rl_r_lim.push_back(true);
-    }
+    typedef bit_hash_table<size_t, 44> rl_table_t;
+    uint8_t width = sdsl::bits::hi(rules.size())+1;
+
+    //the runs do not cross the limits of the rules, so the ranges of rules are scanned
+    // independently. scan_runs calls f(sym, run_len, last) for every run of a range, where
+    // last tells if the run ends a rule
+    std::vector<rule_range> ranges = rule_ranges(p_gram.sigma, p_gram.r-1, r_lim_ss, 4*pool.size());
+    size_t n_ranges = ranges.size();
+    auto scan_runs = [&](const rule_range& range, auto&& f){
+        size_t run_len=1;
+        for(size_t i=range.start+1;i<=range.end;i++){
+            if(r_lim[i-1] || rules[i]!=rules[i-1]){
+                f(rules[i-1], run_len, r_lim[i-1]);
+                run_len=0;
+            }
+            run_len++;
+        }
+    };
 
-    size_t i=p_gram.sigma+1;
-    while(i<rules.size()-p_gram.c){
-        //std::cout<<rules[i-1]<<" ";
-        if(rules[i]!=rules[i-1] || r_lim[i-1]){
+    //1) every range collects its distinct runs of length > 1 (the value of a run is its
+    // rank of first occurrence in the range) and counts the symbols it will produce
+    std::vector<std::unique_ptr<rl_table_t>> range_runs(n_ranges);
+    std::vector<size_t> range_syms(n_ranges+1, 0);
+    pool.parallel_for(n_ranges, [&](size_t r_id, size_t){
+        auto runs = std::make_unique<rl_table_t>();
+        string_t pair(2, width);
+        size_t n_syms=0;
+        scan_runs(ranges[r_id], [&](size_t sym, size_t run_len, bool){
             if(run_len>1){
-                pair.write(0, rules[i-1]);
+                pair.write(0, sym);
                 pair.write(1, run_len);
-                auto res = ht.insert(pair.data(), pair.n_bits(), 0);
-                if(res.second){
-                    tmp_sym = new_id;
-                    ht.insert_value_at(*res.first, tmp_sym);
-                    new_id++;
-                }else{
-                    tmp_sym = res.first.value();
-                }
-                //std::cout<<"("<<pair[0]<<" "<<pair[1]<<")"<<" "<<tmp_sym<<std::endl;
-            }else{
-                tmp_sym = rules[i-1];
+                runs->insert(pair.data(), pair.n_bits(), runs->size());
             }
-            run_len=0;
+            n_syms++;
+        });
+        range_runs[r_id] = std::move(runs);
+        range_syms[r_id+1] = n_syms;
+    });
 
-            rl_rules.push_back(tmp_sym);
-            if(r_lim[i-1]){
-                rl_r_lim[rl_rules.size()-1] = true;
-            }
+    //2) the new nonterminals get their ids in the order their runs first appear in the
+    // grammar: the ranges are visited from left to right, and a run gets the next id if
+    // no previous range had it
+    rl_table_t ht;
+    std::vector<std::vector<size_t>> run_ids(n_ranges);
+    size_t new_id = p_gram.r-1;
+    string_t pair(2, width);
+    range_syms[0] = p_gram.sigma;
+    for(size_t r_id=0;r_id<n_ranges;r_id++){
+        auto& runs = *range_runs[r_id];
+        key_wrapper key_w{width, runs.description_bits(), runs.get_data()};
+        run_ids[r_id].reserve(runs.size());
+        for(auto const& phrase : runs){
+            pair.write(0, key_w.read(phrase, 0));
+            pair.write(1, key_w.read(phrase, 1));
+            auto res = ht.insert(pair.data(), pair.n_bits(), new_id);
+            if(res.second) new_id++;
+            run_ids[r_id].push_back(res.first.value());
         }
-        /*if(r_lim[i-1]){
-            std::cout<<""<<std::endl;
-        }*/
-        run_len++;
-        i++;
+        range_syms[r_id+1] += range_syms[r_id];
     }
 
-    assert(r_lim[i-1]);
-    if(run_len>1){
-        pair.write(0, rules[i-1]);
-        pair.write(1, run_len);
-        auto res = ht.insert(pair.data(), pair.n_bits(), 0);
-        if(res.second){
-            tmp_sym = new_id;
-            ht.insert_value_at(*res.first, tmp_sym);
-        }else{
-            tmp_sym = res.first.value();
-        }
-    }else{
-        tmp_sym = rules[i-1];
+    size_t c_start = rules.size()-p_gram.c;
+    size_t new_size = range_syms[n_ranges] + 2*ht.size() + p_gram.c;
+    sdsl::int_vector<> rl_rules(new_size, 0, 64);
+    bv_t rl_r_lim(new_size, false);
+
+    for(size_t i=0;i<p_gram.sigma;i++){
+        rl_rules[i] = i;
+        rl_r_lim[i] = true;
     }
-    rl_rules.push_back(tmp_sym);
-    rl_r_lim[rl_rules.size()-1] = true;
 
-    const bitstream<buff_t>& stream = ht.get_data();
-    key_wrapper key_w{pair.width(), ht.description_bits(), stream};
-    new_id = p_gram.r-1;
+    //3) every range writes its symbols at its offset of the new rules. The cells have 64
+    // bits, so the ranges never write the same word of rl_rules
+    pool.parallel_for(n_ranges, [&](size_t r_id, size_t){
+        auto& runs = *range_runs[r_id];
+        string_t r_pair(2, width);
+        size_t pos = range_syms[r_id];
+        scan_runs(ranges[r_id], [&](size_t sym, size_t run_len, bool last){
+            if(run_len>1){
+                r_pair.write(0, sym);
+                r_pair.write(1, run_len);
+                sym = run_ids[r_id][runs.find(r_pair.data(), r_pair.n_bits()).first.value()];
+            }
+            rl_rules[pos] = sym;
+            if(last) atomic_set(rl_r_lim, pos);
+            pos++;
+        });
+        assert(pos==range_syms[r_id+1]);
+        range_runs[r_id].reset();
+    });
+
+    //the run-length rules
+    size_t pos = range_syms[n_ranges];
+    key_wrapper key_w{width, ht.description_bits(), ht.get_data()};
     for(auto const& phrase : ht){
-        rl_rules.push_back(key_w.read(phrase, 0));
-        rl_rules.push_back(key_w.read(phrase, 1));
-        rl_r_lim[rl_rules.size()-1] = true;
-        is_rl_bv[new_id++]=true;
+        rl_rules[pos++] = key_w.read(phrase, 0);
+        rl_rules[pos++] = key_w.read(phrase, 1);
+        rl_r_lim[pos-1] = true;
     }
-    is_rl_bv[new_id]=false;
-
-    for(size_t k=rules.size()-p_gram.c;k<rules.size();k++){
-        rl_rules.push_back(rules[k]);
+    bv_t is_rl(p_gram.r+ht.size(), false);
+    for(size_t i=p_gram.r-1;i<p_gram.r-1+ht.size();i++){
+        is_rl[i] = true;
     }
-    rl_r_lim[rl_rules.size()-1] = true;
+
+    //the compressed string
+    std::vector<rule_range> c_ranges;
+    split_rule(p_gram.r-1, c_start, rules.size(), pool.size(), c_ranges);
+    pool.parallel_for(c_ranges.size(), [&](size_t r_id, size_t){
+        for(size_t k=c_ranges[r_id].start;k<c_ranges[r_id].end;k++){
+            rl_rules[pos+k-c_start] = rules[k];
+        }
+    });
+    rl_r_lim[new_size-1] = true;
 
     p_gram.r+=ht.size();
     p_gram.g = rl_rules.size();
@@ -1312,14 +1560,10 @@ void lpg_build::run_length_compress(lpg_build::plain_grammar_t &p_gram, sdsl::ca
     std::cout<<"      Number of new nonterminals: "<<ht.size()<<std::endl;
     std::cout<<"      Compression ratio:          "<<float(rl_rules.size())/float(rules.size())<<std::endl;
 
-    rules.close();
-    r_lim.close();
-    rl_rules.close();
-    rl_r_lim.close();
-    is_rl_bv.close();
-
-    rename(rl_rules_file.c_str(), p_gram.rules_file.c_str());
-    rename(rl_r_lim_file.c_str(), p_gram.rules_lim_file.c_str());
+    sdsl::store_to_file(rl_rules, p_gram.rules_file);
+    sdsl::store_to_file(rl_r_lim, p_gram.rules_lim_file);
+    sdsl::store_to_file(is_rl, p_gram.is_rl_file);
+    p_stats.print("      ");
 }
 
 //lpg_build::plain_grammar_t lpg_build::repair_compress(lpg_build::plain_grammar_t &p_gram, sdsl::cache_config &config) {
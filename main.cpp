@@ -3,7 +3,10 @@
 
 #include "third-party/CLI11.hpp"
 #include "lpg/lpg_index.hpp"
+#include "lpg/lpg_server.hpp"
 #include <filesystem>
+#include <sstream>
+#include <algorithm>
 
 void generate_random_samples(const std::string &file, const std::string &o_file, const uint32_t& len, const uint32_t& samples){
 
@@ -30,21 +33,46 @@ void generate_random_samples(const std::string &file, const std::string &o_file,
     }
 }
 
+//parse a range "START:END" (inclusive). The fields can also be separated by ',' or blanks
+bool parse_range(const std::string& str, std::pair<size_t, size_t>& range){
+    std::string tmp = str;
+    std::replace(tmp.begin(), tmp.end(), ':', ' ');
+    std::replace(tmp.begin(), tmp.end(), ',', ' ');
+    std::stringstream ss(tmp);
+    if(!(ss >> range.first >> range.second)) return false;
+    return range.first <= range.second;
+}
 
 struct arguments{
     std::string input_file;
     std::string output_file;
     std::string patter_list_file;
     std::vector<std::string> patterns;
+    std::vector<std::string> ranges;
+    std::string range_list_file;
+    std::string socket_file;
 
     std::string tmp_dir;
+    std::string resume_dir;
     size_t n_threads{};
     float hbuff_frac=0.5;
+    size_t scratch_budget=0;
+    size_t mem_budget=0;
     bool ver=false;
 
     size_t pat_len{};
     size_t n_pat{};
     bool ind_report=false;
+    bool count_only=false;
+    bool print_occ=false;
+    bool doc_list=false;
+    bool doc_lines=false;
+    bool build_kr=false;
+    size_t prefix_k=0;
+    std::string grid_type="rrr";
+    bool level_grid=false;
+    bool shared_dict=false;
+    bool checkpoint=false;
 
     std::string version="0.0.1.alpha";
 
@@ -65,26 +93,52 @@ static void parse_app(CLI::App& app, struct arguments& args){
 
     CLI::App *index = app.add_subcommand("index", "Create an LPG self-index");
     CLI::App *search = app.add_subcommand("search", "Search for a pattern in the index");
+    CLI::App *extract = app.add_subcommand("extract", "Extract text substrings from the index");
+    CLI::App *serve = app.add_subcommand("serve", "Keep the index in memory and answer queries from stdin or a socket");
     CLI::App *rand_pat = app.add_subcommand("rpat", "Extract random patterns from the text");
 
     app.set_help_all_flag("--help-all", "Expand all help");
     app.add_flag("-v,--version", args.ver, "Print the software version and exit");
 
-    index->add_option("TEXT", args.input_file, "Input text file")->check(CLI::ExistingFile)->required();
+    index->add_option("TEXT", args.input_file, "Input text file, or a directory with the documents of a collection")->check(CLI::ExistingPath)->required();
     index->add_option("-o,--output-file", args.output_file, "Output file")->type_name("");
     index->add_option("-t,--threads", args.n_threads, "Maximum number of threads")->default_val(1);
     index->add_option("-f,--hbuff", args.hbuff_frac, "Hashing step will use at most INPUT_SIZE*f bytes. O means no limit (def. 0.5)")-> check(CLI::Range(0.0,1.0))-> default_val(0.5);
     index->add_option("-T,--tmp", args.tmp_dir, "Temporal folder (def. /tmp/lpg_index.xxxx)")->check(CLI::ExistingDirectory)->default_val("/tmp");
+    auto doc_list_opt = index->add_flag("-L,--doc-list", args.doc_list, "TEXT is a file with the paths of the documents of a collection (one per line)");
+    index->add_flag("-n,--doc-lines", args.doc_lines, "Every line of TEXT is a document of a collection")->excludes(doc_list_opt);
+    index->add_flag("-k,--kr", args.build_kr, "Store Karp-Rabin fingerprints of the rules to speed up the search of long patterns");
+    index->add_option("-P,--prefix-cache", args.prefix_k, "Cache the first K bytes of the grid rows and columns to speed up the search. 0 means no cache (def. 0)")->check(CLI::Range(0, 64))->default_val(0);
+    index->add_option("-G,--grid", args.grid_type, "Data structure of the grid: rrr (compressed wavelet tree), plain (wavelet tree over plain bitvectors) or wm (wavelet matrix). The last two are faster but larger (def. rrr)")->check(CLI::IsMember({"rrr", "plain", "wm"}))->default_val("rrr");
+    index->add_flag("-V,--level-grid", args.level_grid, "Partition the grid by the level of the rules, so the search of a cut only visits the levels that can contain it");
+    index->add_option("-B,--scratch-budget", args.scratch_budget, "Maximum MB of temporal files the construction can keep in the temporal folder. 0 means no limit (def. 0)")->default_val(0);
+    index->add_option("-M,--mem-budget", args.mem_budget, "MB of RAM for the parse of the text. The parsing rounds run in memory once the parse fits in this budget. 0 keeps all the rounds on disk (def. 0)")->default_val(0);
+    index->add_flag("-D,--shared-dict", args.shared_dict, "The threads insert the phrases into one dictionary shared by all of them. It saves the merge of the thread dictionaries, but the dictionary has to fit in RAM (-f is ignored)");
+    index->add_flag("-C,--checkpoint", args.checkpoint, "Record the stages of the construction in the temporal folder, so an interrupted construction can be resumed with --resume");
+    index->add_option("-R,--resume", args.resume_dir, "Resume an interrupted construction from its temporal folder. The input and the index options have to be the same")->check(CLI::ExistingDirectory)->type_name("DIR");
 
     search->add_option("INDEX", args.input_file, "Input LPG index file")->check(CLI::ExistingFile)->required(true);
     search->add_flag("-r,--ind-report", args.ind_report, "Flag to report the result for each pattern individually");
+    search->add_flag("-c,--count", args.count_only, "Only count the occurrences (do not compute their positions)");
+    search->add_flag("-l,--list-occ", args.print_occ, "Print the positions of the occurrences (document:offset pairs if the index is a collection)");
     CLI::Option_group *opt = search->add_option_group("Pattern options");
     opt->add_option("-p,--patterns", args.patterns, "Pattern to search for in the index");
     opt->add_option("-F,--pattern-list", args.patter_list_file, "File with a pattern list");
     opt->require_option(1, 2);
-    //search->add_option("-t,--threads", args.n_threads, "Maximum number of threads")->default_val(1);
+    search->add_option("-t,--threads", args.n_threads, "Maximum number of threads")->default_val(1);
     //search->add_option("-o,--output-file", args.output_file, "Output file")->type_name("");
 
+    extract->add_option("INDEX", args.input_file, "Input LPG index file")->check(CLI::ExistingFile)->required(true);
+    CLI::Option_group *ext_opt = extract->add_option_group("Range options");
+    ext_opt->add_option("-r,--ranges", args.ranges, "Text range START:END (inclusive, 0-based) to extract");
+    ext_opt->add_option("-F,--range-list", args.range_list_file, "File with a list of ranges (one START:END per line)")->check(CLI::ExistingFile);
+    ext_opt->require_option(1, 2);
+    extract->add_option("-o,--output-file", args.output_file, "Output file (def. stdout)")->type_name("");
+
+    serve->add_option("INDEX", args.input_file, "Input LPG index file")->check(CLI::ExistingFile)->required(true);
+    serve->add_option("-s,--socket", args.socket_file, "Unix domain socket to listen in (def. stdin/stdout)")->type_name("");
+    serve->add_option("-t,--threads", args.n_threads, "Maximum number of threads")->default_val(1);
+
     rand_pat->add_option("TEXT", args.input_file, "Input text file")->check(CLI::ExistingFile)->required();
     rand_pat->add_option("PAT_LEN", args.pat_len, "Pattern length")->required()->check(CLI::Range(5, 10000));
     rand_pat->add_option("N_PATS", args.n_pat, "Pattern length")->required()->check(CLI::Range(1, std::numeric_limits<int>::max()));
@@ -105,12 +159,37 @@ int main(int argc, char** argv) {
 
     if(app.got_subcommand("index")) {
 
-        lpg_index g(args.input_file, args.tmp_dir, args.n_threads, args.hbuff_frac);
+        collection_mode mode = SINGLE_TEXT;
+        if(args.doc_list){
+            mode = DOC_LIST;
+        }else if(args.doc_lines){
+            mode = DOC_LINES;
+        }else if(std::filesystem::is_directory(args.input_file)){
+            mode = DOC_DIRECTORY;
+        }
+        if(mode!=DOC_DIRECTORY && std::filesystem::is_directory(args.input_file)){
+            std::cerr<<"Error: "<<args.input_file<<" is a directory"<<std::endl;
+            exit(1);
+        }
+
+        grid_backend backend = GRID_RRR;
+        if(args.grid_type=="plain"){
+            backend = GRID_PLAIN;
+        }else if(args.grid_type=="wm"){
+            backend = GRID_WM;
+        }
 
         if(args.output_file.empty()){
-            args.output_file = std::filesystem::path(args.input_file).filename();
+            auto in_path = std::filesystem::path(args.input_file).lexically_normal();
+            if(!in_path.has_filename()) in_path = in_path.parent_path();//a directory ending with '/'
+            args.output_file = in_path.filename();
         }
         args.output_file = std::filesystem::path(args.output_file).replace_extension(".lpg_idx");
+        std::string doc_names_file = std::filesystem::path(args.output_file).replace_extension(".docs");
+
+        lpg_index g(args.input_file, args.tmp_dir, args.n_threads, args.hbuff_frac, args.scratch_budget*1024*1024,
+                    mode, doc_names_file, args.build_kr, args.prefix_k, backend, args.level_grid,
+                    args.mem_budget*1024*1024, args.resume_dir, args.shared_dict, args.checkpoint);
 
         std::cout<<"Saving the self-index to file "<<args.output_file<<std::endl;
         sdsl::store_to_file(g, args.output_file);
@@ -123,6 +202,9 @@ int main(int argc, char** argv) {
         std::cout<<"  Index name:                                              "<<args.input_file<<std::endl;
         std::cout<<"  Index size:                                              "<<sdsl::size_in_bytes(g)<<" bytes "<<std::endl;
         std::cout<<"  Orig. text len:                                          "<<g.text_size()<<std::endl;
+        if(g.is_collection()){
+            std::cout<<"  Number of documents:                                     "<<g.n_docs()<<std::endl;
+        }
         std::cout<<"  Number of bits in the index per input text symbol (bps): "<<g.bps()<<std::endl;
         std::set<std::string> patterns_set;
 
@@ -165,7 +247,7 @@ int main(int argc, char** argv) {
 //        }
      if(!args.patterns.empty()){
          std::cout<<"Searching for the patterns "<<std::endl;
-         g.search(args.patterns, args.ind_report
+         g.search(args.patterns, args.ind_report, args.n_threads, args.count_only, args.print_occ
 #ifdef CHECK_OCC
 			                    ,file
 #endif
@@ -187,6 +269,47 @@ int main(int argc, char** argv) {
     }
 	// g.search(args.patterns);
     // g.search(args.patter_list_file);
+    } else if(app.got_subcommand("extract")){
+        std::vector<std::pair<size_t, size_t>> ranges;
+        std::pair<size_t, size_t> range;
+        for(auto const& str : args.ranges){
+            if(!parse_range(str, range)){
+                std::cerr<<"Error: invalid range "<<str<<std::endl;
+                exit(1);
+            }
+            ranges.push_back(range);
+        }
+        if(!args.range_list_file.empty()){
+            std::fstream in(args.range_list_file, std::ios::in);
+            std::string line;
+            while (std::getline(in, line)) {
+                if(line.empty()) continue;
+                if(!parse_range(line, range)){
+                    std::cerr<<"Error: invalid range "<<line<<std::endl;
+                    exit(1);
+                }
+                ranges.push_back(range);
+            }
+        }
+
+        lpg_index g;
+        sdsl::load_from_file(g, args.input_file);
+        if(args.output_file.empty()){
+            g.extract(ranges, std::cout);
+        }else{
+            std::ofstream out(args.output_file, std::ios::out | std::ios::binary);
+            g.extract(ranges, out);
+        }
+    } else if(app.got_subcommand("serve")){
+        lpg_index g;
+        sdsl::load_from_file(g, args.input_file);
+        lpg_server server(g, args.n_threads);
+        if(args.socket_file.empty()){
+            std::cerr<<"Serving queries from the standard input"<<std::endl;
+            server.serve_stdio();
+        }else{
+            server.serve_socket(args.socket_file);
+        }
     } else if(app.got_subcommand("rpat")){
         if(args.output_file.empty()){
             args.output_file = std::filesystem::path(args.input_file).filename();
@@ -22,12 +22,13 @@
 #ifndef INCLUDED_SDSL_WM_INT
 #define INCLUDED_SDSL_WM_INT
 
-#include "sdsl_concepts.hpp"
-#include "int_vector.hpp"
-#include "rank_support_v.hpp"
-#include "select_support_mcl.hpp"
-#include "wt_helper.hpp"
-#include "util.hpp"
+#include <sdsl/sdsl_concepts.hpp>
+#include <sdsl/int_vector.hpp>
+#include <sdsl/rank_support_v.hpp>
+#include <sdsl/select_support_mcl.hpp>
+#include <sdsl/wt_helper.hpp>
+#include <sdsl/util.hpp>
+#include "wt_par_helper.hpp"
 #include <set> // for calculating the alphabet size
 #include <map> // for mapping a symbol to its lexicographical index
 #include <algorithm> // for std::swap
@@ -219,6 +220,75 @@ class wm_int
             }
         }
 
+        //! In-memory constructor
+        /*! \param rac         Sequence for which the wm_int should be build. It is used as working
+         *                     space and it is released after the construction.
+         *  \param pool        Thread pool whose workers build every level of the matrix. It has to
+         *                     provide size() and parallel_for(n, f(i, worker_id)).
+         *  \param max_level   Maximal level of the wavelet matrix. If set to 0, determined automatically.
+         *
+         *  The matrix is the same as the one of the semi-external constructor. Every level is
+         *  split into blocks of positions: the bits of a block are computed in one pass, and a
+         *  second pass moves the value of position i to rank0(i) if its bit is 0 and to
+         *  zeros+rank1(i) otherwise.
+         */
+        template<class t_pool>
+        wm_int(int_vector<64>& rac, t_pool& pool, uint32_t max_level=0) : m_size(rac.size())
+        {
+            if (0 == m_size)
+                return;
+            m_sigma = 0; // init sigma
+            wt_par_level lvl(m_size, pool);
+
+            value_type x = lvl.max_value(rac, pool);  // biggest value in rac
+            if (max_level == 0) {
+                m_max_level = bits::hi(x)+1; // we need max_level bits to represent all values in the range [0..x]
+            } else {
+                m_max_level = max_level;
+            }
+
+            bit_vector tree(m_size*m_max_level, 0);
+            int_vector<64> tmp(m_size, 0);
+            m_zero_cnt = int_vector<64>(m_max_level, 0); // zeros at level i
+
+            for (uint32_t k=0; k<m_max_level; ++k) {
+                const uint64_t mask  = 1ULL<<(m_max_level-k-1);
+                size_type      zeros = lvl.compute(rac, mask, tree.data(), k*m_size, pool);
+                m_zero_cnt[k] = zeros;
+                pool.parallel_for(lvl.blocks(), [&](size_t b, size_t) {
+                    size_type r0 = lvl.rank0(lvl.begin(b));
+                    for (size_type i=lvl.begin(b); i<lvl.end(b); ++i) {
+                        if (lvl[i]) {
+                            tmp[zeros + i - r0] = rac[i];
+                        } else {
+                            tmp[r0++] = rac[i];
+                        }
+                    }
+                });
+                rac.swap(tmp);
+            }
+            tmp.resize(0);
+
+            // the equal values are contiguous in the last level
+            std::vector<size_type> blk_sigma(lvl.blocks(), 0);
+            pool.parallel_for(lvl.blocks(), [&](size_t b, size_t) {
+                for (size_type i=lvl.begin(b); i<lvl.end(b); ++i) {
+                    blk_sigma[b] += (i == 0 or rac[i] != rac[i-1]);
+                }
+            });
+            for (auto const& s : blk_sigma)
+                m_sigma += s;
+            rac.resize(0);
+            m_tree = bit_vector_type(std::move(tree));
+            util::init_support(m_tree_rank, &m_tree);
+            util::init_support(m_tree_select0, &m_tree);
+            util::init_support(m_tree_select1, &m_tree);
+            m_rank_level = int_vector<64>(m_max_level, 0);
+            for (uint32_t k=0; k<m_rank_level.size(); ++k) {
+                m_rank_level[k] = m_tree_rank(k*m_size);
+            }
+        }
+
         //! Copy constructor
         wm_int(const wm_int& wt)
         {
@@ -29,6 +29,7 @@
 #include <sdsl/select_support_mcl.hpp>
 #include <sdsl/wt_helper.hpp>
 #include <sdsl/util.hpp>
+#include "wt_par_helper.hpp"
 #include <set> // for calculating the alphabet size
 #include <map> // for mapping a symbol to its lexicographical index
 #include <algorithm> // for std::swap
@@ -255,6 +256,113 @@ class wt_int
             util::init_support(m_tree_select1, &m_tree);
         }
 
+        //! In-memory constructor
+        /*! \param rac         Sequence for which the wt_int should be build. It is used as working
+         *                     space, so its content is undefined after the construction.
+         *  \param pool        Thread pool whose workers build every level of the tree. It has to
+         *                     provide size() and parallel_for(n, f(i, worker_id)).
+         *  \param max_level   Maximal level of the wavelet tree. If set to 0, determined automatically.
+         *    \par Time complexity
+         *        \f$ \Order{n\log|\Sigma|/t}\f$, where \f$t\f$ is the number of workers of the pool.
+         *    \par Space complexity
+         *        \f$ 128n + n\log|\Sigma| + O(n)\f$ bits.
+         *
+         *  The tree is the same as the one of the semi-external constructor. Level k is split
+         *  into blocks of positions (not of nodes), so a large node is processed by several
+         *  workers. The bits of a block are computed in one pass, and a second pass moves
+         *  every value to its place in the next level: a value of the node [s, e) goes to
+         *  s+rank0 if its bit is 0 and to s+zeros(node)+rank1 otherwise, both counted from s.
+         *  The limits of the node of the first position of a block are found with an
+         *  exponential search, as the sequence of the level is sorted by the top k bits.
+         */
+        template<class t_pool>
+        wt_int(int_vector<64>& rac, t_pool& pool, uint32_t max_level=0) : m_size(rac.size()) {
+            if (0 == m_size)
+                return;
+            m_sigma = 0;
+            wt_par_level lvl(m_size, pool);
+
+            value_type x = lvl.max_value(rac, pool);  // biggest value in rac
+            if (max_level == 0) {
+                m_max_level = bits::hi(x)+1; // max_level bits to represent all values range [0..x]
+            } else {
+                m_max_level = max_level;
+            }
+
+            bit_vector tree(m_size*m_max_level, 0);
+            int_vector<64> tmp(m_size, 0);
+            std::vector<size_type> blk_sigma(lvl.blocks(), 0);
+
+            uint64_t mask_old = 1ULL<<(m_max_level);
+            for (uint32_t k=0; k<m_max_level; ++k) {
+                const uint64_t mask_new = 1ULL<<(m_max_level-k-1);
+                lvl.compute(rac, mask_new, tree.data(), k*m_size, pool);
+
+                // the values with prefix p are contiguous in rac
+                auto in_node = [&](size_type i, uint64_t p) {
+                    return (rac[i]&mask_old) == p;
+                };
+                pool.parallel_for(lvl.blocks(), [&](size_t b, size_t) {
+                    size_type i = lvl.begin(b), end = lvl.end(b);
+                    while (i < end) {
+                        uint64_t  p    = rac[i]&mask_old;
+                        size_type s    = i, e = i+1;
+                        size_type step = 1;
+                        if (i == lvl.begin(b)) { // the node can start in a previous block
+                            while (step <= s and in_node(s-step, p)) {
+                                s -= step;
+                                step <<= 1;
+                            }
+                            size_type lo = (step <= s) ? s-step+1 : 0;
+                            while (lo < s) {
+                                size_type mid = lo + (s-lo)/2;
+                                if (in_node(mid, p)) s = mid; else lo = mid+1;
+                            }
+                            step = 1;
+                        }
+                        while (e-1+step < m_size and in_node(e-1+step, p)) {
+                            e += step;
+                            step <<= 1;
+                        }
+                        size_type hi = std::min<size_type>(e-1+step, m_size);
+                        while (e < hi) {
+                            size_type mid = e + (hi-e)/2;
+                            if (in_node(mid, p)) e = mid+1; else hi = mid;
+                        }
+
+                        size_type z_s  = lvl.rank0(s);
+                        size_type z_e  = lvl.rank0(e);
+                        size_type stop = std::min(e, end);
+                        if (k+1 < m_max_level) { // inner node
+                            size_type r0 = lvl.rank0(i);
+                            for (; i<stop; ++i) {
+                                if (lvl[i]) {
+                                    tmp[s + (z_e-z_s) + (i-s) - (r0-z_s)] = rac[i];
+                                } else {
+                                    tmp[s + (r0++ - z_s)] = rac[i];
+                                }
+                            }
+                        } else { // leaf node, counted by the block where it starts
+                            if (s >= lvl.begin(b))
+                                blk_sigma[b] += (z_e > z_s) + (e-s > z_e-z_s);
+                            i = stop;
+                        }
+                    }
+                });
+                if (k+1 < m_max_level)
+                    rac.swap(tmp);
+                mask_old += mask_new;
+            }
+            for (auto const& s : blk_sigma)
+                m_sigma += s;
+            tmp.resize(0);
+            rac.resize(0);
+            m_tree = bit_vector_type(std::move(tree));
+            util::init_support(m_tree_rank, &m_tree);
+            util::init_support(m_tree_select0, &m_tree);
+            util::init_support(m_tree_select1, &m_tree);
+        }
+
         //! Copy constructor
         wt_int(const wt_int& wt) {
             copy(wt);
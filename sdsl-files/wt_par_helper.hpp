@@ -0,0 +1,132 @@
+/*! \file wt_par_helper.hpp
+    \brief wt_par_helper.hpp contains the helper used by wt_int and wm_int to
+           build their levels in memory with the workers of a thread pool.
+*/
+#ifndef INCLUDED_SDSL_WT_PAR_HELPER
+#define INCLUDED_SDSL_WT_PAR_HELPER
+
+#include <sdsl/int_vector.hpp>
+#include <sdsl/bits.hpp>
+#include <algorithm>
+#include <vector>
+
+//! Namespace for the succinct data structure library.
+namespace sdsl
+{
+
+//! Bits of one level of a wavelet tree (or matrix) computed in parallel.
+/*!
+ *  The sequence of the level is split into blocks of whole 64-bit words, one
+ *  block per task, so the tasks never write the same word of the level. Besides
+ *  the bits, the helper keeps the number of zeros before every word, so rank0
+ *  of any position of the level takes O(1) time during the redistribution of the
+ *  values to the next level.
+ *
+ *  The pool has to provide size() and parallel_for(n, f(i, worker_id)).
+ */
+class wt_par_level
+{
+    public:
+
+        typedef int_vector<>::size_type size_type;
+
+    private:
+
+        size_type              m_size    = 0;
+        size_type              m_words   = 0;
+        std::vector<size_type> m_limits;   // word limits of the blocks
+        int_vector<64>         m_bits;     // bits of the level, aligned at 0
+        int_vector<64>         m_zeros;    // m_zeros[w] = number of zeros in m_bits before word w
+
+        //! OR the len least significant bits of word into the bit vector at bit offset off
+        static inline void atomic_or(uint64_t* data, size_type off, uint64_t word, uint8_t len) {
+            uint8_t   shift = off & 0x3FULL;
+            uint64_t* p     = data + (off >> 6);
+            if (word == 0)
+                return;
+            __atomic_fetch_or(p, word << shift, __ATOMIC_RELAXED);
+            if (shift > 0 and shift + len > 64) {
+                __atomic_fetch_or(p+1, word >> (64 - shift), __ATOMIC_RELAXED);
+            }
+        }
+
+    public:
+
+        template<class t_pool>
+        wt_par_level(size_type size, t_pool& pool) : m_size(size), m_words((size+63)>>6) {
+            size_type n_blocks = std::max<size_type>(1, std::min<size_type>(m_words, 4*pool.size()));
+            m_limits.resize(n_blocks+1);
+            for (size_type i=0; i<=n_blocks; ++i) {
+                m_limits[i] = (i*m_words)/n_blocks;
+            }
+            m_bits  = int_vector<64>(m_words, 0);
+            m_zeros = int_vector<64>(m_words+1, 0);
+        }
+
+        size_type blocks() const {
+            return m_limits.size()-1;
+        }
+
+        //! First position of the block
+        size_type begin(size_type block) const {
+            return std::min(m_limits[block] << 6, m_size);
+        }
+
+        //! Position after the last one of the block
+        size_type end(size_type block) const {
+            return std::min(m_limits[block+1] << 6, m_size);
+        }
+
+        //! Largest value of v (at least 1)
+        template<class t_pool>
+        uint64_t max_value(const int_vector<64>& v, t_pool& pool) const {
+            std::vector<uint64_t> blk_max(blocks(), 1);
+            pool.parallel_for(blocks(), [&](size_t b, size_t) {
+                uint64_t x = 1;
+                for (size_type i=begin(b); i<end(b); ++i) {
+                    x = std::max<uint64_t>(x, v[i]);
+                }
+                blk_max[b] = x;
+            });
+            return *std::max_element(blk_max.begin(), blk_max.end());
+        }
+
+        //! Compute the bits (v[i] & mask)!=0 of the level and OR them into tree at
+        //! bit offset tree_off. Returns the number of zeros of the level
+        template<class t_pool>
+        size_type compute(const int_vector<64>& v, uint64_t mask, uint64_t* tree, size_type tree_off, t_pool& pool) {
+            pool.parallel_for(blocks(), [&](size_t b, size_t) {
+                for (size_type w=m_limits[b]; w<m_limits[b+1]; ++w) {
+                    size_type i   = w << 6;
+                    uint8_t   len = std::min<size_type>(64, m_size-i);
+                    uint64_t  word = 0;
+                    for (uint8_t j=0; j<len; ++j) {
+                        word |= uint64_t((v[i+j] & mask) != 0) << j;
+                    }
+                    m_bits[w]    = word;
+                    m_zeros[w+1] = len - bits::cnt(word);
+                    atomic_or(tree, tree_off+i, word, len);
+                }
+            });
+            for (size_type w=0; w<m_words; ++w) {
+                m_zeros[w+1] += m_zeros[w];
+            }
+            return m_zeros[m_words];
+        }
+
+        //! Number of zeros in the level before position i
+        inline size_type rank0(size_type i) const {
+            size_type w = i >> 6;
+            uint8_t   r = i & 0x3FULL;
+            if (r == 0)
+                return m_zeros[w];
+            return m_zeros[w] + r - bits::cnt(m_bits[w] & bits::lo_set[r]);
+        }
+
+        inline bool operator[](size_type i) const {
+            return (m_bits[i >> 6] >> (i & 0x3FULL)) & 1ULL;
+        }
+};
+
+}// end namespace sdsl
+#endif
@@ -0,0 +1,61 @@
+//
+// Checks that count reports the same number of occurrences as locate, and that both match
+// a scan of the text, on repetitive texts with long runs of one symbol
+//
+
+#include "test_common.hpp"
+#include "lpg/lpg_index.hpp"
+
+static size_t naive_count(const std::string& text, const std::string& pattern){
+    size_t n_occ = 0;
+    for(size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1)) n_occ++;
+    return n_occ;
+}
+
+static bool check_text(const std::string& text, bool build_kr, std::mt19937_64& rng){
+    std::string dir = lpg_test::make_tmp_dir("lpg_count_test");
+    std::string input = lpg_test::write_text(dir, "text", text);
+    bool ok = true;
+    {
+        lpg_index idx(input, dir, 2, 0.5, 0, SINGLE_TEXT, "", build_kr);
+
+        std::vector<std::string> patterns;
+        for(size_t i = 0; i < 300; ++i){
+            size_t len = 2 + rng() % 40;
+            size_t pos = rng() % (text.size() - len);
+            patterns.push_back(text.substr(pos, len));
+        }
+        //patterns inside and across the runs of one symbol
+        for(size_t len : {2, 3, 5, 8, 13, 40}){
+            patterns.emplace_back(len, 'a');
+            patterns.push_back("b" + std::string(len, 'a'));
+            patterns.push_back(std::string(len, 'a') + "b");
+        }
+
+        for(const auto& pattern : patterns){
+            std::set<lpg_index::size_type> occ;
+            idx.locate(pattern, occ);
+            size_t n_occ = idx.count(pattern);
+            size_t exp_occ = naive_count(text, pattern);
+            ok &= lpg_test::check(occ.size() == exp_occ, "locate(" + pattern + ") = " +
+                                  std::to_string(occ.size()) + ", expected " + std::to_string(exp_occ));
+            ok &= lpg_test::check(n_occ == occ.size(), "count(" + pattern + ") = " +
+                                  std::to_string(n_occ) + ", locate reports " + std::to_string(occ.size()));
+            if(!ok) break;
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return ok;
+}
+
+int main(){
+    std::mt19937_64 rng(7);
+    bool ok = true;
+    for(size_t sigma : {2, 4, 26}){
+        ok &= check_text(lpg_test::repetitive_text(50000, sigma, 100, rng), false, rng);
+        ok &= check_text(lpg_test::repetitive_text(50000, sigma, 100, rng), true, rng);
+    }
+    if(!ok) return 1;
+    std::cout<<"count_test: OK"<<std::endl;
+    return 0;
+}
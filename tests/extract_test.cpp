@@ -0,0 +1,58 @@
+//
+// Compares the substrings extracted from the index with the text. The texts contain long
+// runs of one symbol, so the grammar has run-length rules whose second child is a terminal
+//
+
+#include "test_common.hpp"
+#include "lpg/lpg_index.hpp"
+
+static bool check_text(const std::string& text, size_t n_threads, std::mt19937_64& rng){
+    std::string dir = lpg_test::make_tmp_dir("lpg_extract_test");
+    std::string input = lpg_test::write_text(dir, "text", text);
+    bool ok = true;
+    {
+        lpg_index idx(input, dir, n_threads, 0.5);
+
+        std::string out;
+        idx.extract(0, text.size() - 1, out);
+        ok &= lpg_test::check(out == text, "extraction of the whole text");
+
+        //ranges starting and ending at every position of some runs
+        for(size_t i = 0; i < text.size() && ok; i += 1 + rng() % 97){
+            size_t j = std::min(text.size() - 1, i + rng() % 600);
+            idx.extract(i, j, out);
+            ok &= lpg_test::check(out == text.substr(i, j - i + 1),
+                                  "extraction of [" + std::to_string(i) + "," + std::to_string(j) + "]");
+        }
+        for(size_t i = 0; i + 1 < text.size() && ok; ++i){
+            if(text[i] != text[i + 1]) continue;
+            size_t j = i;
+            while(j + 1 < text.size() && text[j + 1] == text[i]) j++;
+            size_t mid = i + (j - i) / 2;
+            for(auto [s, e] : {std::make_pair(i, j), std::make_pair(mid, j), std::make_pair(i, mid),
+                               std::make_pair(mid, std::min(text.size() - 1, j + 5)),
+                               std::make_pair(i > 3 ? i - 3 : 0, mid)}){
+                idx.extract(s, e, out);
+                ok &= lpg_test::check(out == text.substr(s, e - s + 1),
+                                      "extraction of the run [" + std::to_string(s) + "," + std::to_string(e) + "]");
+            }
+            i = j;
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return ok;
+}
+
+int main(){
+    std::mt19937_64 rng(42);
+    bool ok = true;
+    ok &= check_text(std::string(5000, 'a'), 1, rng);
+    ok &= check_text("b" + std::string(3000, 'a') + "c" + std::string(17, 'a') + "b" + std::string(3000, 'a') + "c", 1, rng);
+    for(size_t sigma : {2, 4, 26}){
+        ok &= check_text(lpg_test::repetitive_text(50000, sigma, 200, rng), 1, rng);
+        ok &= check_text(lpg_test::repetitive_text(50000, sigma, 200, rng), 4, rng);
+    }
+    if(!ok) return 1;
+    std::cout<<"extract_test: OK"<<std::endl;
+    return 0;
+}
@@ -0,0 +1,69 @@
+//
+// Helpers shared by the tests of the index
+//
+
+#ifndef LPG_COMPRESSOR_TEST_COMMON_HPP
+#define LPG_COMPRESSOR_TEST_COMMON_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <filesystem>
+#include <unistd.h>
+
+namespace lpg_test {
+
+    //fresh folder for the input and the temporal files of one test
+    inline std::string make_tmp_dir(const std::string& prefix){
+        std::string tmpl = (std::filesystem::temp_directory_path() / (prefix + ".XXXXXX")).string();
+        if(mkdtemp(tmpl.data()) == nullptr){
+            std::cout<<"Error: cannot create the folder "<<tmpl<<std::endl;
+            exit(1);
+        }
+        return tmpl;
+    }
+
+    //write the text followed by the '\0' the index expects at the end
+    inline std::string write_text(const std::string& dir, const std::string& name, const std::string& text){
+        std::string path = dir + "/" + name;
+        std::ofstream ofs(path, std::ios::binary);
+        ofs.write(text.data(), (std::streamsize)text.size());
+        ofs.put('\0');
+        return path;
+    }
+
+    //random text over sigma symbols with runs of one symbol of up to max_run copies and
+    // substrings copied from earlier positions, so the grammar has run-length rules
+    // of terminals and nonterminals
+    inline std::string repetitive_text(size_t len, size_t sigma, size_t max_run, std::mt19937_64& rng){
+        std::string text;
+        text.reserve(len + max_run);
+        while(text.size() < len){
+            switch(rng() % 3){
+                case 0:
+                    text.append(1 + rng() % max_run, char('a' + rng() % sigma));
+                    break;
+                case 1:
+                    if(!text.empty()){
+                        size_t src = rng() % text.size();
+                        size_t cnt = 1 + rng() % std::min<size_t>(text.size() - src, 300);
+                        for(size_t i = 0; i < cnt; ++i) text.push_back(text[src + i]);
+                        break;
+                    }
+                    [[fallthrough]];
+                default:
+                    for(size_t i = 0, cnt = 1 + rng() % 20; i < cnt; ++i) text.push_back(char('a' + rng() % sigma));
+            }
+        }
+        text.resize(len);
+        return text;
+    }
+
+    inline bool check(bool cond, const std::string& msg){
+        if(!cond) std::cout<<"FAILED: "<<msg<<std::endl;
+        return cond;
+    }
+}
+#endif //LPG_COMPRESSOR_TEST_COMMON_HPP
@@ -0,0 +1,89 @@
+//
+// Checks that the in-memory constructors of wt_int and wm_int (the ones that build the
+// levels with a thread pool) produce the same structures as the semi-external constructors
+// of sdsl, by comparing their serialized bytes
+//
+
+#include "test_common.hpp"
+#include "lpg/grid.hpp"
+#include "cdt/thread_pool.hpp"
+#include <sstream>
+
+typedef sdsl::wt_int<grid_rrr_bv, grid_rrr_bv::rank_1_type,
+                     grid_rrr_bv::select_1_type, grid_rrr_bv::select_0_type>      wt_rrr_t;
+typedef sdsl::wt_int<sdsl::bit_vector, grid_plain_rank,
+                     sdsl::select_support_mcl<1, 1>, sdsl::select_support_mcl<0, 1>> wt_plain_t;
+typedef sdsl::wm_int<sdsl::bit_vector, grid_plain_rank,
+                     sdsl::select_support_mcl<1, 1>, sdsl::select_support_mcl<0, 1>> wm_plain_t;
+
+template<class wt_t>
+static std::string serialized(const wt_t& wt){
+    std::stringstream ss;
+    wt.serialize(ss);
+    return ss.str();
+}
+
+template<class wt_t>
+static bool check_backend(const std::string& name, const std::vector<uint64_t>& values,
+                          const std::string& dir, size_t n_threads){
+    std::string file = dir + "/values";
+    {
+        sdsl::int_vector<> iv(values.size());
+        for(size_t i = 0; i < values.size(); ++i) iv[i] = values[i];
+        sdsl::util::bit_compress(iv);
+        sdsl::store_to_file(iv, file);
+    }
+    sdsl::int_vector_buffer<> buf(file);
+    wt_t se_wt(buf, values.size());
+
+    sdsl::int_vector<64> rac(values.size());
+    for(size_t i = 0; i < values.size(); ++i) rac[i] = values[i];
+    thread_pool pool(n_threads);
+    wt_t mem_wt(rac, pool);
+
+    return lpg_test::check(serialized(se_wt) == serialized(mem_wt),
+                           name + " with " + std::to_string(values.size()) + " values and " +
+                           std::to_string(n_threads) + " threads");
+}
+
+static bool check_values(const std::vector<uint64_t>& values, const std::string& dir){
+    bool ok = true;
+    for(size_t n_threads : {1, 3, 8}){
+        ok &= check_backend<wt_rrr_t>("wt_int<rrr_vector>", values, dir, n_threads);
+        ok &= check_backend<wt_plain_t>("wt_int<bit_vector>", values, dir, n_threads);
+        ok &= check_backend<wm_plain_t>("wm_int<bit_vector>", values, dir, n_threads);
+    }
+    return ok;
+}
+
+int main(){
+    std::mt19937_64 rng(25);
+    std::string dir = lpg_test::make_tmp_dir("lpg_wt_build_test");
+    bool ok = true;
+
+    for(size_t n : {1, 63, 64, 65, 1000, 200000}){
+        //random values
+        std::vector<uint64_t> values(n);
+        for(auto& v : values) v = rng() % (n + 1);
+        ok &= check_values(values, dir);
+
+        //skewed values: most of them are small and a few are large
+        std::geometric_distribution<uint64_t> geo(0.05);
+        for(auto& v : values) v = rng() % 100 == 0 ? rng() % (1UL << 30) : geo(rng);
+        ok &= check_values(values, dir);
+
+        //a permutation, as the columns of the grid
+        for(size_t i = 0; i < n; ++i) values[i] = i;
+        std::shuffle(values.begin(), values.end(), rng);
+        ok &= check_values(values, dir);
+
+        //a single symbol
+        std::fill(values.begin(), values.end(), 7);
+        ok &= check_values(values, dir);
+    }
+
+    std::filesystem::remove_all(dir);
+    if(!ok) return 1;
+    std::cout<<"wt_build_test: OK"<<std::endl;
+    return 0;
+}